@@ -0,0 +1,165 @@
+#include "rvcc.h"
+
+// 内存池，一次编译中所有的Obj、Function等对象都从这里分配，
+// AST节点则存放在连续的节点池中，以编号访问，
+// 编译结束后通过arenaFree一次性释放
+
+// 每个内存块的默认大小
+#define ARENA_CHUNK_SIZE (1 << 20)
+// 分配的对齐字节数
+#define ARENA_ALIGN 16
+
+// 内存块，通过链表串联起来
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+    ArenaChunk* Next; // 上一个分配的内存块
+    size_t Cap; // 可用字节数
+    size_t Used; // 已使用的字节数
+    // 内存块的数据紧跟在结构体后面
+    _Alignas(ARENA_ALIGN) char Data[];
+};
+
+// 当前正在分配的内存块
+static ArenaChunk* Cur;
+// 已分配给调用者的总字节数
+static size_t BytesUsed;
+
+// 从内存池中分配Size字节，返回的内存已清零
+void* arenaAlloc(size_t Size) {
+    Size = (Size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    // 当前内存块已满，申请新的内存块
+    if(!Cur || Cur->Cap - Cur->Used < Size) {
+        size_t Cap = Size > ARENA_CHUNK_SIZE ? Size : ARENA_CHUNK_SIZE;
+        // calloc申请的内存已清零，之后的分配无需再次清零
+        ArenaChunk* Chunk = calloc(1, sizeof(ArenaChunk) + Cap);
+        if(!Chunk)
+            error("out of memory");
+        Chunk->Cap = Cap;
+        Chunk->Next = Cur;
+        Cur = Chunk;
+    }
+
+    void* Ptr = Cur->Data + Cur->Used;
+    Cur->Used += Size;
+    BytesUsed += Size;
+    return Ptr;
+}
+
+// 释放内存池中的全部对象，包括节点池
+void arenaFree(void) {
+    while(Cur) {
+        ArenaChunk* Next = Cur->Next;
+        free(Cur);
+        Cur = Next;
+    }
+    BytesUsed = 0;
+    nodePoolFree();
+}
+
+// 返回已从内存池分配的字节数
+size_t arenaBytesUsed(void) {
+    return BytesUsed;
+}
+
+//
+// 节点池
+//
+
+// 节点池的初始容量
+#define NODE_POOL_INIT 1024
+
+Node* Nodes;
+NodeExt* NodeExts;
+
+// 节点池与附加表的容量及已使用的数量
+static uint32_t NodeCap, NodeCnt;
+static uint32_t ExtCap, ExtCnt;
+
+// 将连续存放的数组扩容到至少能容纳Cnt个元素，新增的部分清零
+static void* growArray(void* Arr, uint32_t* Cap, uint32_t Cnt, size_t Size) {
+    if(Cnt < *Cap)
+        return Arr;
+
+    uint32_t NewCap = *Cap ? *Cap * 2 : NODE_POOL_INIT;
+    if(NewCap <= *Cap)
+        error("too many AST nodes");
+    Arr = realloc(Arr, NewCap * Size);
+    if(!Arr)
+        error("out of memory");
+    memset((char*)Arr + *Cap * Size, 0, (NewCap - *Cap) * Size);
+    *Cap = NewCap;
+    return Arr;
+}
+
+// 新建一个节点，返回其编号
+NodeId newNode(NodeKind Kind) {
+    // 下标0保留为空节点及全空的附加字段
+    if(NodeCnt == 0) {
+        NodeCnt = 1;
+        ExtCnt = 1;
+        NodeExts = growArray(NodeExts, &ExtCap, 0, sizeof(NodeExt));
+    }
+    Nodes = growArray(Nodes, &NodeCap, NodeCnt, sizeof(Node));
+
+    NodeId Id = NodeCnt++;
+    Nodes[Id].Kind = Kind;
+    return Id;
+}
+
+// 为节点分配附加字段，返回附加字段
+NodeExt* newNodeExt(NodeId Id) {
+    NodeExts = growArray(NodeExts, &ExtCap, ExtCnt, sizeof(NodeExt));
+
+    Nodes[Id].Ext = ExtCnt;
+    return &NodeExts[ExtCnt++];
+}
+
+// 释放节点池与附加表
+void nodePoolFree(void) {
+    free(Nodes);
+    free(NodeExts);
+    Nodes = NULL;
+    NodeExts = NULL;
+    NodeCap = NodeCnt = 0;
+    ExtCap = ExtCnt = 0;
+}
+
+// 节点池与附加表占用的字节数
+size_t nodePoolBytes(void) {
+    return NodeCap * sizeof(Node) + ExtCap * sizeof(NodeExt);
+}
+
+// 已分配的节点数，包括下标0的空节点
+uint32_t nodeCount(void) {
+    return NodeCnt;
+}
+
+//
+// 可扩容的数组与遍历栈
+//
+
+// 在容量为*Cap的malloc数组中预留第Len个元素的位置，容量不足时翻倍
+void* growList(void* Arr, int Len, int* Cap, size_t Size) {
+    if(Len < *Cap)
+        return Arr;
+    *Cap = *Cap ? *Cap * 2 : 64;
+    Arr = realloc(Arr, *Cap * Size);
+    if(!Arr)
+        error("out of memory");
+    return Arr;
+}
+
+// 将节点压入遍历栈，空节点不入栈
+void pushNode(WorkStack* S, NodeId Id) {
+    if(!Id)
+        return;
+    S->Data = growList(S->Data, S->Top, &S->Cap, sizeof(NodeId));
+    S->Data[S->Top++] = Id;
+}
+
+// 释放遍历栈
+void freeWorkStack(WorkStack* S) {
+    free(S->Data);
+    *S = (WorkStack){0};
+}
@@ -0,0 +1,230 @@
+// 编译速度的基准测试
+// 生成几类压力程序，分别测量词法分析、语法分析、优化与代码生成所用的时间，
+// 每个阶段重复运行多次取中位数，每行输出一个JSON对象，便于脚本比较
+//
+// 终结符是流式生成的，parse在读取终结符时才进行词法分析，
+// 因此parse阶段的时间包含了词法分析，单独的词法分析时间见tokenize阶段
+
+#include "../rvcc.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 默认每个阶段重复运行的次数
+#define DEFAULT_REPEAT 5
+// 重复运行的最大次数
+#define MAX_REPEAT 101
+
+// 测量的阶段，与--stats的阶段相同，但不构造SSA形式
+static StatPhase Phases[] = {ST_TOKENIZE, ST_PARSE, ST_OPTIMIZE, ST_CODEGEN};
+
+// 程序规模的倍数
+static long Scale = 1;
+
+// 可以自动扩容的源程序缓冲区
+static char* Buf;
+static size_t BufLen, BufCap;
+
+// 向缓冲区追加格式化的文本
+static void emit(char* Fmt, ...) {
+    va_list VA;
+    while(true) {
+        va_start(VA, Fmt);
+        int N = vsnprintf(Buf + BufLen, BufCap - BufLen, Fmt, VA);
+        va_end(VA);
+        if(BufLen + N < BufCap) {
+            BufLen += N;
+            return;
+        }
+        BufCap = BufCap ? BufCap * 2 : 1 << 16;
+        Buf = realloc(Buf, BufCap);
+        if(!Buf)
+            error("out of memory");
+    }
+}
+
+// 很长的语句序列，只使用少量变量
+static void genStmts(void) {
+    long N = 200000 * Scale;
+    emit("{ a=1; b=2; c=3; ");
+    for(long I = 0; I < N; I++) {
+        switch(I % 4) {
+        case 0: emit("a=a+%ld; ", I % 97); break;
+        case 1: emit("b=a*3-b; "); break;
+        case 2: emit("c=(a+b)/7; "); break;
+        case 3: emit("a=c<b; "); break;
+        }
+    }
+    emit("return a+b+c; }");
+}
+
+// 大量不同的局部变量，每个变量都使用之前的变量赋值
+static void genLocals(void) {
+    long N = 20000 * Scale;
+    emit("{ v0=0; ");
+    for(long I = 1; I < N; I++)
+        emit("v%ld=v%ld+%ld; ", I, I / 2, I % 13);
+    emit("return v%ld; }", N - 1);
+}
+
+// 嵌套很深的括号
+static void genParens(void) {
+    long N = 1000000 * Scale;
+    emit("{ a=1; return ");
+    for(long I = 0; I < N; I++)
+        emit("(");
+    emit("a");
+    for(long I = 0; I < N; I++)
+        emit(")");
+    emit("; }");
+}
+
+// 很长的加法链
+static void genPlusChain(void) {
+    long N = 1000000 * Scale;
+    emit("{ a=1; b=2; return a");
+    for(long I = 1; I < N; I++)
+        emit(I % 2 ? "+b" : "+%ld", I % 100);
+    emit("; }");
+}
+
+// 大量嵌套的if与for，每组嵌套8层
+static void genNested(void) {
+    long N = 20000 * Scale;
+    emit("{ a=0; i=0; j=0; ");
+    for(long I = 0; I < N; I++) {
+        for(int D = 0; D < 8; D++) {
+            if(D % 2)
+                emit("for(%c=0; %c<%d; %c=%c+1) { ", "ij"[D % 4 / 2],
+                     "ij"[D % 4 / 2], D + 2, "ij"[D % 4 / 2], "ij"[D % 4 / 2]);
+            else
+                emit("if(a<%ld) { a=a+%d; ", I, D);
+        }
+        emit("a=a+i*j; ");
+        for(int D = 0; D < 8; D++)
+            emit("} ");
+    }
+    emit("return a; }");
+}
+
+// 压力程序
+static struct {
+    char* Name;
+    void (*Gen)(void);
+} Programs[] = {
+    {"stmts", genStmts},
+    {"locals", genLocals},
+    {"parens", genParens},
+    {"plus-chain", genPlusChain},
+    {"nested", genNested},
+};
+
+static int cmpDouble(const void* A, const void* B) {
+    double X = *(double*)A, Y = *(double*)B;
+    return (X > Y) - (X < Y);
+}
+
+// 返回T[0..N)的中位数，会将T排序
+static double median(double* T, int N) {
+    qsort(T, N, sizeof(double), cmpDouble);
+    return N % 2 ? T[N / 2] : (T[N / 2 - 1] + T[N / 2]) / 2;
+}
+
+// 只进行词法分析，返回终结符数
+static long lexAll(char* Src) {
+    long N = 0;
+    for(Token* Tok = tokenize(Src); Tok->Kind != TK_EOF; Tok = nextToken(Tok))
+        N++;
+    return N;
+}
+
+// 在子进程中测试一个程序，使峰值内存只包含该程序
+static void benchProgram(char* Name, char* Src, int Repeat, FILE* Null) {
+    double Times[ST_NUM][MAX_REPEAT];
+    long Tokens = 0;
+
+    for(int R = 0; R < Repeat; R++) {
+        double T0 = nowSec();
+        Tokens = lexAll(Src);
+        double T1 = nowSec();
+        Function* Prog = parse(tokenize(Src));
+        double T2 = nowSec();
+        optimize(Prog);
+        double T3 = nowSec();
+        codegen(Prog, Null);
+        fflush(Null);
+        double T4 = nowSec();
+        arenaFree();
+
+        Times[ST_TOKENIZE][R] = T1 - T0;
+        Times[ST_PARSE][R] = T2 - T1;
+        Times[ST_OPTIMIZE][R] = T3 - T2;
+        Times[ST_CODEGEN][R] = T4 - T3;
+    }
+
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+
+    size_t Len = strlen(Src);
+    for(size_t I = 0; I < sizeof(Phases) / sizeof(*Phases); I++) {
+        StatPhase P = Phases[I];
+        double T = median(Times[P], Repeat);
+        // 时间太短无法计时的阶段，吞吐量输出为0
+        double Rate = T > 0 ? 1 / T : 0;
+        printf("{\"program\":\"%s\",\"phase\":\"%s\",\"opt\":%d,\"bytes\":%zu,"
+               "\"tokens\":%ld,\"repeat\":%d,\"median_ms\":%.3f,"
+               "\"mb_per_s\":%.2f,\"tokens_per_s\":%.0f,\"peak_rss_kb\":%ld}\n",
+               Name, statPhaseName(P), OptLevel, Len, Tokens, Repeat, T * 1e3,
+               Len / 1e6 * Rate, Tokens * Rate, Usage.ru_maxrss);
+    }
+    fflush(stdout);
+}
+
+// 用法：rvcc_bench [ -O0 | -O1 ] [ 规模的倍数 [ 重复次数 ] ]
+int main(int Argc, char** Argv) {
+    int Repeat = DEFAULT_REPEAT;
+    int Pos = 0;
+    for(int I = 1; I < Argc; I++) {
+        if(!strcmp(Argv[I], "-O0") || !strcmp(Argv[I], "-O1")) {
+            OptLevel = Argv[I][2] - '0';
+            continue;
+        }
+        if(Pos++ == 0)
+            Scale = atol(Argv[I]);
+        else
+            Repeat = atoi(Argv[I]);
+    }
+    if(Scale < 1 || Repeat < 1 || Repeat > MAX_REPEAT) {
+        fprintf(stderr, "rvcc_bench [ -O0 | -O1 ] [ scale [ repeat ] ]\n");
+        return 1;
+    }
+
+    // 生成的代码写入/dev/null，只计算生成与格式化的时间
+    FILE* Null = fopen("/dev/null", "w");
+    if(!Null)
+        error("cannot open /dev/null: %s", strerror(errno));
+
+    int Failed = 0;
+    for(size_t I = 0; I < sizeof(Programs) / sizeof(*Programs); I++) {
+        pid_t Pid = fork();
+        if(Pid < 0)
+            error("fork: %s", strerror(errno));
+        if(Pid == 0) {
+            BufLen = 0;
+            Programs[I].Gen();
+            benchProgram(Programs[I].Name, Buf, Repeat, Null);
+            exit(0);
+        }
+
+        int Status;
+        if(waitpid(Pid, &Status, 0) < 0 || !WIFEXITED(Status) ||
+           WEXITSTATUS(Status) != 0) {
+            fprintf(stderr, "%s: benchmark failed\n", Programs[I].Name);
+            Failed++;
+        }
+    }
+
+    fclose(Null);
+    return Failed;
+}
@@ -0,0 +1,160 @@
+// 词法分析的吞吐量测试
+// 生成合成的源程序，分别使用标量、SSE2、AVX2的扫描实现进行词法分析，
+// 输出每种实现的吞吐量(MB/s)，并校验各实现得到的终结符序列一致
+
+#include "../rvcc.h"
+
+// 合成源程序的默认大小
+#define DEFAULT_SIZE (32 << 20)
+// 每种实现重复运行的次数，取最快的一次
+#define REPEAT 5
+
+// 简单的线性同余随机数
+static uint64_t Seed = 88172645463325252ULL;
+static uint32_t rnd(uint32_t N) {
+    Seed = Seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(Seed >> 33) % N;
+}
+
+// 为true时生成较长的连续字符：深缩进、长标识符、长数字，
+// 模拟机器生成的代码
+static bool LongRuns;
+
+// 追加随机长度的标识符
+static char* genIdent(char* P) {
+    static char First[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+    static char Rest[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+    int Len = LongRuns ? 16 + rnd(48) : 1 + rnd(24);
+    *P++ = First[rnd(sizeof(First) - 1)];
+    for(int I = 1; I < Len; I++)
+        *P++ = Rest[rnd(sizeof(Rest) - 1)];
+    return P;
+}
+
+// 生成大小约为Size的源程序，由带缩进的赋值与条件语句组成
+static char* genSource(size_t Size) {
+    // 末尾预留余量及'\0'
+    char* Buf = calloc(1, Size + 256);
+    char* P = Buf;
+    static char* Ops[] = {" + ", " - ", " * ", " / ", " < ", " <= ", " == ", " != "};
+
+    while(P < Buf + Size) {
+        // 缩进
+        int Indent = LongRuns ? 4 * (4 + rnd(16)) : 4 * (1 + rnd(4));
+        for(int I = 0; I < Indent; I++)
+            *P++ = ' ';
+
+        if(rnd(4) == 0) {
+            P += sprintf(P, "if (");
+            P = genIdent(P);
+            P += sprintf(P, "%s%u) {\n", Ops[rnd(8)], rnd(100000));
+            continue;
+        }
+
+        P = genIdent(P);
+        P += sprintf(P, " = ");
+        int Terms = 1 + rnd(4);
+        for(int I = 0; I < Terms; I++) {
+            if(I)
+                P += sprintf(P, "%s", Ops[rnd(4)]);
+            if(rnd(2))
+                P = genIdent(P);
+            else if(LongRuns)
+                P += sprintf(P, "%u%09u", rnd(1000000000), rnd(1000000000));
+            else
+                P += sprintf(P, "%u", rnd(1000000000));
+        }
+        P += sprintf(P, ";\n");
+    }
+
+    *P = '\0';
+    return Buf;
+}
+
+// 对源程序进行一次完整的词法分析，返回终结符的校验和
+static uint64_t lexAll(char* Src, int* Count) {
+    uint64_t Sum = 0;
+    int N = 0;
+    for(Token* Tok = tokenize(Src); Tok->Kind != TK_EOF; Tok = nextToken(Tok)) {
+        Sum = Sum * 31 + (uint64_t)(Tok->Loc - Src) * 7 + Tok->Len * 3 +
+              Tok->Kind + (uint64_t)Tok->Val;
+        N++;
+    }
+    *Count = N;
+    return Sum;
+}
+
+// 在源程序Src上测试所有的实现，返回结果不一致的实现数
+static int benchCorpus(char* Name, char* Src) {
+    static struct {
+        LexImpl Impl;
+        char* Name;
+    } Impls[] = {
+        {LEX_SCALAR, "scalar"},
+        {LEX_SSE2, "sse2"},
+        {LEX_AVX2, "avx2"},
+    };
+
+    size_t Len = strlen(Src);
+    uint64_t Expect = 0;
+    int ExpectCount = 0;
+    double ScalarRate = 0;
+    int Failed = 0;
+
+    printf("%s: %.1f MB\n", Name, Len / 1e6);
+    for(size_t I = 0; I < sizeof(Impls) / sizeof(*Impls); I++) {
+        // 不支持的实现会回退，跳过
+        if(lexSelectImpl(Impls[I].Impl) != Impls[I].Impl) {
+            printf("  %-8s unsupported\n", Impls[I].Name);
+            continue;
+        }
+
+        double Best = 1e30;
+        uint64_t Sum = 0;
+        int Count = 0;
+        for(int R = 0; R < REPEAT; R++) {
+            double Start = nowSec();
+            Sum = lexAll(Src, &Count);
+            double T = nowSec() - Start;
+            if(T < Best)
+                Best = T;
+        }
+
+        double Rate = Len / 1e6 / Best;
+        if(I == 0) {
+            Expect = Sum;
+            ExpectCount = Count;
+            ScalarRate = Rate;
+        }
+
+        bool Same = Sum == Expect && Count == ExpectCount;
+        if(!Same)
+            Failed++;
+        printf("  %-8s %8.1f MB/s  %5.2fx  %d tokens%s\n", Impls[I].Name, Rate,
+               Rate / ScalarRate, Count, Same ? "" : "  MISMATCH");
+    }
+
+    return Failed;
+}
+
+// 用法：rvcc_lex_bench [每种输入的MB数]
+int main(int Argc, char** Argv) {
+    size_t Size = Argc > 1 ? (size_t)atol(Argv[1]) << 20 : DEFAULT_SIZE;
+    int Failed = 0;
+
+    // 普通的手写风格代码
+    LongRuns = false;
+    char* Src = genSource(Size);
+    Failed += benchCorpus("mixed", Src);
+    free(Src);
+
+    // 含有大量长连续字符的机器生成代码
+    LongRuns = true;
+    Src = genSource(Size);
+    Failed += benchCorpus("long-runs", Src);
+    free(Src);
+
+    // 恢复自动选择
+    lexSelectImpl(LEX_AUTO);
+    return Failed;
+}
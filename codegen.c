@@ -1,31 +1,193 @@
 #include "rvcc.h"
 
+// 是否在汇编中输出注释，由--annotate开启
+bool OptAnnotate;
+
+// 优化级别，由-O0、-O1指定
+int OptLevel = 1;
+
+// 输出的格式，由--emit指定
+EmitFormat OptEmit;
+
+// 输出文件
+static FILE* OutputFile;
+
+// 输出缓冲区的大小
+#define OUT_BUF_SIZE (1 << 16)
+
+// 输出缓冲区，汇编先写入缓冲区，写满后再一次性写入文件
+static char OutBuf[OUT_BUF_SIZE];
+// 缓冲区已使用的字节数
+static size_t OutLen;
+
 // 记录栈的深度
 static int Depth;
 
+// 代码生成的统计
+CodegenStats CgStats;
+
+// 将缓冲区的内容写入输出文件
+static void flushOut(void) {
+    if(OutLen && fwrite(OutBuf, 1, OutLen, OutputFile) != OutLen)
+        error("failed to write output");
+    OutLen = 0;
+}
+
+// 单条指令输出后的最大长度，写入一条指令前确保缓冲区留有该空间
+#define MAX_LINE 64
+
+// 确保缓冲区至少剩余N字节
+static void reserve(size_t N) {
+    if(OutLen + N > OUT_BUF_SIZE)
+        flushOut();
+}
+
+// 将字符串写入缓冲区，调用前需已预留空间
+static void putStr(char* Str) {
+    while(*Str)
+        OutBuf[OutLen++] = *Str++;
+}
+
+// 将整数写入缓冲区，调用前需已预留空间
+static void putInt(int64_t Val) {
+    char Tmp[24];
+    int N = 0;
+    uint64_t U = Val < 0 ? -(uint64_t)Val : (uint64_t)Val;
+    do {
+        Tmp[N++] = '0' + U % 10;
+        U /= 10;
+    } while(U);
+    if(Val < 0)
+        OutBuf[OutLen++] = '-';
+    while(N)
+        OutBuf[OutLen++] = Tmp[--N];
+}
+
+// 指令列表，代码生成时指令先存入这里，最后统一输出
+static InstList Code;
+
+// 在指令列表末尾新增一条指令，返回的指针在下次新增前有效
+static Inst* newInst(InstKind Kind) {
+    if(Code.Len == Code.Cap) {
+        Code.Cap = Code.Cap ? Code.Cap * 2 : 1024;
+        Code.Data = realloc(Code.Data, sizeof(Inst) * Code.Cap);
+        if(!Code.Data)
+            error("out of memory");
+    }
+    Inst* I = &Code.Data[Code.Len++];
+    memset(I, 0, sizeof(*I));
+    I->Kind = Kind;
+    return I;
+}
+
+// 新增寄存器间运算的指令，如add rd, rs1, rs2、mv rd, rs1
+static void emitR(InstKind Kind, int Rd, int Rs1, int Rs2) {
+    Inst* I = newInst(Kind);
+    I->Rd = Rd;
+    I->Rs1 = Rs1;
+    I->Rs2 = Rs2;
+}
+
+// 新增带立即数的指令，如addi rd, rs1, imm、ld rd, imm(rs1)、li rd, imm
+static void emitI(InstKind Kind, int Rd, int Rs1, int64_t Imm) {
+    Inst* I = newInst(Kind);
+    I->Rd = Rd;
+    I->Rs1 = Rs1;
+    I->Imm = Imm;
+}
+
+// 新增存储指令sd rs2, imm(rs1)
+static void emitStore(int Rs2, int Rs1, int64_t Imm) {
+    Inst* I = newInst(RV_SD);
+    I->Rs1 = Rs1;
+    I->Rs2 = Rs2;
+    I->Imm = Imm;
+}
+
+// 新增跳转指令或标签，Rs1为beqz判断的寄存器
+static void emitLabel(InstKind Kind, int Rs1, int64_t Label) {
+    Inst* I = newInst(Kind);
+    I->Rs1 = Rs1;
+    I->Imm = Label;
+}
+
+// 新增比较两个寄存器的分支指令，如blt rs1, rs2, label
+static void emitBranch(InstKind Kind, int Rs1, int Rs2, int64_t Label) {
+    Inst* I = newInst(Kind);
+    I->Rs1 = Rs1;
+    I->Rs2 = Rs2;
+    I->Imm = Label;
+}
+
+// 新增一行注释，仅在开启--annotate时输出
+static void annotate(char* Fmt, ...) {
+    if(!OptAnnotate)
+        return;
+
+    va_list VA;
+    va_start(VA, Fmt);
+    int Len = vsnprintf(NULL, 0, Fmt, VA);
+    va_end(VA);
+
+    char* Text = arenaAlloc(Len + 1);
+    va_start(VA, Fmt);
+    vsnprintf(Text, Len + 1, Fmt, VA);
+    va_end(VA);
+    newInst(RV_COMMENT)->Text = Text;
+}
+
 // 代码段标号计数
 static int count(void) {
     static int I = 1;
+    CgStats.Labels++;
     return I++;
 }
 
-// 压栈，将结果临时压入栈中备用
+// 可用于存放变量的被调用者保存寄存器数量，即s1~s11
+#define SAVED_REG_NUM 11
+
+// 当前函数使用的被调用者保存寄存器数量，使用s1~s{NumSavedRegs}
+static int NumSavedRegs;
+
+// 存放表达式临时值的寄存器池，即t0~t6、a2~a7
+// a0作为累加器保存当前结果，a1作为溢出时的暂存寄存器，故不在池中
+static int TmpRegs[] = {
+    5, 6, 7, 28, 29, 30, 31,
+    12, 13, 14, 15, 16, 17,
+};
+
+// 寄存器池的大小
+#define TMP_REG_NUM (int)(sizeof(TmpRegs) / sizeof(*TmpRegs))
+
+// 压栈，将结果临时保存起来备用
+// 深度未超过寄存器池大小时，将a0的值存入第Depth个临时寄存器
+// 寄存器用尽后，才溢出到栈中
 // sp为栈指针，栈反向向下增长，64位下，8个字节为一个单位，所以sp-8
-// 当前栈指针的地址就是sp，将a0的值压入栈
-// 不使用寄存器存储的原因是因为需要存储的值的数量是变化的。
-static void push() {
-    printf("  # 压栈，将a0的值压入栈顶\n");
-    printf("  addi sp, sp, -8\n");
-    printf("  sd a0, 0(sp)\n");
+static void push(void) {
+    if(Depth < TMP_REG_NUM) {
+        annotate("  # 将a0的值存入临时寄存器%s", regName(TmpRegs[Depth]));
+        emitR(RV_MV, TmpRegs[Depth], R_A0, 0);
+    } else {
+        annotate("  # 寄存器已用尽，将a0的值压入栈顶");
+        emitI(RV_ADDI, R_SP, R_SP, -8);
+        emitStore(R_A0, R_SP, 0);
+    }
     Depth++;
+    if(Depth > CgStats.MaxDepth)
+        CgStats.MaxDepth = Depth;
 }
 
-// 弹栈，将sp指向的地址的值，弹出到a1
-static void pop(char* Reg) {
-    printf("  # 弹栈，将栈顶的值存入%s\n", Reg);
-    printf("  ld %s, 0(sp)\n", Reg);
-    printf("  addi sp, sp, 8\n");
+// 弹栈，返回存放最近一次压栈值的寄存器
+// 若该值已溢出到栈中，则将其弹出到a1
+static int pop(void) {
     Depth--;
+    if(Depth < TMP_REG_NUM)
+        return TmpRegs[Depth];
+
+    annotate("  # 弹栈，将栈顶的值存入a1");
+    emitI(RV_LD, R_A1, R_SP, 0);
+    emitI(RV_ADDI, R_SP, R_SP, 8);
+    return R_A1;
 }
 
 // 对齐到Align的整数倍
@@ -35,104 +197,184 @@ static int alignTo(int N, int Align) {
 
 // 计算给定节点的绝对地址
 // 报错，说明节点不在内存中
-static void genAddr(Node *Nd) {
-    if(Nd->Kind == ND_VAR) {
+static void genAddr(Node* Nd) {
+    if(Nd->Kind == ND_VAR && !Nd->Var->Reg) {
         //偏移量是相对于fp的
-        printf("  # 获取变量%s的栈内地址为%d(fp)\n", Nd->Var->Name, Nd->Var->Offset);
-        printf("  addi a0, fp, %d\n", Nd->Var->Offset);
+        annotate("  # 获取变量%.*s的栈内地址为%d(fp)", Nd->Var->Len, Nd->Var->Name,
+               Nd->Var->Offset);
+        // 偏移量超出12位立即数的范围时，先加载到a0中
+        if(Nd->Var->Offset >= -2048) {
+            emitI(RV_ADDI, R_A0, R_FP, Nd->Var->Offset);
+        } else {
+            emitI(RV_LI, R_A0, 0, Nd->Var->Offset);
+            emitR(RV_ADD, R_A0, R_FP, R_A0);
+        }
         return;
     } 
 
     error("not a lvalue");
 }
 
-// 表达式
-static void genExpr(Node* Nd) {
-    //加载数字到a0
-    switch(Nd->Kind) {
-    case ND_NUM:
-        printf("  li a0, %d\n",Nd->Val);
-        return;
-    //对寄存器取反
-    case ND_NEG:
-        genExpr(Nd->LHS);
-        printf("  # 对a0值进行取反\n");
-        printf("  neg a0, a0\n");
-        return;
-    case ND_VAR:
-        // 计算出变量的地址，然后存入a0
-        genAddr(Nd);
-        // 访问a0地址中存储的数据，存入到a0当中
-        printf("  # 读取a0中存放的地址，得到的值存入a0\n");
-        printf("  ld a0, 0(a0)\n");
-        return;
-    case ND_ASSIGN:
-        // 左部是左值，保存值到地址
-        genAddr(Nd->LHS);
-        push();
-        // 右部是右值，为表达式的值
-        genExpr(Nd->RHS);
-        pop("a1");
-        printf("  # 将a0的值，写入到a1中存放的地址\n");
-        printf("  sd a0, 0(a1)\n");
+// 表达式遍历中的一帧，State记录已经处理完成的子节点数
+typedef struct {
+    NodeId Id;
+    int State;
+} ExprFrame;
+
+// 表达式遍历的显式栈，代替递归，在多次遍历间复用
+static ExprFrame* Frames;
+static int FrameCnt, FrameCap;
+
+// 将节点压入遍历栈，之后会先处理它
+static void pushFrame(NodeId Id) {
+    if(FrameCnt == FrameCap) {
+        FrameCap = FrameCap ? FrameCap * 2 : 64;
+        Frames = realloc(Frames, sizeof(ExprFrame) * FrameCap);
+        if(!Frames)
+            error("out of memory");
+    }
+    Frames[FrameCnt++] = (ExprFrame){Id, 0};
+}
+
+//
+// 指令选择
+//
+// 按照BURS的方式为表达式树选择指令：先自底向上为每个节点计算将其值求到a0中的
+// 最小代价(指令数)及达到该代价的覆盖方式，再自顶向下按选定的覆盖方式生成指令。
+// 叶子节点除了求到a0中，还可以直接作为父节点指令的操作数：
+// 位于s寄存器中的变量作为源寄存器，12位以内的数字作为立即数
+
+// 无法使用某种覆盖方式时的代价
+#define COST_INF (1 << 30)
+
+// 操作数的获取方式
+typedef enum {
+    OPD_REG, // 先将子节点的值求到a0中
+    OPD_SREG, // 位于s寄存器中的变量，直接读取
+    OPD_IMM, // 12位有符号数，作为立即数
+    OPD_ZERO, // 数字0，使用zero寄存器
+    OPD_NUM, // 获取方式的总数
+} Operand;
+
+// 节点的覆盖方式
+typedef enum {
+    TL_NUM, // li a0, N
+    TL_NUM_LUI, // lui a0, hi; addi a0, a0, lo
+    TL_VAR_SREG, // mv a0, sN
+    TL_VAR_FP, // ld a0, off(fp)
+    TL_VAR_FAR, // 偏移量超出12位，先计算地址再ld a0, 0(a0)
+    TL_NEG, // neg a0, 操作数
+    TL_BINARY, // 左右操作数按各自的方式获取后进行运算
+    TL_ASSIGN_SREG, // 求值右部后mv sN, a0
+    TL_ASSIGN_FP, // 求值右部后sd a0, off(fp)
+    TL_ASSIGN_FAR, // 先计算地址并压栈，求值右部后sd a0, 0(地址)
+} Tile;
+
+// 节点的匹配结果
+typedef struct {
+    int Cost; // 将值求到a0中的最小代价
+    uint8_t Tile; // 达到最小代价的覆盖方式
+    uint8_t LOpd, ROpd; // 左右操作数的获取方式
+    bool HasAssign; // 子树中是否含有赋值
+} Match;
+
+// 每个节点的匹配结果，下标为节点编号
+static Match* Matches;
+
+// 数字能否由lui与addi得到，即能否表示为32位有符号数
+static bool fitsLui(int64_t Val) {
+    int64_t Hi = Val - lo12(Val);
+    return INT32_MIN <= Hi && Hi <= INT32_MAX;
+}
+
+// 将数字加载到a0中
+static void genNum(int64_t Val) {
+    if(isImm12(Val) || !fitsLui(Val)) {
+        emitI(RV_LI, R_A0, 0, Val);
         return;
+    }
+    // lui加载高20位，addi加上有符号的低12位
+    annotate("  # 使用lui、addi加载%ld", Val);
+    emitI(RV_LUI, R_A0, 0, ((Val - lo12(Val)) >> 12) & 0xfffff);
+    if(lo12(Val))
+        emitI(RV_ADDI, R_A0, R_A0, lo12(Val));
+}
+
+// 将数字加载到寄存器所需的指令数
+static int numCost(int64_t Val) {
+    if(isImm12(Val))
+        return 1;
+    if(fitsLui(Val))
+        return lo12(Val) ? 2 : 1;
+    // li展开为lui、addi、slli组成的序列，最多8条
+    return 8;
+}
+
+// 以Opd的方式获取节点的值所需的代价
+static int opdCost(NodeId Id, Operand Opd) {
+    Node* Nd = getNode(Id);
+    switch(Opd) {
+    case OPD_REG:
+        return Matches[Id].Cost;
+    case OPD_SREG:
+        return Nd->Kind == ND_VAR && Nd->Var->Reg ? 0 : COST_INF;
+    case OPD_ZERO:
+        return Nd->Kind == ND_NUM && Nd->Val == 0 ? 0 : COST_INF;
     default:
-        break;
+        return Nd->Kind == ND_NUM && isImm12(Nd->Val) ? 0 : COST_INF;
     }
+}
 
-    // 递归到最右节点
-    genExpr(Nd->RHS);
-    // 将结果压入栈
-    push();
-    // 递归到左节点
-    genExpr(Nd->LHS);
-    // 将结果弹栈到a1
-    pop("a1");
+// 以Opd的方式获取的操作数所在的寄存器
+static int opdReg(NodeId Id, Operand Opd) {
+    if(Opd == OPD_SREG)
+        return sReg(getNode(Id)->Var->Reg);
+    return Opd == OPD_ZERO ? R_ZERO : R_A0;
+}
 
+// 生成二叉树节点的运算，a0=Rs1 op Rs2
+static void genBinary(Node* Nd, int Rs1, int Rs2) {
     // 生成各个二叉树节点
     switch (Nd->Kind) {
-    case ND_ADD: // + a0=a0+a1
-        printf("  # a0+a1，结果写入a0\n");
-        printf("  add a0, a0, a1\n");
+    case ND_ADD: // + a0=rs1+rs2
+        annotate("  # %s+%s，结果写入a0", regName(Rs1), regName(Rs2));
+        emitR(RV_ADD, R_A0, Rs1, Rs2);
         return;
-    case ND_SUB: // - a0=a0-a1
-        printf("  # a0-a1，结果写入a0\n");
-        printf("  sub a0, a0, a1\n");
+    case ND_SUB: // - a0=rs1-rs2
+        annotate("  # %s-%s，结果写入a0", regName(Rs1), regName(Rs2));
+        emitR(RV_SUB, R_A0, Rs1, Rs2);
         return;
-    case ND_MUL: // * a0=a0*a1
-        printf("  # a0×a1，结果写入a0\n");
-        printf("  mul a0, a0, a1\n");
+    case ND_MUL: // * a0=rs1*rs2
+        annotate("  # %s×%s，结果写入a0", regName(Rs1), regName(Rs2));
+        emitR(RV_MUL, R_A0, Rs1, Rs2);
         return;
-    case ND_DIV: // / a0=a0/a1
-        printf("  # a0÷a1，结果写入a0\n");
-        printf("  div a0, a0, a1\n");
+    case ND_DIV: // / a0=rs1/rs2
+        annotate("  # %s÷%s，结果写入a0", regName(Rs1), regName(Rs2));
+        emitR(RV_DIV, R_A0, Rs1, Rs2);
         return;
     case ND_EQ:
     case ND_NE:
-        // a0 = a0 ^ a1
-        printf("  # 判断是否a0%sa1\n", Nd->Kind == ND_EQ ? "=" : "≠");
-        printf("  xor a0, a0, a1\n");
-        // a0 == a1
-        // a0 = a0 ^ a1, sltiu a0, a0, 1
+        // a0 = rs1 ^ rs2
+        annotate("  # 判断是否%s%s%s", regName(Rs1), Nd->Kind == ND_EQ ? "=" : "≠",
+                 regName(Rs2));
+        emitR(RV_XOR, R_A0, Rs1, Rs2);
         // 等于0则置1
         if(Nd->Kind == ND_EQ)
-            printf("  seqz a0, a0\n");
-        // a0 != a1
-        // a0 = a0 ^ a1, sltu a0, a0, 1
+            emitR(RV_SEQZ, R_A0, R_A0, 0);
         // 不等于0则置1
         else
-            printf("  snez a0, a0\n");
+            emitR(RV_SNEZ, R_A0, R_A0, 0);
         return;
     case ND_LT:
-        printf("  # 判断a0<a1\n");
-        printf("  slt a0, a0, a1\n");
+        annotate("  # 判断%s<%s", regName(Rs1), regName(Rs2));
+        emitR(RV_SLT, R_A0, Rs1, Rs2);
         return;
     case ND_LE:
-        //a0<=a1等价于
-        //a0=a1<a0,a0=a0^1
-        printf("  # 判断是否a0≤a1\n");
-        printf("  slt a0, a1, a0\n");
-        printf("  xori a0, a0, 1\n");
+        // rs1<=rs2等价于
+        // a0=rs2<rs1,a0=a0^1
+        annotate("  # 判断是否%s≤%s", regName(Rs1), regName(Rs2));
+        emitR(RV_SLT, R_A0, Rs2, Rs1);
+        emitI(RV_XORI, R_A0, R_A0, 1);
         return;
     default:
         break;
@@ -141,87 +383,540 @@ static void genExpr(Node* Nd) {
     error("invalid expression");
 }
 
+// genBinary生成的指令数
+static int binaryCost(NodeKind Kind) {
+    return Kind == ND_EQ || Kind == ND_NE || Kind == ND_LE ? 2 : 1;
+}
+
+// 寄存器Src与立即数N运算，结果写入a0，Left为true时N为左操作数
+// Emit为false时仅返回所需的指令数，没有合适的立即数指令时返回COST_INF
+static int genImmOp(NodeKind Kind, int Src, int64_t N, bool Left, bool Emit) {
+    switch(Kind) {
+    case ND_ADD:
+        if(Emit)
+            emitI(RV_ADDI, R_A0, Src, N);
+        return 1;
+    case ND_SUB:
+        // N-x等价于-x+N
+        if(Left) {
+            if(Emit) {
+                emitR(RV_NEG, R_A0, Src, 0);
+                if(N != 0)
+                    emitI(RV_ADDI, R_A0, R_A0, N);
+            }
+            return N != 0 ? 2 : 1;
+        }
+        if(!isImm12(-N))
+            return COST_INF;
+        if(Emit)
+            emitI(RV_ADDI, R_A0, Src, -N);
+        return 1;
+    case ND_EQ:
+    case ND_NE: {
+        InstKind Set = Kind == ND_EQ ? RV_SEQZ : RV_SNEZ;
+        // 与0比较时无需异或
+        if(N == 0) {
+            if(Emit)
+                emitR(Set, R_A0, Src, 0);
+            return 1;
+        }
+        if(Emit) {
+            emitI(RV_XORI, R_A0, Src, N);
+            emitR(Set, R_A0, R_A0, 0);
+        }
+        return 2;
+    }
+    case ND_LT:
+        if(!Left) {
+            if(Emit)
+                emitI(RV_SLTI, R_A0, Src, N);
+            return 1;
+        }
+        // N<x等价于!(x<N+1)
+        if(!isImm12(N + 1))
+            return COST_INF;
+        if(Emit) {
+            emitI(RV_SLTI, R_A0, Src, N + 1);
+            emitI(RV_XORI, R_A0, R_A0, 1);
+        }
+        return 2;
+    case ND_LE:
+        // x<=N等价于x<N+1
+        if(!Left) {
+            if(!isImm12(N + 1))
+                return COST_INF;
+            if(Emit)
+                emitI(RV_SLTI, R_A0, Src, N + 1);
+            return 1;
+        }
+        // N<=x等价于!(x<N)
+        if(Emit) {
+            emitI(RV_SLTI, R_A0, Src, N);
+            emitI(RV_XORI, R_A0, R_A0, 1);
+        }
+        return 2;
+    default:
+        // 乘除法没有立即数形式
+        return COST_INF;
+    }
+}
+
+// 获取二叉树节点的左右操作数所需的代价，分别以LOpd、ROpd的方式获取
+static int operandsCost(Node* Nd, Operand LOpd, Operand ROpd) {
+    int LC = opdCost(Nd->LHS, LOpd);
+    int RC = opdCost(Nd->RHS, ROpd);
+    if(LC == COST_INF || RC == COST_INF)
+        return COST_INF;
+    // 原本先求值右部再求值左部，右部为s寄存器中的变量时改为在左部之后读取，
+    // 左部含有赋值时可能改变读取到的值
+    if(LOpd == OPD_REG && ROpd == OPD_SREG && Matches[Nd->LHS].HasAssign)
+        return COST_INF;
+
+    // 两个操作数都需要求到a0中时，右部的值需要压栈保存
+    int Push = LOpd == OPD_REG && ROpd == OPD_REG;
+    return LC + RC + Push;
+}
+
+// 二叉树节点的左右操作数分别以LOpd、ROpd的方式获取时，将结果求到a0中的代价
+static int binaryTileCost(Node* Nd, Operand LOpd, Operand ROpd) {
+    // 两个数字的运算已被常量折叠
+    if(LOpd == OPD_IMM && ROpd == OPD_IMM)
+        return COST_INF;
+    int Opd = operandsCost(Nd, LOpd, ROpd);
+    if(Opd == COST_INF)
+        return COST_INF;
+
+    int Op;
+    if(LOpd == OPD_IMM)
+        Op = genImmOp(Nd->Kind, R_A0, getNode(Nd->LHS)->Val, true, false);
+    else if(ROpd == OPD_IMM)
+        Op = genImmOp(Nd->Kind, R_A0, getNode(Nd->RHS)->Val, false, false);
+    else
+        Op = binaryCost(Nd->Kind);
+    if(Op == COST_INF)
+        return COST_INF;
+    return Opd + Op;
+}
+
+// 为节点选择代价最小的覆盖方式，子节点已经完成匹配
+static void matchNode(NodeId Id) {
+    Node* Nd = getNode(Id);
+    Match* M = &Matches[Id];
+    *M = (Match){.Cost = COST_INF};
+
+    switch(Nd->Kind) {
+    case ND_NUM:
+        M->Tile = isImm12(Nd->Val) || !fitsLui(Nd->Val) ? TL_NUM : TL_NUM_LUI;
+        M->Cost = numCost(Nd->Val);
+        return;
+    case ND_VAR:
+        if(Nd->Var->Reg) {
+            M->Tile = TL_VAR_SREG;
+            M->Cost = 1;
+        } else if(isImm12(Nd->Var->Offset)) {
+            M->Tile = TL_VAR_FP;
+            M->Cost = 1;
+        } else {
+            // li、add、ld
+            M->Tile = TL_VAR_FAR;
+            M->Cost = 3;
+        }
+        return;
+    case ND_NEG:
+        M->Tile = TL_NEG;
+        M->HasAssign = Matches[Nd->LHS].HasAssign;
+        for(Operand Opd = OPD_REG; Opd <= OPD_SREG; Opd++) {
+            int C = opdCost(Nd->LHS, Opd);
+            if(C != COST_INF && C + 1 < M->Cost) {
+                M->Cost = C + 1;
+                M->LOpd = Opd;
+            }
+        }
+        return;
+    case ND_ASSIGN: {
+        Node* LHS = getNode(Nd->LHS);
+        if(LHS->Kind != ND_VAR)
+            error("not a lvalue");
+        M->HasAssign = true;
+        M->Cost = Matches[Nd->RHS].Cost + 1;
+        if(LHS->Var->Reg) {
+            M->Tile = TL_ASSIGN_SREG;
+        } else if(isImm12(LHS->Var->Offset)) {
+            M->Tile = TL_ASSIGN_FP;
+        } else {
+            // 额外的li、add及压栈
+            M->Tile = TL_ASSIGN_FAR;
+            M->Cost += 3;
+        }
+        return;
+    }
+    default:
+        break;
+    }
+
+    // 二叉树节点，枚举左右操作数的获取方式
+    M->Tile = TL_BINARY;
+    M->HasAssign = Matches[Nd->LHS].HasAssign || Matches[Nd->RHS].HasAssign;
+    for(Operand L = OPD_REG; L < OPD_NUM; L++) {
+        for(Operand R = OPD_REG; R < OPD_NUM; R++) {
+            int C = binaryTileCost(Nd, L, R);
+            if(C < M->Cost) {
+                M->Cost = C;
+                M->LOpd = L;
+                M->ROpd = R;
+            }
+        }
+    }
+    if(M->Cost == COST_INF)
+        error("invalid expression");
+}
+
+// 自底向上匹配表达式树的全部节点，使用显式的栈进行后序遍历
+static void labelExpr(NodeId Root) {
+    int Base = FrameCnt;
+    pushFrame(Root);
+
+    while(FrameCnt > Base) {
+        ExprFrame* F = &Frames[FrameCnt - 1];
+        NodeId Id = F->Id;
+        Node* Nd = getNode(Id);
+
+        // 第一次访问时压入子节点，子节点匹配完成后再匹配自身
+        if(F->State++ == 0 && Nd->Kind != ND_NUM && Nd->Kind != ND_VAR) {
+            if(Nd->Kind != ND_NEG)
+                pushFrame(Nd->RHS);
+            pushFrame(Nd->LHS);
+            continue;
+        }
+        matchNode(Id);
+        FrameCnt--;
+    }
+}
+
+// 按选定的覆盖方式生成二叉树节点的运算，需要求到a0中的操作数已经生成
+static void genBinaryTile(Node* Nd, Match* M) {
+    if(M->LOpd == OPD_IMM) {
+        annotate("  # 立即数%ld作为左操作数", getNode(Nd->LHS)->Val);
+        genImmOp(Nd->Kind, opdReg(Nd->RHS, M->ROpd), getNode(Nd->LHS)->Val, true,
+                 true);
+        return;
+    }
+    if(M->ROpd == OPD_IMM) {
+        annotate("  # 立即数%ld作为右操作数", getNode(Nd->RHS)->Val);
+        genImmOp(Nd->Kind, opdReg(Nd->LHS, M->LOpd), getNode(Nd->RHS)->Val, false,
+                 true);
+        return;
+    }
+
+    // 两个操作数都求到a0中时，右部已被压栈
+    int Rs2 = M->LOpd == OPD_REG && M->ROpd == OPD_REG
+                  ? pop()
+                  : opdReg(Nd->RHS, M->ROpd);
+    genBinary(Nd, opdReg(Nd->LHS, M->LOpd), Rs2);
+}
+
+// 按选定的覆盖方式生成表达式，结果存入a0，树中的节点均已完成匹配
+// 使用显式的栈进行后序遍历，任意深度的表达式都不会耗尽C的调用栈
+static void reduceExpr(NodeId Root) {
+    int Base = FrameCnt;
+    pushFrame(Root);
+
+    while(FrameCnt > Base) {
+        ExprFrame* F = &Frames[FrameCnt - 1];
+        Node* Nd = getNode(F->Id);
+        Match* M = &Matches[F->Id];
+        // 压入子节点可能使栈扩容，先取出并更新状态
+        int State = F->State++;
+
+        switch(M->Tile) {
+        //加载数字到a0
+        case TL_NUM:
+        case TL_NUM_LUI:
+            genNum(Nd->Val);
+            FrameCnt--;
+            continue;
+        // 变量位于寄存器中，直接读取
+        case TL_VAR_SREG:
+            annotate("  # 读取寄存器s%d中的变量%.*s", Nd->Var->Reg, Nd->Var->Len,
+                     Nd->Var->Name);
+            emitR(RV_MV, R_A0, sReg(Nd->Var->Reg), 0);
+            FrameCnt--;
+            continue;
+        // 以fp为基址直接读取栈上的变量
+        case TL_VAR_FP:
+            annotate("  # 读取栈上%d(fp)处的变量%.*s", Nd->Var->Offset,
+                     Nd->Var->Len, Nd->Var->Name);
+            emitI(RV_LD, R_A0, R_FP, Nd->Var->Offset);
+            FrameCnt--;
+            continue;
+        case TL_VAR_FAR:
+            // 计算出变量的地址，然后存入a0
+            genAddr(Nd);
+            // 访问a0地址中存储的数据，存入到a0当中
+            annotate("  # 读取a0中存放的地址，得到的值存入a0");
+            emitI(RV_LD, R_A0, R_A0, 0);
+            FrameCnt--;
+            continue;
+        //对寄存器取反
+        case TL_NEG:
+            if(State == 0 && M->LOpd == OPD_REG) {
+                pushFrame(Nd->LHS);
+                continue;
+            }
+            annotate("  # 对%s的值进行取反", regName(opdReg(Nd->LHS, M->LOpd)));
+            emitR(RV_NEG, R_A0, opdReg(Nd->LHS, M->LOpd), 0);
+            FrameCnt--;
+            continue;
+        // 左部是寄存器中的变量，直接写入寄存器
+        case TL_ASSIGN_SREG: {
+            if(State == 0) {
+                pushFrame(Nd->RHS);
+                continue;
+            }
+            Node* LHS = getNode(Nd->LHS);
+            annotate("  # 将a0的值写入变量%.*s所在的寄存器s%d", LHS->Var->Len,
+                     LHS->Var->Name, LHS->Var->Reg);
+            emitR(RV_MV, sReg(LHS->Var->Reg), R_A0, 0);
+            FrameCnt--;
+            continue;
+        }
+        // 以fp为基址直接写入栈上的变量
+        case TL_ASSIGN_FP: {
+            if(State == 0) {
+                pushFrame(Nd->RHS);
+                continue;
+            }
+            Node* LHS = getNode(Nd->LHS);
+            annotate("  # 将a0的值写入栈上%d(fp)处的变量%.*s", LHS->Var->Offset,
+                     LHS->Var->Len, LHS->Var->Name);
+            emitStore(R_A0, R_FP, LHS->Var->Offset);
+            FrameCnt--;
+            continue;
+        }
+        case TL_ASSIGN_FAR: {
+            if(State == 0) {
+                // 左部是左值，保存值到地址
+                genAddr(getNode(Nd->LHS));
+                push();
+                // 右部是右值，为表达式的值
+                pushFrame(Nd->RHS);
+                continue;
+            }
+            int Addr = pop();
+            annotate("  # 将a0的值，写入到%s中存放的地址", regName(Addr));
+            emitStore(R_A0, Addr, 0);
+            FrameCnt--;
+            continue;
+        }
+        default:
+            break;
+        }
+
+        // 二叉树节点
+        switch(State) {
+        case 0:
+            // 先生成最右节点
+            if(M->ROpd == OPD_REG) {
+                pushFrame(Nd->RHS);
+                continue;
+            }
+            // fallthrough
+        case 1:
+            // 此时尚未压入新的帧，F仍然有效
+            F->State = 2;
+            // 再生成左节点，右部也在a0中时先将其压栈
+            if(M->LOpd == OPD_REG) {
+                if(M->ROpd == OPD_REG)
+                    push();
+                pushFrame(Nd->LHS);
+                continue;
+            }
+            // fallthrough
+        default:
+            genBinaryTile(Nd, M);
+            FrameCnt--;
+            continue;
+        }
+    }
+}
+
+// 表达式，结果存入a0
+// 先为整棵树选择指令，再按选择的结果生成指令
+static void genExpr(NodeId Root) {
+    labelExpr(Root);
+    reduceExpr(Root);
+}
+
+// 是否为比较运算
+static bool isCompare(NodeKind Kind) {
+    return Kind == ND_EQ || Kind == ND_NE || Kind == ND_LT || Kind == ND_LE;
+}
+
+// 生成条件判断，条件的真假为JumpIf时跳转到Label，否则继续执行之后的指令
+// 条件为比较运算时，使用直接比较两个操作数的分支指令，无需先求出0或1
+static void genCond(NodeId Cond, int64_t Label, bool JumpIf) {
+    Node* Nd = getNode(Cond);
+
+    // 条件为常量时，无需判断，直接跳转或继续执行
+    if(Nd->Kind == ND_NUM) {
+        annotate("  # 条件恒为%s", Nd->Val ? "真" : "假");
+        if((Nd->Val != 0) == JumpIf)
+            emitLabel(RV_J, 0, Label);
+        return;
+    }
+
+    labelExpr(Cond);
+
+    // 分支指令的操作数只能是寄存器，枚举左右操作数的获取方式
+    int Cost = COST_INF;
+    Operand LOpd = OPD_REG, ROpd = OPD_REG;
+    if(isCompare(Nd->Kind)) {
+        for(Operand L = OPD_REG; L < OPD_NUM; L++) {
+            for(Operand R = OPD_REG; R < OPD_NUM; R++) {
+                if(L == OPD_IMM || R == OPD_IMM)
+                    continue;
+                int C = operandsCost(Nd, L, R);
+                if(C != COST_INF && C + 1 < Cost) {
+                    Cost = C + 1;
+                    LOpd = L;
+                    ROpd = R;
+                }
+            }
+        }
+    }
+
+    // 先求出0或1再用beqz、bnez判断，代价低于比较分支时使用
+    if(Matches[Cond].Cost + 1 < Cost) {
+        reduceExpr(Cond);
+        annotate("  # 若a0%s0，则跳转", JumpIf ? "≠" : "=");
+        emitLabel(JumpIf ? RV_BNEZ : RV_BEQZ, R_A0, Label);
+        return;
+    }
+
+    // 与二叉树节点相同，先右部后左部
+    if(ROpd == OPD_REG)
+        reduceExpr(Nd->RHS);
+    if(LOpd == OPD_REG) {
+        if(ROpd == OPD_REG)
+            push();
+        reduceExpr(Nd->LHS);
+    }
+    int Rs2 = LOpd == OPD_REG && ROpd == OPD_REG ? pop() : opdReg(Nd->RHS, ROpd);
+    int Rs1 = opdReg(Nd->LHS, LOpd);
+
+    // 条件成立时跳转使用相同的比较，不成立时跳转使用相反的比较
+    switch(Nd->Kind) {
+    case ND_EQ:
+    case ND_NE: {
+        bool Eq = (Nd->Kind == ND_EQ) == JumpIf;
+        annotate("  # 若%s%s%s，则跳转", regName(Rs1), Eq ? "=" : "≠", regName(Rs2));
+        emitBranch(Eq ? RV_BEQ : RV_BNE, Rs1, Rs2, Label);
+        return;
+    }
+    case ND_LT:
+        annotate("  # 若%s%s%s，则跳转", regName(Rs1), JumpIf ? "<" : "≥",
+                 regName(Rs2));
+        emitBranch(JumpIf ? RV_BLT : RV_BGE, Rs1, Rs2, Label);
+        return;
+    default:
+        // rs1<=rs2即rs2>=rs1，不成立即rs2<rs1
+        annotate("  # 若%s%s%s，则跳转", regName(Rs1), JumpIf ? "≤" : ">",
+                 regName(Rs2));
+        emitBranch(JumpIf ? RV_BGE : RV_BLT, Rs2, Rs1, Label);
+        return;
+    }
+}
+
 // 生成语句
 static void genStmt(Node* Nd) {
     switch(Nd->Kind) {
     case ND_IF: {
+        Node* Cond = getNode(Nd->Cond);
+        // 条件为常量时，只生成会执行的分支
+        if(Cond->Kind == ND_NUM) {
+            annotate("\n# =====条件恒为%s的分支语句=====", Cond->Val ? "真" : "假");
+            if(Cond->Val)
+                genStmt(getNode(Nd->Then));
+            else if(getExt(Nd)->Els)
+                genStmt(getNode(getExt(Nd)->Els));
+            return;
+        }
+
         //代码段计数
         int C = count();
-        printf("\n# =====分支语句%d==============\n", C);
-        //生成条件内语句
-        genExpr(Nd->Cond);
-        // 判断结果是否为0，为0则跳转到else标签
-        printf("  # 若a0为0，则跳转到分支%d的.L.else.%d段\n", C, C);
-        printf("  beqz a0, .L.else.%d\n", C);
+        annotate("\n# =====分支语句%d==============", C);
+        // 生成条件判断，不成立则跳转到else标签
+        genCond(Nd->Cond, LABEL(LB_ELSE, C), false);
         // 生成符合条件后的语句
-        printf("\n# Then语句%d\n", C);
-        genStmt(Nd->Then);
+        annotate("\n# Then语句%d", C);
+        genStmt(getNode(Nd->Then));
         // 执行完后跳转到if语句后面的语句
-        printf("  # 跳转到分支%d的.L.end.%d段\n", C, C);
-        printf("  j .L.end.%d\n", C);
+        annotate("  # 跳转到分支%d的.L.end.%d段", C, C);
+        emitLabel(RV_J, 0, LABEL(LB_END, C));
         // else代码块，else可能为空，故输出标签
-        printf("\n# Else语句%d\n", C);
-        printf("# 分支%d的.L.else.%d段标签\n", C, C);
-        printf(".L.else.%d:\n", C);
+        annotate("\n# Else语句%d", C);
+        annotate("# 分支%d的.L.else.%d段标签", C, C);
+        emitLabel(RV_LABEL, 0, LABEL(LB_ELSE, C));
         // 生成不符合条件后的语句
-        if (Nd->Els)
-            genStmt(Nd->Els);
+        if(getExt(Nd)->Els)
+            genStmt(getNode(getExt(Nd)->Els));
         // 结束if语句，继续执行后面的语句
-        printf("\n# 分支%d的.L.end.%d段标签\n", C, C);
-        printf(".L.end.%d:\n", C);
+        annotate("\n# 分支%d的.L.end.%d段标签", C, C);
+        emitLabel(RV_LABEL, 0, LABEL(LB_END, C));
         return;
     }
     // 生成for循环语句
     case ND_FOR: {
         //代码段计数
         int C = count();
-        printf("\n# =====循环语句%d===============\n", C);
+        annotate("\n# =====循环语句%d===============", C);
         //生成初始化语句
-        if(Nd->Init) {
-            printf("\n# Init语句%d\n", C);
-            genStmt(Nd->Init);
+        NodeExt* Ext = getExt(Nd);
+        if(Ext->Init) {
+            annotate("\n# Init语句%d", C);
+            genStmt(getNode(Ext->Init));
         }
-        //输出循环头部标签
-        printf("\n# 循环%d的.L.begin.%d段标签\n", C, C);
-        printf(".L.begin.%d:\n", C);
-        //处理循环条件语句
-        printf("# Cond表达式%d\n", C);
+        // 循环经过旋转，条件判断放在循环体之后，每次迭代只需一条向回的条件分支
+        // 首次进入前先判断一次条件，不成立则跳过整个循环
         if(Nd->Cond) {
-            //生成条件循环语句
-            genExpr(Nd->Cond);
-            //判断结构是否为0，为0则跳转到结束部分
-            printf("  # 若a0为0，则跳转到循环%d的.L.end.%d段\n", C, C);
-            printf("  beqz a0, .L.end.%d\n", C);
+            annotate("# 入口处的Cond表达式%d", C);
+            genCond(Nd->Cond, LABEL(LB_END, C), false);
         }
+        //输出循环头部标签
+        annotate("\n# 循环%d的.L.begin.%d段标签", C, C);
+        emitLabel(RV_LABEL, 0, LABEL(LB_BEGIN, C));
         //生成循环体语句
-        printf("\n# Then语句%d\n", C);
-        genStmt(Nd->Then);
+        annotate("\n# Then语句%d", C);
+        genStmt(getNode(Nd->Then));
         //处理循环递增语句
-        if(Nd->Inc) {
-            printf("\n# Inc语句%d\n", C);
-            genExpr(Nd->Inc);
+        if(Ext->Inc) {
+            annotate("\n# Inc语句%d", C);
+            genExpr(Ext->Inc);
         }
-        //跳转到循环头部
-        printf("  # 跳转到循环%d的.L.begin.%d段\n", C, C);
-        printf("  j .L.begin.%d\n", C);
+        //条件成立时跳转到循环头部，没有条件时无条件跳转
+        annotate("# Cond表达式%d", C);
+        if(Nd->Cond)
+            genCond(Nd->Cond, LABEL(LB_BEGIN, C), true);
+        else
+            emitLabel(RV_J, 0, LABEL(LB_BEGIN, C));
         //输出循环尾部标签
-        printf("\n# 循环%d的.L.end.%d段标签\n", C, C);
-        printf(".L.end.%d:\n", C);
+        annotate("\n# 循环%d的.L.end.%d段标签", C, C);
+        emitLabel(RV_LABEL, 0, LABEL(LB_END, C));
         return;
     }
     // 生成代码块
     case ND_BLOCK:
-        for(Node* N = Nd->Body; N; N = N->Next)
-            genStmt(N);
+        for(NodeId N = Nd->Body; N; N = getNode(N)->Next)
+            genStmt(getNode(N));
         return;
     // 生成return语句
     case ND_RETURN:
-        printf("# 返回语句\n");
+        annotate("# 返回语句");
         genExpr(Nd->LHS);
         // 无条件跳转语句，跳转到.L.return段
         // j offset是 jal x0, offset的别名指令
-        printf(" # 跳转到.L.return段\n");
-        printf("  j .L.return\n");
+        annotate(" # 跳转到.L.return段");
+        emitLabel(RV_J, 0, LABEL(LB_RETURN, 0));
         return;
     // 生成表达式语句
     case ND_EXPR_STMT:
@@ -234,12 +929,139 @@ static void genStmt(Node* Nd) {
     error("invalid statement");
 }
 
+// 统计变量使用次数时待访问的节点及其所在循环嵌套的权重
+typedef struct {
+    NodeId Id;
+    int Weight;
+} UseFrame;
+
+// 统计变量使用次数时的显式栈
+static UseFrame* UseStack;
+static int UseTop, UseCap;
+
+// 将待访问的节点压栈，空节点不入栈
+static void pushUse(NodeId Id, int Weight) {
+    if(!Id)
+        return;
+    if(UseTop == UseCap) {
+        UseCap = UseCap ? UseCap * 2 : 64;
+        UseStack = realloc(UseStack, sizeof(UseFrame) * UseCap);
+        if(!UseStack)
+            error("out of memory");
+    }
+    UseStack[UseTop++] = (UseFrame){Id, Weight};
+}
+
+// 统计函数体中变量的使用次数，使用显式的栈遍历全部节点
+static void countVarUses(NodeId Root) {
+    pushUse(Root, 1);
+    while(UseTop > 0) {
+        UseFrame F = UseStack[--UseTop];
+        Node* Nd = getNode(F.Id);
+
+        switch(Nd->Kind) {
+        // 目前语言中没有取址运算符，变量的地址仅在读写变量时使用，
+        // 因此所有变量都不会被取址，都可以提升到寄存器中
+        case ND_VAR:
+            Nd->Var->UseCnt += F.Weight;
+            break;
+        case ND_NUM:
+            break;
+        case ND_IF:
+            pushUse(Nd->Cond, F.Weight);
+            pushUse(Nd->Then, F.Weight);
+            pushUse(getExt(Nd)->Els, F.Weight);
+            break;
+        case ND_FOR: {
+            // 循环内的变量使用更加频繁，权重放大8倍
+            int Inner = F.Weight * 8;
+            if(Inner > (1 << 20))
+                Inner = 1 << 20;
+            pushUse(getExt(Nd)->Init, F.Weight);
+            pushUse(Nd->Cond, Inner);
+            pushUse(Nd->Then, Inner);
+            pushUse(getExt(Nd)->Inc, Inner);
+            break;
+        }
+        case ND_BLOCK:
+            for(NodeId N = Nd->Body; N; N = getNode(N)->Next)
+                pushUse(N, F.Weight);
+            break;
+        default:
+            pushUse(Nd->LHS, F.Weight);
+            pushUse(Nd->RHS, F.Weight);
+            break;
+        }
+    }
+
+    free(UseStack);
+    UseStack = NULL;
+    UseCap = 0;
+}
+
+// 比较两个变量的加权使用次数，次数多的排在前面
+static int cmpUseCnt(const void* A, const void* B) {
+    Obj* X = *(Obj**)A;
+    Obj* Y = *(Obj**)B;
+    if(X->UseCnt != Y->UseCnt)
+        return X->UseCnt > Y->UseCnt ? -1 : 1;
+    // 次数相同时按声明顺序，保证输出稳定
+    return X->Offset - Y->Offset;
+}
+
+// 将使用最频繁的变量分配到s1~s11寄存器中
+static void assignLVarRegs(Function* Prog) {
+    int N = 0;
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next) {
+        Var->UseCnt = 0;
+        Var->Reg = 0;
+        N++;
+    }
+
+    countVarUses(Prog->Body);
+
+    // Locals为逆序链表，借用Offset临时记录声明顺序
+    Obj** Vars = calloc(N, sizeof(Obj*));
+    int I = N;
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next) {
+        Vars[--I] = Var;
+        Var->Offset = I;
+    }
+    qsort(Vars, N, sizeof(Obj*), cmpUseCnt);
+
+    NumSavedRegs = 0;
+    for(I = 0; I < N && NumSavedRegs < SAVED_REG_NUM; I++) {
+        if(Vars[I]->UseCnt == 0)
+            break;
+        Vars[I]->Reg = ++NumSavedRegs;
+    }
+    free(Vars);
+}
+
 // 根据变量的链表计算出偏移量
+// fp下方先存放被调用者保存寄存器的原值，再存放未分配寄存器的变量
 static void assignLVarOffsets(Function* Prog) {
-    int Offset = 0;
+    int Offset = NumSavedRegs * 8;
+
+    // 优化时，存活范围不相交的变量共用栈槽
+    if(OptLevel > 0) {
+        int Size = shareStackSlots(Prog, Offset);
+        if(Size >= 0) {
+            for(Obj* Var = Prog->Locals; Var; Var = Var->Next)
+                if(Var->Reg)
+                    Var->Offset = 0;
+            Prog->StackSize = alignTo(Offset + Size, 16);
+            return;
+        }
+    }
 
     //读取所有变量
     for(Obj* Var = Prog->Locals; Var; Var = Var->Next) {
+        // 位于寄存器中的变量不需要栈空间
+        if(Var->Reg) {
+            Var->Offset = 0;
+            continue;
+        }
         // 每个变量分配8个字节
         Offset += 8;
         // 为每个变量赋一个偏移量，即栈中地址
@@ -250,18 +1072,695 @@ static void assignLVarOffsets(Function* Prog) {
     Prog->StackSize = alignTo(Offset, 16);
 }
 
-void codegen(Function* Prog) {
-    assignLVarOffsets(Prog);
-    printf("  # 定义全局main段\n");
-    printf("  .global main\n");
-    printf("\n# =====程序开始===============\n");
-    printf("# main段标签，也是程序入口段\n");
-    printf("main:\n");
+//
+// SSA后端
+//
+// 由SSA形式的函数体生成代码：按基本块的顺序为指令编号，求出每个值的存活区间，
+// 以线性扫描分配寄存器，寄存器用尽时将区间最远的值溢出到栈中。
+// 常量不占用寄存器，在使用处作为立即数或由li加载。
+// phi在前驱的末尾转换为并行复制，控制流图中没有关键边，
+// 有phi的块的前驱都只有这一个后继
+
+// 分配给值的寄存器，t0与a0作为暂存寄存器，不在其中
+// 没有函数调用，先使用无需保存的t1~t6、a1~a7，再使用s1~s11
+static int IRRegs[] = {6,  7,  28, 29, 30, 31, 11, 12, 13, 14, 15, 16,
+                       17, 9,  18, 19, 20, 21, 22, 23, 24, 25, 26, 27};
+
+// 可分配的寄存器数量
+#define IR_REG_NUM (int)(sizeof(IRRegs) / sizeof(*IRRegs))
+
+// 值在代码生成中的信息，下标为值的编号
+typedef struct {
+    int Pos; // 指令的位置
+    int Start, End; // 存活区间
+    int Reg; // 分配到的寄存器，0表示溢出到栈中
+    int Slot; // 溢出时的栈槽编号，从1开始
+    bool Fused; // 比较已合并到分支指令中，不单独生成
+} ValInfo;
+
+// 基本块在代码生成中的信息，下标为基本块的编号
+typedef struct {
+    int Start, End; // 块开头的位置，以及末尾跳转指令的位置
+} BlockInfo;
+
+static ValInfo* Vals;
+static BlockInfo* Blocks;
+// 溢出的栈槽数
+static int NumSlots;
+
+// 是否为比较运算
+static bool isIRCompare(IROp Op) {
+    return Op == IR_EQ || Op == IR_NE || Op == IR_LT || Op == IR_LE;
+}
+
+// 是否为12位以内的常量，可以作为立即数
+static bool isImmConst(IRValue* V) {
+    return V->Op == IR_CONST && isImm12(V->Val);
+}
+
+// 值是否需要分配寄存器或栈槽
+static bool needsLoc(IRValue* V) {
+    return V->Op != IR_CONST && V->Op != IR_JMP && V->Op != IR_BR &&
+           V->Op != IR_RET && !Vals[V->Id].Fused;
+}
+
+// 将值的存活区间扩展到包含位置Pos
+static void extendTo(IRValue* V, int Pos) {
+    ValInfo* I = &Vals[V->Id];
+    if(Pos < I->Start)
+        I->Start = Pos;
+    if(Pos > I->End)
+        I->End = Pos;
+}
+
+// 基本块B在S的前驱中的下标
+static int predIndex(IRBlock* S, IRBlock* B) {
+    for(int I = 0; I < S->NumPreds; I++)
+        if(S->Preds[I] == B)
+            return I;
+    error("invalid control flow graph");
+    return -1;
+}
+
+// 按指令顺序编号，将只用于分支的比较合并到分支指令中
+static void numberIR(IRFunc* F) {
+    int P = 0;
+    for(int I = 0; I < F->NumBlocks; I++) {
+        IRBlock* B = F->Blocks[I];
+        IRValue* T = B->Last;
+        if(T->Op == IR_BR) {
+            IRValue* C = T->Args[0];
+            if(isIRCompare(C->Op) && C->Block == B && C->NumUsers == 1) {
+                irMoveBefore(C, T);
+                Vals[C->Id].Fused = true;
+            }
+        }
+
+        Blocks[I].Start = P;
+        P += 2;
+        for(IRValue* V = B->First; V; V = V->Next) {
+            Vals[V->Id].Pos = P;
+            P += 2;
+        }
+        Blocks[I].End = Vals[T->Id].Pos;
+    }
+}
+
+// 存活分析时待处理的基本块，以及各块最近一次标记时的值的编号加1
+static IRBlock** LiveWork;
+static int* LiveMark;
+
+// V在基本块B的入口处存活：沿前驱向上传播，直到V的定义所在的块
+// 区间取所有存活位置的范围，是实际存活范围的超集
+static void liveIn(IRValue* V, IRBlock* B) {
+    int Top = 0;
+    if(LiveMark[B->Id] == V->Id + 1)
+        return;
+    LiveMark[B->Id] = V->Id + 1;
+    LiveWork[Top++] = B;
+    while(Top > 0) {
+        IRBlock* X = LiveWork[--Top];
+        extendTo(V, Blocks[X->Id].Start);
+        for(int I = 0; I < X->NumPreds; I++) {
+            IRBlock* P = X->Preds[I];
+            extendTo(V, Blocks[P->Id].End);
+            if(P == V->Block || LiveMark[P->Id] == V->Id + 1)
+                continue;
+            LiveMark[P->Id] = V->Id + 1;
+            LiveWork[Top++] = P;
+        }
+    }
+}
+
+// 求出每个值的存活区间
+// 从每个使用处沿控制流图逆向传播到定义处，代价与存活范围的大小成正比
+static void buildIntervals(IRFunc* F) {
+    LiveWork = malloc(sizeof(IRBlock*) * (F->NumBlocks + 1));
+    LiveMark = calloc(F->NumBlocks + 1, sizeof(int));
+    if(!LiveWork || !LiveMark)
+        error("out of memory");
+
+    for(int I = 0; I < F->NumBlocks; I++)
+        for(IRValue* V = F->Blocks[I]->First; V; V = V->Next)
+            Vals[V->Id].Start = Vals[V->Id].End = Vals[V->Id].Pos;
+
+    for(int I = 0; I < F->NumBlocks; I++) {
+        IRBlock* B = F->Blocks[I];
+        for(IRValue* V = B->First; V; V = V->Next) {
+            // phi在各前驱的末尾写入，参数在那里读取
+            if(V->Op == IR_PHI) {
+                for(int J = 0; J < V->NumArgs; J++) {
+                    IRBlock* P = B->Preds[J];
+                    IRValue* A = V->Args[J];
+                    extendTo(V, Blocks[P->Id].End);
+                    if(!needsLoc(A))
+                        continue;
+                    extendTo(A, Blocks[P->Id].End);
+                    if(A->Block != P)
+                        liveIn(A, P);
+                }
+                continue;
+            }
+            // 合并到分支中的比较在分支指令处读取参数
+            int Use = Vals[V->Id].Fused ? Blocks[I].End : Vals[V->Id].Pos;
+            for(int J = 0; J < V->NumArgs; J++) {
+                IRValue* A = V->Args[J];
+                if(!needsLoc(A))
+                    continue;
+                extendTo(A, Use);
+                if(A->Block != B)
+                    liveIn(A, B);
+            }
+        }
+    }
+
+    free(LiveWork);
+    free(LiveMark);
+    LiveWork = NULL;
+    LiveMark = NULL;
+}
+
+// 按区间的起点排序，起点相同时按编号
+static int cmpStart(const void* A, const void* B) {
+    ValInfo* X = &Vals[(*(IRValue**)A)->Id];
+    ValInfo* Y = &Vals[(*(IRValue**)B)->Id];
+    if(X->Start != Y->Start)
+        return X->Start < Y->Start ? -1 : 1;
+    return (*(IRValue**)A)->Id - (*(IRValue**)B)->Id;
+}
+
+// 线性扫描分配寄存器
+static void linearScan(IRFunc* F) {
+    int N = 0;
+    IRValue** Order = malloc(sizeof(IRValue*) * (F->NumValues + 1));
+    if(!Order)
+        error("out of memory");
+    for(int I = 0; I < F->NumBlocks; I++)
+        for(IRValue* V = F->Blocks[I]->First; V; V = V->Next)
+            if(needsLoc(V))
+                Order[N++] = V;
+    qsort(Order, N, sizeof(IRValue*), cmpStart);
+
+    // 占用各寄存器的值，下标为在IRRegs中的序号
+    IRValue* Active[IR_REG_NUM] = {0};
+    NumSlots = 0;
+    NumSavedRegs = 0;
+
+    for(int I = 0; I < N; I++) {
+        IRValue* V = Order[I];
+        ValInfo* VI = &Vals[V->Id];
+
+        // 释放区间已结束的寄存器，结束处的读取先于此处的写入
+        int Free = -1;
+        for(int R = 0; R < IR_REG_NUM; R++) {
+            if(Active[R] && Vals[Active[R]->Id].End <= VI->Start)
+                Active[R] = NULL;
+            if(!Active[R] && Free < 0)
+                Free = R;
+        }
+
+        // 没有空闲的寄存器时，溢出区间结束最晚的值
+        if(Free < 0) {
+            int Far = 0;
+            for(int R = 1; R < IR_REG_NUM; R++)
+                if(Vals[Active[R]->Id].End > Vals[Active[Far]->Id].End)
+                    Far = R;
+            if(Vals[Active[Far]->Id].End <= VI->End) {
+                VI->Slot = ++NumSlots;
+                continue;
+            }
+            ValInfo* Spilled = &Vals[Active[Far]->Id];
+            Spilled->Reg = 0;
+            Spilled->Slot = ++NumSlots;
+            Free = Far;
+        }
+
+        Active[Free] = V;
+        VI->Reg = IRRegs[Free];
+        // 使用的s寄存器需要在序言中保存
+        if(VI->Reg == sReg(1) && NumSavedRegs < 1)
+            NumSavedRegs = 1;
+        if(VI->Reg >= sReg(2) && VI->Reg <= sReg(SAVED_REG_NUM) &&
+           NumSavedRegs < VI->Reg - 16)
+            NumSavedRegs = VI->Reg - 16;
+    }
+    free(Order);
+}
+
+// 为SSA形式的函数体分配寄存器与栈槽，计算栈的大小
+static void allocIR(Function* Prog) {
+    IRFunc* F = Prog->IR;
+    Vals = calloc(F->NumValues + 1, sizeof(ValInfo));
+    Blocks = calloc(F->NumBlocks + 1, sizeof(BlockInfo));
+    if(!Vals || !Blocks)
+        error("out of memory");
+
+    numberIR(F);
+    buildIntervals(F);
+    linearScan(F);
+    Prog->StackSize = alignTo(NumSavedRegs * 8 + NumSlots * 8, 16);
+}
+
+// 栈槽相对fp的偏移量，位于被调用者保存寄存器的下方
+static int slotOffset(int Slot) {
+    return -(NumSavedRegs + Slot) * 8;
+}
+
+// 将值读到寄存器中，返回所在的寄存器
+// 常量与溢出的值读到暂存寄存器Scratch中
+static int irUse(IRValue* V, int Scratch) {
+    if(V->Op == IR_CONST) {
+        if(!V->Val)
+            return R_ZERO;
+        emitI(RV_LI, Scratch, 0, V->Val);
+        return Scratch;
+    }
+    ValInfo* VI = &Vals[V->Id];
+    if(VI->Reg)
+        return VI->Reg;
+    emitI(RV_LD, Scratch, R_FP, slotOffset(VI->Slot));
+    return Scratch;
+}
+
+// 写入值的结果的寄存器，溢出的值先写入t0
+static int irDst(IRValue* V) {
+    return Vals[V->Id].Reg ? Vals[V->Id].Reg : R_T0;
+}
+
+// 溢出的值写回栈槽
+static void irDef(IRValue* V) {
+    if(!Vals[V->Id].Reg)
+        emitStore(R_T0, R_FP, slotOffset(Vals[V->Id].Slot));
+}
+
+// 值所在的位置，正数为寄存器，负数为栈槽的相反数，常量为0
+static int irLoc(IRValue* V) {
+    if(V->Op == IR_CONST)
+        return 0;
+    return Vals[V->Id].Reg ? Vals[V->Id].Reg : -Vals[V->Id].Slot;
+}
+
+// 并行复制中的一次复制
+typedef struct {
+    int Dst; // 目标位置
+    int Src; // 源位置，为0时复制常量Val
+    int64_t Val;
+} Move;
+
+// 将Src位置或常量Val复制到Dst位置，内存之间的复制借助a0
+static void emitMove(int Dst, int Src, int64_t Val) {
+    int Reg = Dst > 0 ? Dst : R_A0;
+    if(Src > 0)
+        Reg = Dst > 0 ? (emitR(RV_MV, Dst, Src, 0), Dst) : Src;
+    else if(Src < 0)
+        emitI(RV_LD, Reg, R_FP, slotOffset(-Src));
+    else if(Val || Dst > 0)
+        emitI(RV_LI, Reg, 0, Val);
+    else
+        Reg = R_ZERO;
+    if(Dst < 0)
+        emitStore(Reg, R_FP, slotOffset(-Dst));
+}
+
+// 并行复制的缓冲区
+static Move* Moves;
+static int MoveCap;
+
+// 在B的末尾为后继S的phi生成并行复制
+// 依次生成目标不再被其他复制读取的复制，只剩环时将一个源暂存到t0中
+static void genPhiCopies(IRBlock* B, IRBlock* S) {
+    int Idx = predIndex(S, B);
+    int N = 0;
+    for(IRValue* Phi = S->First; Phi && Phi->Op == IR_PHI; Phi = Phi->Next) {
+        IRValue* A = Phi->Args[Idx];
+        int Dst = irLoc(Phi);
+        int Src = irLoc(A);
+        if(Src && Src == Dst)
+            continue;
+        if(N == MoveCap) {
+            MoveCap = MoveCap ? MoveCap * 2 : 16;
+            Moves = realloc(Moves, sizeof(Move) * MoveCap);
+            if(!Moves)
+                error("out of memory");
+        }
+        Moves[N++] = (Move){Dst, Src, A->Op == IR_CONST ? A->Val : 0};
+    }
+
+    while(N > 0) {
+        int I = 0;
+        for(; I < N; I++) {
+            bool Blocked = false;
+            for(int J = 0; J < N && !Blocked; J++)
+                Blocked = J != I && Moves[J].Src == Moves[I].Dst;
+            if(!Blocked)
+                break;
+        }
+
+        if(I == N) {
+            // 剩下的复制都在环中，将一个源暂存到t0，打破环
+            int Loc = 0;
+            for(int J = 0; J < N && !Loc; J++)
+                Loc = Moves[J].Src;
+            annotate("  # 并行复制成环，暂存到t0");
+            emitMove(R_T0, Loc, 0);
+            for(int J = 0; J < N; J++)
+                if(Moves[J].Src == Loc)
+                    Moves[J].Src = R_T0;
+            continue;
+        }
+
+        emitMove(Moves[I].Dst, Moves[I].Src, Moves[I].Val);
+        Moves[I] = Moves[--N];
+    }
+}
+
+// 生成比较运算，结果0或1写入Rd
+static void genIRCompare(IRValue* V, int Rd) {
+    IRValue* A = V->Args[0];
+    IRValue* B = V->Args[1];
+    switch(V->Op) {
+    case IR_EQ:
+    case IR_NE: {
+        InstKind Set = V->Op == IR_EQ ? RV_SEQZ : RV_SNEZ;
+        // 与0比较时直接判断，与小常量比较时先异或立即数
+        if(A->Op == IR_CONST && !A->Val) {
+            emitR(Set, Rd, irUse(B, R_T0), 0);
+            return;
+        }
+        int Rs1 = irUse(A, R_T0);
+        if(isImmConst(B)) {
+            if(B->Val)
+                emitI(RV_XORI, Rd, Rs1, B->Val);
+            emitR(Set, Rd, B->Val ? Rd : Rs1, 0);
+            return;
+        }
+        int Rs2 = irUse(B, R_A0);
+        emitR(RV_XOR, Rd, Rs1, Rs2);
+        emitR(Set, Rd, Rd, 0);
+        return;
+    }
+    case IR_LT: {
+        int Rs1 = irUse(A, R_T0);
+        if(isImmConst(B)) {
+            emitI(RV_SLTI, Rd, Rs1, B->Val);
+            return;
+        }
+        int Rs2 = irUse(B, R_A0);
+        emitR(RV_SLT, Rd, Rs1, Rs2);
+        return;
+    }
+    default: {
+        // A<=B即!(B<A)
+        int Rs1 = irUse(B, R_T0);
+        if(isImmConst(A)) {
+            emitI(RV_SLTI, Rd, Rs1, A->Val);
+        } else {
+            int Rs2 = irUse(A, R_A0);
+            emitR(RV_SLT, Rd, Rs1, Rs2);
+        }
+        emitI(RV_XORI, Rd, Rd, 1);
+        return;
+    }
+    }
+}
+
+// 生成分支：条件成立时跳转到Then，否则跳转到Els
+static void genIRBranch(IRValue* Cond, IRBlock* Then, IRBlock* Els) {
+    int64_t ThenLabel = LABEL(LB_BLOCK, Then->Id);
+    if(Vals[Cond->Id].Fused) {
+        int Rs1 = irUse(Cond->Args[0], R_T0);
+        int Rs2 = irUse(Cond->Args[1], R_A0);
+        switch(Cond->Op) {
+        case IR_EQ:
+            emitBranch(RV_BEQ, Rs1, Rs2, ThenLabel);
+            break;
+        case IR_NE:
+            emitBranch(RV_BNE, Rs1, Rs2, ThenLabel);
+            break;
+        case IR_LT:
+            emitBranch(RV_BLT, Rs1, Rs2, ThenLabel);
+            break;
+        default:
+            emitBranch(RV_BGE, Rs2, Rs1, ThenLabel);
+            break;
+        }
+    } else {
+        emitLabel(RV_BNEZ, irUse(Cond, R_T0), ThenLabel);
+    }
+    emitLabel(RV_J, 0, LABEL(LB_BLOCK, Els->Id));
+}
+
+// 生成一个值的指令
+static void genIRValue(IRValue* V) {
+    IRBlock* B = V->Block;
+    if(V->Op == IR_CONST || V->Op == IR_PHI || Vals[V->Id].Fused)
+        return;
+
+    switch(V->Op) {
+    case IR_JMP:
+        genPhiCopies(B, B->Succs[0]);
+        emitLabel(RV_J, 0, LABEL(LB_BLOCK, B->Succs[0]->Id));
+        return;
+    case IR_BR:
+        genIRBranch(V->Args[0], B->Succs[0], B->Succs[1]);
+        return;
+    case IR_RET:
+        emitMove(R_A0, irLoc(V->Args[0]), V->Args[0]->Val);
+        emitLabel(RV_J, 0, LABEL(LB_RETURN, 0));
+        return;
+    default:
+        break;
+    }
+
+    int Rd = irDst(V);
+    IRValue* A = V->Args[0];
+    IRValue* C = V->NumArgs > 1 ? V->Args[1] : NULL;
+    switch(V->Op) {
+    case IR_ADD:
+        // 常量在任一侧时使用addi
+        if(isImmConst(C)) {
+            emitI(RV_ADDI, Rd, irUse(A, R_T0), C->Val);
+        } else if(isImmConst(A)) {
+            emitI(RV_ADDI, Rd, irUse(C, R_T0), A->Val);
+        } else {
+            int Rs1 = irUse(A, R_T0);
+            emitR(RV_ADD, Rd, Rs1, irUse(C, R_A0));
+        }
+        break;
+    case IR_SUB:
+        if(C->Op == IR_CONST && isImm12(-C->Val)) {
+            emitI(RV_ADDI, Rd, irUse(A, R_T0), -C->Val);
+        } else {
+            int Rs1 = irUse(A, R_T0);
+            emitR(RV_SUB, Rd, Rs1, irUse(C, R_A0));
+        }
+        break;
+    case IR_MUL:
+    case IR_DIV: {
+        int Rs1 = irUse(A, R_T0);
+        emitR(V->Op == IR_MUL ? RV_MUL : RV_DIV, Rd, Rs1, irUse(C, R_A0));
+        break;
+    }
+    case IR_NEG:
+        emitR(RV_NEG, Rd, irUse(A, R_T0), 0);
+        break;
+    default:
+        genIRCompare(V, Rd);
+        break;
+    }
+    irDef(V);
+}
+
+// 按逆后序生成各基本块，跳到紧随其后的块的跳转由基本块布局删除
+static void genIR(IRFunc* F) {
+    for(int I = 0; I < F->NumBlocks; I++) {
+        annotate("\n# 基本块b%d", I);
+        emitLabel(RV_LABEL, 0, LABEL(LB_BLOCK, I));
+        for(IRValue* V = F->Blocks[I]->First; V; V = V->Next)
+            genIRValue(V);
+    }
+
+    free(Vals);
+    free(Blocks);
+    free(Moves);
+    Vals = NULL;
+    Blocks = NULL;
+    Moves = NULL;
+    MoveCap = 0;
+}
+
+// 寄存器的名称，x8使用fp
+static char* RegNames[REG_NUM] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+// 寄存器的名称
+char* regName(int Reg) {
+    return RegNames[Reg];
+}
+
+// 将标签的名称写入缓冲区
+static void putLabel(int64_t Label) {
+    switch(Label % LB_NUM) {
+    case LB_MAIN:
+        putStr("main");
+        return;
+    case LB_RETURN:
+        putStr(".L.return");
+        return;
+    case LB_ELSE:
+        putStr(".L.else.");
+        break;
+    case LB_END:
+        putStr(".L.end.");
+        break;
+    case LB_BLOCK:
+        putStr(".L.bb.");
+        break;
+    default:
+        putStr(".L.begin.");
+        break;
+    }
+    putInt(Label / LB_NUM);
+}
+
+// 指令的助记符
+static char* Mnemonics[] = {
+    [RV_ADD] = "add",   [RV_SUB] = "sub",   [RV_MUL] = "mul",
+    [RV_DIV] = "div",   [RV_XOR] = "xor",   [RV_SLT] = "slt",
+    [RV_ADDI] = "addi", [RV_XORI] = "xori", [RV_SLTI] = "slti",
+    [RV_NEG] = "neg",   [RV_SEQZ] = "seqz", [RV_SNEZ] = "snez",
+    [RV_MV] = "mv",     [RV_LI] = "li",     [RV_LUI] = "lui",
+    [RV_LD] = "ld",
+    [RV_SD] = "sd",     [RV_J] = "j",       [RV_BEQZ] = "beqz",
+    [RV_BNEZ] = "bnez", [RV_BEQ] = "beq",   [RV_BNE] = "bne",   [RV_BLT] = "blt",
+    [RV_BGE] = "bge",
+    [RV_RET] = "ret",   [RV_GLOBAL] = ".global",
+};
+
+// 将指令列表输出为汇编
+// 指令数量可达数百万条，因此直接拼接到缓冲区，不经过printf的格式解析
+static void printInsts(FILE* Out) {
+    OutputFile = Out;
+    OutLen = 0;
+
+    for(int I = 0; I < Code.Len; I++) {
+        Inst* In = &Code.Data[I];
+
+        // 注释的长度不定，单独输出
+        if(In->Kind == RV_COMMENT) {
+            size_t Len = strlen(In->Text);
+            reserve(Len + 1);
+            if(Len + 1 > OUT_BUF_SIZE) {
+                fputs(In->Text, OutputFile);
+                fputc('\n', OutputFile);
+                continue;
+            }
+            putStr(In->Text);
+            OutBuf[OutLen++] = '\n';
+            continue;
+        }
+        if(In->Kind == RV_NOP)
+            continue;
+
+        reserve(MAX_LINE);
+        if(In->Kind == RV_LABEL) {
+            putLabel(In->Imm);
+            putStr(":\n");
+            continue;
+        }
+
+        putStr("  ");
+        putStr(Mnemonics[In->Kind]);
+        switch(In->Kind) {
+        case RV_ADD: case RV_SUB: case RV_MUL: case RV_DIV: case RV_XOR:
+        case RV_SLT:
+            putStr(" ");
+            putStr(regName(In->Rd));
+            putStr(", ");
+            putStr(regName(In->Rs1));
+            putStr(", ");
+            putStr(regName(In->Rs2));
+            break;
+        case RV_ADDI: case RV_XORI: case RV_SLTI:
+            putStr(" ");
+            putStr(regName(In->Rd));
+            putStr(", ");
+            putStr(regName(In->Rs1));
+            putStr(", ");
+            putInt(In->Imm);
+            break;
+        case RV_NEG: case RV_SEQZ: case RV_SNEZ: case RV_MV:
+            putStr(" ");
+            putStr(regName(In->Rd));
+            putStr(", ");
+            putStr(regName(In->Rs1));
+            break;
+        case RV_LI: case RV_LUI:
+            putStr(" ");
+            putStr(regName(In->Rd));
+            putStr(", ");
+            putInt(In->Imm);
+            break;
+        case RV_LD: case RV_SD:
+            putStr(" ");
+            putStr(regName(In->Kind == RV_LD ? In->Rd : In->Rs2));
+            putStr(", ");
+            putInt(In->Imm);
+            putStr("(");
+            putStr(regName(In->Rs1));
+            putStr(")");
+            break;
+        case RV_J: case RV_GLOBAL:
+            putStr(" ");
+            putLabel(In->Imm);
+            break;
+        case RV_BEQZ: case RV_BNEZ:
+            putStr(" ");
+            putStr(regName(In->Rs1));
+            putStr(", ");
+            putLabel(In->Imm);
+            break;
+        case RV_BEQ: case RV_BNE: case RV_BLT: case RV_BGE:
+            putStr(" ");
+            putStr(regName(In->Rs1));
+            putStr(", ");
+            putStr(regName(In->Rs2));
+            putStr(", ");
+            putLabel(In->Imm);
+            break;
+        default:
+            break;
+        }
+        OutBuf[OutLen++] = '\n';
+    }
+
+    flushOut();
+}
+
+void codegen(Function* Prog, FILE* Out) {
+    Code.Len = 0;
+    if(Prog->IR) {
+        allocIR(Prog);
+    } else {
+        assignLVarRegs(Prog);
+        assignLVarOffsets(Prog);
+    }
+    annotate("  # 定义全局main段");
+    emitLabel(RV_GLOBAL, 0, LABEL(LB_MAIN, 0));
+    annotate("\n# =====程序开始===============");
+    annotate("# main段标签，也是程序入口段");
+    emitLabel(RV_LABEL, 0, LABEL(LB_MAIN, 0));
 
     // 栈布局
     //-------------------------------// sp
     //              fp                  
     //-------------------------------// fp = sp-8
+    //     被调用者保存寄存器s1~s11         
+    //-------------------------------//
     //              变量                 
     //-------------------------------// fp = sp-8-StackSize
     //           表达式计算
@@ -269,35 +1768,85 @@ void codegen(Function* Prog) {
 
     // Prologue, 前言
     // 将fp压入栈中，保存fp的值
-    printf(" # 将fp压栈，fp属于“被调用者保存”的寄存器，需要恢复原值\n");
-    printf("  addi sp, sp, -8\n");
-    printf("  sd fp, 0(sp)\n");
+    annotate(" # 将fp压栈，fp属于“被调用者保存”的寄存器，需要恢复原值");
+    emitI(RV_ADDI, R_SP, R_SP, -8);
+    emitStore(R_FP, R_SP, 0);
     // 将sp写入fp
-    printf("  # 将sp的值写入fp\n");
-    printf("  mv fp, sp\n");
+    annotate("  # 将sp的值写入fp");
+    emitR(RV_MV, R_FP, R_SP, 0);
 
     // 偏移量为实际变量所用的栈大小
-    printf("  # sp腾出StackSize大小的栈空间\n");
-    printf("  addi sp, sp, -%d\n", Prog->StackSize);
+    annotate("  # sp腾出StackSize大小的栈空间");
+    if(Prog->StackSize <= 2048) {
+        emitI(RV_ADDI, R_SP, R_SP, -Prog->StackSize);
+    } else {
+        // 超出12位立即数的范围，借助t0完成
+        emitI(RV_LI, R_T0, 0, -Prog->StackSize);
+        emitR(RV_ADD, R_SP, R_SP, R_T0);
+    }
+
+    // 保存用于存放变量的被调用者保存寄存器
+    for(int I = 1; I <= NumSavedRegs; I++) {
+        annotate("  # 保存寄存器s%d", I);
+        emitStore(sReg(I), R_FP, -8 * I);
+    }
+
+    annotate("\n# =====程序主体===============");
+    if(Prog->IR) {
+        genIR(Prog->IR);
+    } else {
+        Matches = calloc(nodeCount(), sizeof(Match));
+        if(!Matches)
+            error("out of memory");
+        genStmt(getNode(Prog->Body));
+        assert(Depth == 0);
 
-    printf("\n# =====程序主体===============\n");
-    genStmt(Prog->Body);
-    assert(Depth == 0);
+        // 表达式遍历的栈与匹配结果仅在代码生成期间使用
+        free(Frames);
+        Frames = NULL;
+        FrameCap = 0;
+        free(Matches);
+        Matches = NULL;
+    }
 
     // Epilogue，后语
     // 输出return段标签
-    printf("\n# =====程序结束===============\n");
-    printf("# return段标签\n");
-    printf(".L.return:\n");
+    annotate("\n# =====程序结束===============");
+    annotate("# return段标签");
+    emitLabel(RV_LABEL, 0, LABEL(LB_RETURN, 0));
+    // 恢复被调用者保存寄存器
+    for(int I = 1; I <= NumSavedRegs; I++) {
+        annotate("  # 恢复寄存器s%d", I);
+        emitI(RV_LD, sReg(I), R_FP, -8 * I);
+    }
     // 将fp的值改写回sp
-    printf("  # 将fp的值写回sp\n");
-    printf("  mv sp, fp\n");
+    annotate("  # 将fp的值写回sp");
+    emitR(RV_MV, R_SP, R_FP, 0);
     // 将最早fp保存的值弹栈，恢复fp。
-    printf("  # 将最早fp保存的值弹栈，恢复fp和sp\n");
-    printf("  ld fp, 0(sp)\n");
-    printf("  addi sp, sp, 8\n");
+    annotate("  # 将最早fp保存的值弹栈，恢复fp和sp");
+    emitI(RV_LD, R_FP, R_SP, 0);
+    emitI(RV_ADDI, R_SP, R_SP, 8);
 
     // 返回
-    printf(" # 返回a0值给系统调用\n");
-    printf("  ret\n");
+    annotate(" # 返回a0值给系统调用");
+    newInst(RV_RET);
+
+    // 优化后输出汇编，或编码为机器码输出ELF文件
+    if(OptLevel > 0) {
+        layoutBlocks(&Code);
+        peephole(&Code);
+    }
+    if(OptEmit == EMIT_ASM)
+        printInsts(Out);
+    else
+        emitElf(&Code, OptEmit == EMIT_EXE, Out);
+
+    for(int I = 0; I < Code.Len; I++)
+        if(!isPseudo(&Code.Data[I]))
+            CgStats.Insts++;
+    if(Code.Cap * sizeof(Inst) > CgStats.InstBytes)
+        CgStats.InstBytes = Code.Cap * sizeof(Inst);
+
+    free(Code.Data);
+    Code = (InstList){0};
 }
\ No newline at end of file
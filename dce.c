@@ -0,0 +1,247 @@
+#include "rvcc.h"
+
+// 死代码删除
+//
+// 在AST上删除不会执行或执行了也没有效果的语句：
+//   return之后、或恒不退出的循环之后的语句
+//   没有副作用的表达式语句，如1;与a+b;
+//   条件为常量的if与for中不会执行的分支
+// 语言中没有break与函数调用，语句只能通过return离开，
+// 因此没有条件的for不会执行到其后的语句。
+//
+// 在SSA上删除没有被使用的值，删除后其参数可能也不再被使用，使用工作表反复处理
+
+// 删除的种类
+typedef enum {
+    DC_UNREACHABLE, // 不会执行到的语句
+    DC_PURE, // 没有副作用的表达式语句
+    DC_BRANCH, // 条件为常量的if与for
+    DC_VALUE, // SSA中没有被使用的值
+    DC_NUM,
+} DeadKind;
+
+// 删除的名称，用于输出统计
+static char* DeadNames[DC_NUM] = {
+    [DC_UNREACHABLE] = "unreachable",
+    [DC_PURE] = "pure",
+    [DC_BRANCH] = "branch",
+    [DC_VALUE] = "value",
+};
+
+// 每种删除进行的次数
+static long DeadCnt[DC_NUM];
+// 删除前后函数体中的节点数，NodesBefore为-1表示未进行
+static long NodesBefore = -1, NodesAfter;
+
+// 统计节点数时使用的显式栈
+static WorkStack Work;
+
+// 统计语句中的节点数
+static long countNodes(NodeId Root) {
+    long N = 0;
+    Work.Top = 0;
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        Node* Nd = getNode(popNode(&Work));
+        N++;
+        switch(Nd->Kind) {
+        case ND_NUM:
+        case ND_VAR:
+            break;
+        case ND_BLOCK:
+            for(NodeId S = Nd->Body; S; S = getNode(S)->Next)
+                pushNode(&Work, S);
+            break;
+        case ND_IF:
+        case ND_FOR:
+            pushNode(&Work, getExt(Nd)->Init);
+            pushNode(&Work, getExt(Nd)->Inc);
+            pushNode(&Work, getExt(Nd)->Els);
+            pushNode(&Work, Nd->Cond);
+            pushNode(&Work, Nd->Then);
+            break;
+        default:
+            pushNode(&Work, Nd->LHS);
+            pushNode(&Work, Nd->RHS);
+            break;
+        }
+    }
+    return N;
+}
+
+// 将节点Id改写为空的代码块
+static NodeId toEmptyBlock(NodeId Id) {
+    Node* Nd = getNode(Id);
+    Nd->Kind = ND_BLOCK;
+    Nd->Body = 0;
+    Nd->RHS = 0;
+    Nd->Ext = 0;
+    return Id;
+}
+
+// 是否为空的代码块
+static bool isEmptyBlock(NodeId Id) {
+    Node* Nd = getNode(Id);
+    return Nd->Kind == ND_BLOCK && !Nd->Body;
+}
+
+// 删除语句中的死代码，返回替换后的语句，调用者负责维护Next
+// 语句执行后不会到达其后的语句时，*Exits置为true
+static NodeId dceStmt(NodeId Id, bool* Exits) {
+    Node* Nd = getNode(Id);
+    *Exits = false;
+    switch(Nd->Kind) {
+    case ND_IF: {
+        NodeExt* Ext = getExt(Nd);
+        // 条件为常量时，只保留会执行的分支
+        Node* Cond = getNode(Nd->Cond);
+        if(Cond->Kind == ND_NUM) {
+            DeadCnt[DC_BRANCH]++;
+            if(Cond->Val)
+                return dceStmt(Nd->Then, Exits);
+            return Ext->Els ? dceStmt(Ext->Els, Exits) : toEmptyBlock(Id);
+        }
+
+        bool ThenExits, ElsExits = false;
+        Nd->Then = dceStmt(Nd->Then, &ThenExits);
+        if(Ext->Els) {
+            Ext->Els = dceStmt(Ext->Els, &ElsExits);
+            if(isEmptyBlock(Ext->Els))
+                Ext->Els = 0;
+        }
+        *Exits = ThenExits && ElsExits;
+
+        // 两个分支都为空时，只需计算条件
+        if(isEmptyBlock(Nd->Then) && !Ext->Els) {
+            if(isPure(Nd->Cond)) {
+                DeadCnt[DC_PURE]++;
+                return toEmptyBlock(Id);
+            }
+            Nd->Kind = ND_EXPR_STMT;
+            Nd->LHS = Nd->Cond;
+            Nd->RHS = 0;
+            Nd->Ext = 0;
+        }
+        return Id;
+    }
+    case ND_FOR: {
+        NodeExt* Ext = getExt(Nd);
+        if(Ext->Init) {
+            Ext->Init = dceStmt(Ext->Init, Exits);
+            if(isEmptyBlock(Ext->Init))
+                Ext->Init = 0;
+        }
+        if(Nd->Cond && getNode(Nd->Cond)->Kind == ND_NUM) {
+            DeadCnt[DC_BRANCH]++;
+            // 条件恒为假，循环体永不执行，只保留初始化语句
+            if(!getNode(Nd->Cond)->Val)
+                return Ext->Init ? Ext->Init : toEmptyBlock(Id);
+            // 条件恒为真，等价于没有条件
+            Nd->Cond = 0;
+        }
+        if(Ext->Inc && isPure(Ext->Inc)) {
+            DeadCnt[DC_PURE]++;
+            Ext->Inc = 0;
+        }
+        bool BodyExits;
+        Nd->Then = dceStmt(Nd->Then, &BodyExits);
+        // 没有条件的循环只能通过return离开
+        *Exits = !Nd->Cond;
+        return Id;
+    }
+    case ND_BLOCK: {
+        NodeId Head = 0;
+        Node* Tail = NULL;
+        for(NodeId N = Nd->Body; N;) {
+            NodeId Next = getNode(N)->Next;
+            NodeId S = dceStmt(N, Exits);
+            N = Next;
+            if(isEmptyBlock(S))
+                continue;
+            if(Tail)
+                Tail->Next = S;
+            else
+                Head = S;
+            Tail = getNode(S);
+            // 之后的语句不会执行
+            if(*Exits) {
+                for(; N; N = getNode(N)->Next)
+                    DeadCnt[DC_UNREACHABLE]++;
+                break;
+            }
+        }
+        if(Tail)
+            Tail->Next = 0;
+        Nd->Body = Head;
+        return Id;
+    }
+    case ND_RETURN:
+        *Exits = true;
+        return Id;
+    case ND_EXPR_STMT:
+        if(isPure(Nd->LHS)) {
+            DeadCnt[DC_PURE]++;
+            return toEmptyBlock(Id);
+        }
+        return Id;
+    default:
+        return Id;
+    }
+}
+
+void eliminateDeadCode(Function* Prog) {
+    long Before = countNodes(Prog->Body);
+    bool Exits;
+    Prog->Body = dceStmt(Prog->Body, &Exits);
+    if(NodesBefore < 0)
+        NodesBefore = NodesAfter = 0;
+    NodesBefore += Before;
+    NodesAfter += countNodes(Prog->Body);
+
+    freeWorkStack(&Work);
+}
+
+void eliminateDeadValues(IRFunc* F) {
+    IRValue** List = NULL;
+    int Top = 0, Cap = 0;
+    for(int I = 0; I < F->NumBlocks; I++) {
+        for(IRValue* V = F->Blocks[I]->First; V; V = V->Next) {
+            if(V->NumUsers || V == F->Blocks[I]->Last)
+                continue;
+            List = growList(List, Top, &Cap, sizeof(IRValue*));
+            List[Top++] = V;
+        }
+    }
+
+    while(Top > 0) {
+        IRValue* V = List[--Top];
+        if(!V->Block || V->NumUsers)
+            continue;
+        DeadCnt[DC_VALUE]++;
+        irRemove(V);
+        // 参数在删除后可能不再被使用
+        for(int I = 0; I < V->NumArgs; I++) {
+            IRValue* A = V->Args[I];
+            if(A->NumUsers || !A->Block)
+                continue;
+            List = growList(List, Top, &Cap, sizeof(IRValue*));
+            List[Top++] = A;
+        }
+    }
+    free(List);
+}
+
+// 输出每种删除进行的次数
+void dceReport(FILE* Out) {
+    if(NodesBefore < 0) {
+        fprintf(Out, "dce: disabled\n");
+        return;
+    }
+    fprintf(Out, "dce: %ld -> %ld nodes", NodesBefore, NodesAfter);
+    if(NodesBefore)
+        fprintf(Out, " (-%.1f%%)",
+                100.0 * (NodesBefore - NodesAfter) / NodesBefore);
+    fprintf(Out, "\n");
+    for(int I = 0; I < DC_NUM; I++)
+        fprintf(Out, "  %-14s %ld\n", DeadNames[I], DeadCnt[I]);
+}
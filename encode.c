@@ -0,0 +1,433 @@
+#include "rvcc.h"
+
+#include <elf.h>
+
+// 机器码与ELF输出
+//
+// 将指令列表直接编码为RV64IM机器码，写出可重定位目标文件或静态可执行文件，
+// 无需再经过汇编器。标签在编码时即解析为相对偏移，因此不需要重定位。
+//
+// 超出范围的跳转经过分支松弛改写为较长的序列：
+//   条件跳转超出±4KiB时，改为反条件跳过其后的j：bxx' .+8; j L
+//   j超出±1MiB时，改为auipc t0, hi; jalr zero, lo(t0)
+// 改写使指令变长，可能让其他跳转也超出范围，因此反复计算地址直到不再变化。
+// 跳转只出现在语句之间，此时t0中没有需要保留的值
+
+// 静态可执行文件的加载地址
+#define EXE_BASE 0x10000ULL
+
+// 指令的操作码
+#define OPC_LOAD 0x03
+#define OPC_OP_IMM 0x13
+#define OPC_AUIPC 0x17
+#define OPC_OP_IMM_32 0x1b
+#define OPC_STORE 0x23
+#define OPC_OP 0x33
+#define OPC_LUI 0x37
+#define OPC_BRANCH 0x63
+#define OPC_JALR 0x67
+#define OPC_JAL 0x6f
+#define OPC_SYSTEM 0x73
+
+// 编码得到的指令字
+static uint32_t* Words;
+static int NumWords, WordCap;
+
+// 每条指令编码后的字节数，以及起始地址
+static int* Sizes;
+static int64_t* Addrs;
+// 标签编号对应的地址，-1表示未定义
+static int64_t* LabelAddrs;
+static int64_t NumLabels;
+
+// 追加一个指令字
+static void emitWord(uint32_t W) {
+    if(NumWords == WordCap) {
+        WordCap = WordCap ? WordCap * 2 : 1024;
+        Words = realloc(Words, sizeof(uint32_t) * WordCap);
+        if(!Words)
+            error("out of memory");
+    }
+    Words[NumWords++] = W;
+}
+
+static uint32_t encR(int Funct7, int Rs2, int Rs1, int Funct3, int Rd, int Opc) {
+    return Funct7 << 25 | Rs2 << 20 | Rs1 << 15 | Funct3 << 12 | Rd << 7 | Opc;
+}
+
+static uint32_t encI(int64_t Imm, int Rs1, int Funct3, int Rd, int Opc) {
+    if(!isImm12(Imm))
+        error("immediate out of range: %ld", (long)Imm);
+    return (uint32_t)(Imm & 0xfff) << 20 | Rs1 << 15 | Funct3 << 12 | Rd << 7 | Opc;
+}
+
+static uint32_t encS(int64_t Imm, int Rs2, int Rs1, int Funct3, int Opc) {
+    if(!isImm12(Imm))
+        error("offset out of range: %ld", (long)Imm);
+    uint32_t U = Imm & 0xfff;
+    return (U >> 5) << 25 | Rs2 << 20 | Rs1 << 15 | Funct3 << 12 |
+           (U & 0x1f) << 7 | Opc;
+}
+
+static uint32_t encB(int64_t Off, int Rs2, int Rs1, int Funct3) {
+    uint32_t U = Off & 0x1fff;
+    return (U >> 12 & 1) << 31 | (U >> 5 & 0x3f) << 25 | Rs2 << 20 | Rs1 << 15 |
+           Funct3 << 12 | (U >> 1 & 0xf) << 8 | (U >> 11 & 1) << 7 | OPC_BRANCH;
+}
+
+static uint32_t encU(int64_t Imm20, int Rd, int Opc) {
+    return (uint32_t)(Imm20 & 0xfffff) << 12 | Rd << 7 | Opc;
+}
+
+static uint32_t encJ(int64_t Off, int Rd) {
+    uint32_t U = Off & 0x1fffff;
+    return (U >> 20 & 1) << 31 | (U >> 1 & 0x3ff) << 21 | (U >> 11 & 1) << 20 |
+           (U >> 12 & 0xff) << 12 | Rd << 7 | OPC_JAL;
+}
+
+// 偏移量能否由条件跳转表示，即13位有符号数
+static bool fitsB(int64_t Off) {
+    return -4096 <= Off && Off <= 4095;
+}
+
+// 偏移量能否由jal表示，即21位有符号数
+static bool fitsJ(int64_t Off) {
+    return -(1 << 20) <= Off && Off < (1 << 20);
+}
+
+// 将任意64位立即数加载到Rd中，返回所需的指令数，Emit为true时输出
+// 32位有符号数使用lui与addiw，否则先加载去掉低12位的高位部分，再左移并加上低12位
+static int genLi(int Rd, int64_t Val, bool Emit) {
+    if(INT32_MIN <= Val && Val <= INT32_MAX) {
+        int64_t Lo = lo12(Val);
+        int64_t Hi = ((Val - Lo) >> 12) & 0xfffff;
+        int N = 0;
+        if(Hi) {
+            if(Emit)
+                emitWord(encU(Hi, Rd, OPC_LUI));
+            N++;
+        }
+        if(Lo || !Hi) {
+            // lui之后的加法须截断为32位，使0x7ffff800这样的值不会被符号扩展
+            if(Emit)
+                emitWord(encI(Lo, Hi ? Rd : R_ZERO, 0, Rd,
+                              Hi ? OPC_OP_IMM_32 : OPC_OP_IMM));
+            N++;
+        }
+        return N;
+    }
+
+    int64_t Lo = lo12(Val);
+    uint64_t Hi = ((uint64_t)Val + 0x800) >> 12;
+    // 去掉高位部分末尾的0，使其尽量短
+    int Shift = 12 + __builtin_ctzll(Hi);
+    int64_t HiVal = (int64_t)((uint64_t)Val + 0x800) >> Shift;
+
+    int N = genLi(Rd, HiVal, Emit);
+    if(Emit)
+        emitWord(encI(Shift, Rd, 1, Rd, OPC_OP_IMM));
+    N++;
+    if(Lo) {
+        if(Emit)
+            emitWord(encI(Lo, Rd, 0, Rd, OPC_OP_IMM));
+        N++;
+    }
+    return N;
+}
+
+// 编码条件跳转，偏移量为Off
+static uint32_t encBranch(Inst* I, InstKind Kind, int64_t Off) {
+    switch(Kind) {
+    case RV_BEQZ: return encB(Off, R_ZERO, I->Rs1, 0);
+    case RV_BNEZ: return encB(Off, R_ZERO, I->Rs1, 1);
+    case RV_BEQ: return encB(Off, I->Rs2, I->Rs1, 0);
+    case RV_BNE: return encB(Off, I->Rs2, I->Rs1, 1);
+    case RV_BLT: return encB(Off, I->Rs2, I->Rs1, 4);
+    case RV_BGE: return encB(Off, I->Rs2, I->Rs1, 5);
+    default: error("invalid branch");
+    }
+}
+
+// 跳转的目标地址
+static int64_t targetAddr(Inst* I) {
+    if(I->Imm < 0 || I->Imm >= NumLabels || LabelAddrs[I->Imm] < 0)
+        error("undefined label %ld", (long)I->Imm);
+    return LabelAddrs[I->Imm];
+}
+
+// 跳转到偏移量Off处所需的字节数
+static int jumpSize(int64_t Off) {
+    return fitsJ(Off) ? 4 : 8;
+}
+
+// 计算每条指令的大小与地址，对超出范围的跳转进行松弛，直到不再变化
+static void relax(InstList* L) {
+    Sizes = calloc(L->Len, sizeof(int));
+    Addrs = calloc(L->Len + 1, sizeof(int64_t));
+    NumLabels = 0;
+    for(int I = 0; I < L->Len; I++) {
+        Inst* In = &L->Data[I];
+        if((In->Kind == RV_LABEL || In->Kind == RV_J || isCondBranch(In)) &&
+           In->Imm >= NumLabels)
+            NumLabels = In->Imm + 1;
+    }
+    LabelAddrs = malloc(sizeof(int64_t) * (NumLabels + 1));
+    if(!Sizes || !Addrs || !LabelAddrs)
+        error("out of memory");
+
+    // 跳转先假定为最短的形式
+    for(int I = 0; I < L->Len; I++) {
+        Inst* In = &L->Data[I];
+        if(In->Kind == RV_LI)
+            Sizes[I] = 4 * genLi(In->Rd, In->Imm, false);
+        else if(!isPseudo(In))
+            Sizes[I] = 4;
+    }
+
+    for(bool Changed = true; Changed;) {
+        for(int64_t K = 0; K < NumLabels; K++)
+            LabelAddrs[K] = -1;
+        int64_t Addr = 0;
+        for(int I = 0; I < L->Len; I++) {
+            Addrs[I] = Addr;
+            if(L->Data[I].Kind == RV_LABEL)
+                LabelAddrs[L->Data[I].Imm] = Addr;
+            Addr += Sizes[I];
+        }
+        Addrs[L->Len] = Addr;
+
+        // 指令只会变长，因此循环一定会结束
+        Changed = false;
+        for(int I = 0; I < L->Len; I++) {
+            Inst* In = &L->Data[I];
+            int Size;
+            if(In->Kind == RV_J) {
+                Size = jumpSize(targetAddr(In) - Addrs[I]);
+            } else if(isCondBranch(In)) {
+                int64_t Off = targetAddr(In) - Addrs[I];
+                Size = fitsB(Off) ? 4 : 4 + jumpSize(Off - 4);
+            } else {
+                continue;
+            }
+            if(Size > Sizes[I]) {
+                Sizes[I] = Size;
+                Changed = true;
+            }
+        }
+    }
+}
+
+// 编码一条无条件跳转，偏移量相对于当前地址
+static void encJump(int64_t Off, int Size) {
+    if(Size == 4) {
+        emitWord(encJ(Off, R_ZERO));
+        return;
+    }
+    // auipc加上的是高20位，jalr再加上低12位的有符号数
+    int64_t Lo = lo12(Off);
+    int64_t Hi = (Off - Lo) >> 12;
+    if(Hi < -(1 << 19) || Hi >= (1 << 19))
+        error("jump out of range");
+    emitWord(encU(Hi, R_T0, OPC_AUIPC));
+    emitWord(encI(Lo, R_T0, 0, R_ZERO, OPC_JALR));
+}
+
+// 编码一条指令
+static void encodeInst(Inst* In, int I) {
+    switch(In->Kind) {
+    case RV_ADD: emitWord(encR(0, In->Rs2, In->Rs1, 0, In->Rd, OPC_OP)); return;
+    case RV_SUB: emitWord(encR(0x20, In->Rs2, In->Rs1, 0, In->Rd, OPC_OP)); return;
+    case RV_MUL: emitWord(encR(1, In->Rs2, In->Rs1, 0, In->Rd, OPC_OP)); return;
+    case RV_DIV: emitWord(encR(1, In->Rs2, In->Rs1, 4, In->Rd, OPC_OP)); return;
+    case RV_XOR: emitWord(encR(0, In->Rs2, In->Rs1, 4, In->Rd, OPC_OP)); return;
+    case RV_SLT: emitWord(encR(0, In->Rs2, In->Rs1, 2, In->Rd, OPC_OP)); return;
+    case RV_ADDI: emitWord(encI(In->Imm, In->Rs1, 0, In->Rd, OPC_OP_IMM)); return;
+    case RV_XORI: emitWord(encI(In->Imm, In->Rs1, 4, In->Rd, OPC_OP_IMM)); return;
+    case RV_SLTI: emitWord(encI(In->Imm, In->Rs1, 2, In->Rd, OPC_OP_IMM)); return;
+    // neg rd, rs即sub rd, zero, rs
+    case RV_NEG: emitWord(encR(0x20, In->Rs1, R_ZERO, 0, In->Rd, OPC_OP)); return;
+    // seqz rd, rs即sltiu rd, rs, 1
+    case RV_SEQZ: emitWord(encI(1, In->Rs1, 3, In->Rd, OPC_OP_IMM)); return;
+    // snez rd, rs即sltu rd, zero, rs
+    case RV_SNEZ: emitWord(encR(0, In->Rs1, R_ZERO, 3, In->Rd, OPC_OP)); return;
+    case RV_MV: emitWord(encI(0, In->Rs1, 0, In->Rd, OPC_OP_IMM)); return;
+    case RV_LI: genLi(In->Rd, In->Imm, true); return;
+    case RV_LUI: emitWord(encU(In->Imm, In->Rd, OPC_LUI)); return;
+    case RV_LD: emitWord(encI(In->Imm, In->Rs1, 3, In->Rd, OPC_LOAD)); return;
+    case RV_SD: emitWord(encS(In->Imm, In->Rs2, In->Rs1, 3, OPC_STORE)); return;
+    case RV_J: encJump(targetAddr(In) - Addrs[I], Sizes[I]); return;
+    case RV_BEQZ: case RV_BNEZ: case RV_BEQ: case RV_BNE: case RV_BLT:
+    case RV_BGE: {
+        int64_t Off = targetAddr(In) - Addrs[I];
+        if(Sizes[I] == 4) {
+            emitWord(encBranch(In, In->Kind, Off));
+            return;
+        }
+        // 反条件跳过其后的长跳转
+        emitWord(encBranch(In, invertBranch(In->Kind), Sizes[I]));
+        encJump(Off - 4, Sizes[I] - 4);
+        return;
+    }
+    // ret即jalr zero, 0(ra)
+    case RV_RET: emitWord(encI(0, R_RA, 0, R_ZERO, OPC_JALR)); return;
+    case RV_LABEL: case RV_GLOBAL: case RV_COMMENT: case RV_NOP: return;
+    }
+    error("invalid instruction");
+}
+
+// 可以自动扩容的输出缓冲区
+static uint8_t* Out;
+static size_t OutLen, OutCap;
+
+// 追加N个字节，Data为NULL时追加0
+static size_t put(void* Data, size_t N) {
+    while(OutLen + N > OutCap) {
+        OutCap = OutCap ? OutCap * 2 : 1 << 16;
+        Out = realloc(Out, OutCap);
+        if(!Out)
+            error("out of memory");
+    }
+    size_t Off = OutLen;
+    if(Data)
+        memcpy(Out + OutLen, Data, N);
+    else
+        memset(Out + OutLen, 0, N);
+    OutLen += N;
+    return Off;
+}
+
+// 以0填充到Align的整数倍
+static void align(size_t Align) {
+    put(NULL, (Align - OutLen % Align) % Align);
+}
+
+void emitElf(InstList* L, bool Exe, FILE* File) {
+    NumWords = 0;
+    relax(L);
+
+    // 可执行文件以_start开始：调用main，再以main的返回值调用exit
+    int64_t MainAddr = -1;
+    for(int I = 0; I < L->Len; I++)
+        if(L->Data[I].Kind == RV_LABEL && L->Data[I].Imm == LABEL(LB_MAIN, 0))
+            MainAddr = Addrs[I];
+    if(MainAddr < 0)
+        error("main is not defined");
+    int StartLen = 0;
+    if(Exe) {
+        StartLen = 12;
+        emitWord(encJ(MainAddr + StartLen, R_RA));
+        emitWord(encI(93, R_ZERO, 0, 17, OPC_OP_IMM));
+        emitWord(encI(0, 0, 0, 0, OPC_SYSTEM));
+    }
+    for(int I = 0; I < L->Len; I++) {
+        encodeInst(&L->Data[I], I);
+        assert(NumWords * 4 == StartLen + Addrs[I + 1]);
+    }
+
+    // 文件布局：ELF头、程序头（仅可执行文件）、.text、.symtab、.strtab、
+    // .shstrtab、节头表
+    OutLen = 0;
+    Elf64_Ehdr Eh = {0};
+    put(&Eh, sizeof(Eh));
+    size_t PhOff = 0;
+    if(Exe) {
+        Elf64_Phdr Ph = {0};
+        PhOff = put(&Ph, sizeof(Ph));
+    }
+
+    size_t TextOff = put(Words, NumWords * 4);
+    size_t TextLen = NumWords * 4;
+    uint64_t TextAddr = Exe ? EXE_BASE + TextOff : 0;
+
+    char StrTab[] = "\0main\0_start";
+    char ShStrTab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+
+    // 符号表：空符号、main，可执行文件还有_start
+    align(8);
+    size_t SymOff = OutLen;
+    Elf64_Sym Sym = {0};
+    put(&Sym, sizeof(Sym));
+    Sym.st_name = 1;
+    Sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    Sym.st_shndx = 1;
+    Sym.st_value = TextAddr + StartLen + MainAddr;
+    Sym.st_size = TextLen - StartLen;
+    put(&Sym, sizeof(Sym));
+    if(Exe) {
+        Sym.st_name = 6;
+        Sym.st_value = TextAddr;
+        Sym.st_size = StartLen;
+        put(&Sym, sizeof(Sym));
+    }
+    size_t SymLen = OutLen - SymOff;
+
+    size_t StrOff = put(StrTab, sizeof(StrTab));
+    size_t ShStrOff = put(ShStrTab, sizeof(ShStrTab));
+
+    // 节头表：空节、.text、.symtab、.strtab、.shstrtab
+    align(8);
+    size_t ShOff = OutLen;
+    Elf64_Shdr Sh[5] = {0};
+    Sh[1] = (Elf64_Shdr){
+        .sh_name = 1, .sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_addr = TextAddr, .sh_offset = TextOff, .sh_size = TextLen,
+        .sh_addralign = 4,
+    };
+    Sh[2] = (Elf64_Shdr){
+        .sh_name = 7, .sh_type = SHT_SYMTAB, .sh_offset = SymOff, .sh_size = SymLen,
+        // 第一个非局部符号的下标
+        .sh_link = 3, .sh_info = 1, .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Sym),
+    };
+    Sh[3] = (Elf64_Shdr){
+        .sh_name = 15, .sh_type = SHT_STRTAB, .sh_offset = StrOff,
+        .sh_size = sizeof(StrTab), .sh_addralign = 1,
+    };
+    Sh[4] = (Elf64_Shdr){
+        .sh_name = 23, .sh_type = SHT_STRTAB, .sh_offset = ShStrOff,
+        .sh_size = sizeof(ShStrTab), .sh_addralign = 1,
+    };
+    put(Sh, sizeof(Sh));
+
+    // 回填ELF头与程序头
+    Eh = (Elf64_Ehdr){
+        .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB,
+                    EV_CURRENT, ELFOSABI_SYSV},
+        .e_type = Exe ? ET_EXEC : ET_REL,
+        .e_machine = EM_RISCV,
+        .e_version = EV_CURRENT,
+        .e_entry = Exe ? TextAddr : 0,
+        .e_phoff = PhOff,
+        .e_shoff = ShOff,
+        // 不使用浮点数，但标记为双精度浮点ABI，以便与常见的lp64d工具链链接
+        .e_flags = EF_RISCV_FLOAT_ABI_DOUBLE,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_phentsize = Exe ? sizeof(Elf64_Phdr) : 0,
+        .e_phnum = Exe ? 1 : 0,
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = 5,
+        .e_shstrndx = 4,
+    };
+    memcpy(Out, &Eh, sizeof(Eh));
+    if(Exe) {
+        // 从文件开头到.text结尾整体加载
+        Elf64_Phdr Ph = {
+            .p_type = PT_LOAD, .p_flags = PF_R | PF_X, .p_offset = 0,
+            .p_vaddr = EXE_BASE, .p_paddr = EXE_BASE,
+            .p_filesz = TextOff + TextLen, .p_memsz = TextOff + TextLen,
+            .p_align = 0x1000,
+        };
+        memcpy(Out + PhOff, &Ph, sizeof(Ph));
+    }
+
+    if(fwrite(Out, 1, OutLen, File) != OutLen)
+        error("failed to write output");
+
+    free(Out);
+    free(Words);
+    free(Sizes);
+    free(Addrs);
+    free(LabelAddrs);
+    Out = NULL;
+    Words = NULL;
+    OutCap = WordCap = 0;
+}
@@ -0,0 +1,1022 @@
+#include "rvcc.h"
+
+// SSA中间表示：将语法树降低为控制流图，再构造为SSA形式
+//
+// 降低时变量的读写先表示为IR_VAR_GET与IR_VAR_SET，控制流图确定后，
+// 计算支配树与支配边界，在变量的定义所在块的迭代支配边界处插入phi，
+// 再沿支配树前序遍历，将变量的读取改写为到达该处的定义（Cytron等人的算法）。
+//
+// 值与基本块都从内存池中分配，编译结束时一并释放。
+// 语法树与支配树都可能很深，遍历都使用显式的栈
+
+// 当前构造的函数
+static IRFunc* Fn;
+// 正在追加指令的基本块，为NULL时之后的指令不可达
+static IRBlock* Cur;
+// 已新建的全部基本块，包括不可达的
+static IRBlock** AllBlocks;
+static int NumAll, CapAll;
+
+// 在内存池中将数组扩容到至少能容纳Len+1个元素，旧的数组留在内存池中
+static void* growArena(void* Arr, int Len, int* Cap, size_t Size) {
+    if(Len < *Cap)
+        return Arr;
+    int NewCap = *Cap ? *Cap * 2 : 4;
+    void* New = arenaAlloc(NewCap * Size);
+    if(Len)
+        memcpy(New, Arr, Len * Size);
+    *Cap = NewCap;
+    return New;
+}
+
+//
+// 值与基本块的维护
+//
+
+// 新建一个基本块
+static IRBlock* newBlock(void) {
+    IRBlock* B = arenaAlloc(sizeof(IRBlock));
+    B->Id = NumAll;
+    AllBlocks = growArena(AllBlocks, NumAll, &CapAll, sizeof(IRBlock*));
+    AllBlocks[NumAll++] = B;
+    return B;
+}
+
+// 新建一个值，不加入基本块
+static IRValue* newValue(IROp Op, int NumArgs) {
+    IRValue* V = arenaAlloc(sizeof(IRValue));
+    V->Op = Op;
+    V->Id = Fn->NumValues++;
+    V->NumArgs = NumArgs;
+    if(NumArgs)
+        V->Args = arenaAlloc(sizeof(IRValue*) * NumArgs);
+    return V;
+}
+
+// 将值插入到基本块B中的Pos之前，Pos为NULL时追加到末尾
+static void insertValue(IRBlock* B, IRValue* V, IRValue* Pos) {
+    V->Block = B;
+    V->Next = Pos;
+    V->Prev = Pos ? Pos->Prev : B->Last;
+    if(V->Prev)
+        V->Prev->Next = V;
+    else
+        B->First = V;
+    if(Pos)
+        Pos->Prev = V;
+    else
+        B->Last = V;
+}
+
+// 将值从所在的基本块中取出
+static void unlinkValue(IRValue* V) {
+    IRBlock* B = V->Block;
+    if(V->Prev)
+        V->Prev->Next = V->Next;
+    else
+        B->First = V->Next;
+    if(V->Next)
+        V->Next->Prev = V->Prev;
+    else
+        B->Last = V->Prev;
+    V->Prev = V->Next = NULL;
+}
+
+// 记录User使用了V
+static void addUser(IRValue* V, IRValue* User) {
+    V->Users = growArena(V->Users, V->NumUsers, &V->CapUsers, sizeof(IRValue*));
+    V->Users[V->NumUsers++] = User;
+}
+
+// 删除User对V的一次使用
+static void removeUser(IRValue* V, IRValue* User) {
+    for(int I = 0; I < V->NumUsers; I++) {
+        if(V->Users[I] == User) {
+            V->Users[I] = V->Users[--V->NumUsers];
+            return;
+        }
+    }
+}
+
+void irReplaceUses(IRValue* Old, IRValue* New) {
+    for(int I = 0; I < Old->NumUsers; I++) {
+        IRValue* User = Old->Users[I];
+        // 同一指令多次使用时，Users中也出现多次，每次只改写一个参数
+        for(int J = 0; J < User->NumArgs; J++) {
+            if(User->Args[J] == Old) {
+                User->Args[J] = New;
+                break;
+            }
+        }
+        addUser(New, User);
+    }
+    Old->NumUsers = 0;
+}
+
+void irRemove(IRValue* V) {
+    for(int I = 0; I < V->NumArgs; I++)
+        if(V->Args[I])
+            removeUser(V->Args[I], V);
+    unlinkValue(V);
+    V->Block = NULL;
+}
+
+void irMoveBefore(IRValue* V, IRValue* Pos) {
+    unlinkValue(V);
+    insertValue(Pos->Block, V, Pos);
+}
+
+bool irDominates(IRBlock* A, IRBlock* B) {
+    return A->DomPre <= B->DomPre && B->DomPost <= A->DomPost;
+}
+
+// 是否为跳转或返回
+static bool isTerminator(IRValue* V) {
+    return V->Op == IR_JMP || V->Op == IR_BR || V->Op == IR_RET;
+}
+
+// 在From与To之间添加一条边
+static void addEdge(IRBlock* From, IRBlock* To) {
+    From->Succs[From->NumSuccs++] = To;
+    To->Preds = growArena(To->Preds, To->NumPreds, &To->CapPreds,
+                          sizeof(IRBlock*));
+    To->Preds[To->NumPreds++] = From;
+}
+
+//
+// 由语法树降低为控制流图
+//
+
+// 在当前基本块末尾新增一个值，当前位置不可达时放入新的基本块
+static IRValue* emit(IROp Op, int NumArgs) {
+    if(!Cur)
+        Cur = newBlock();
+    IRValue* V = newValue(Op, NumArgs);
+    insertValue(Cur, V, NULL);
+    return V;
+}
+
+// 结束当前基本块，跳转到To
+static void emitJmp(IRBlock* To) {
+    if(!Cur)
+        return;
+    emit(IR_JMP, 0);
+    addEdge(Cur, To);
+    Cur = NULL;
+}
+
+// 结束当前基本块，Cond不为0时跳转到Then，否则跳转到Els
+static void emitBr(IRValue* Cond, IRBlock* Then, IRBlock* Els) {
+    emit(IR_BR, 1)->Args[0] = Cond;
+    addEdge(Cur, Then);
+    addEdge(Cur, Els);
+    Cur = NULL;
+}
+
+// 语法树中运算对应的值的种类
+static IROp binaryOp(NodeKind Kind) {
+    switch(Kind) {
+    case ND_ADD:
+        return IR_ADD;
+    case ND_SUB:
+        return IR_SUB;
+    case ND_MUL:
+        return IR_MUL;
+    case ND_DIV:
+        return IR_DIV;
+    case ND_EQ:
+        return IR_EQ;
+    case ND_NE:
+        return IR_NE;
+    case ND_LT:
+        return IR_LT;
+    case ND_LE:
+        return IR_LE;
+    default:
+        error("invalid expression");
+        return IR_CONST;
+    }
+}
+
+// 降低表达式时待访问的节点
+typedef struct {
+    NodeId Id;
+    bool Visited; // 子节点是否已经压栈
+} LowerFrame;
+
+// 降低表达式的显式栈，以及已求出的值
+static LowerFrame* LowerStack;
+static int LowerTop, LowerCap;
+static IRValue** ValStack;
+static int ValTop, ValCap;
+
+// 将待降低的节点压栈
+static void pushLower(NodeId Id) {
+    LowerStack = growList(LowerStack, LowerTop, &LowerCap, sizeof(LowerFrame));
+    LowerStack[LowerTop++] = (LowerFrame){Id, false};
+}
+
+// 将求出的值压栈
+static void pushVal(IRValue* V) {
+    ValStack = growList(ValStack, ValTop, &ValCap, sizeof(IRValue*));
+    ValStack[ValTop++] = V;
+}
+
+// 降低表达式，返回表达式的值
+// 与树形的代码生成一致，二叉树节点先求右部再求左部
+static IRValue* lowerExpr(NodeId Root) {
+    pushLower(Root);
+    while(LowerTop > 0) {
+        LowerFrame* F = &LowerStack[LowerTop - 1];
+        Node* Nd = getNode(F->Id);
+
+        if(!F->Visited) {
+            F->Visited = true;
+            switch(Nd->Kind) {
+            case ND_NUM:
+            case ND_VAR:
+                break;
+            case ND_NEG:
+                pushLower(Nd->LHS);
+                continue;
+            case ND_ASSIGN:
+                if(getNode(Nd->LHS)->Kind != ND_VAR)
+                    error("not a lvalue");
+                pushLower(Nd->RHS);
+                continue;
+            default:
+                pushLower(Nd->LHS);
+                pushLower(Nd->RHS);
+                continue;
+            }
+        }
+
+        LowerTop--;
+        IRValue* V;
+        switch(Nd->Kind) {
+        case ND_NUM:
+            V = emit(IR_CONST, 0);
+            V->Val = Nd->Val;
+            break;
+        case ND_VAR:
+            // 参数在构造SSA时填入到达该处的定义
+            V = emit(IR_VAR_GET, 1);
+            V->Var = Nd->Var;
+            break;
+        case ND_NEG:
+            V = emit(IR_NEG, 1);
+            V->Args[0] = ValStack[--ValTop];
+            break;
+        case ND_ASSIGN:
+            // 赋值表达式的值即右部的值，仍留在栈中
+            V = emit(IR_VAR_SET, 1);
+            V->Var = getNode(Nd->LHS)->Var;
+            V->Args[0] = ValStack[ValTop - 1];
+            continue;
+        default:
+            // 右部先求出，位于左部之下
+            V = emit(binaryOp(Nd->Kind), 2);
+            V->Args[0] = ValStack[--ValTop];
+            V->Args[1] = ValStack[--ValTop];
+            break;
+        }
+        pushVal(V);
+    }
+    return ValStack[--ValTop];
+}
+
+// 降低语句
+static void lowerStmt(NodeId Id) {
+    Node* Nd = getNode(Id);
+    switch(Nd->Kind) {
+    case ND_IF: {
+        IRBlock* Then = newBlock();
+        IRBlock* End = newBlock();
+        IRBlock* Els = getExt(Nd)->Els ? newBlock() : End;
+        emitBr(lowerExpr(Nd->Cond), Then, Els);
+        Cur = Then;
+        lowerStmt(Nd->Then);
+        emitJmp(End);
+        if(Els != End) {
+            Cur = Els;
+            lowerStmt(getExt(Nd)->Els);
+            emitJmp(End);
+        }
+        Cur = End;
+        return;
+    }
+    case ND_FOR: {
+        // 与树形的代码生成一致，循环经过旋转：
+        // 入口处判断一次条件，之后在循环体末尾判断是否回到循环体
+        NodeExt* Ext = getExt(Nd);
+        if(Ext->Init)
+            lowerStmt(Ext->Init);
+        IRBlock* Body = newBlock();
+        IRBlock* End = newBlock();
+        if(Nd->Cond)
+            emitBr(lowerExpr(Nd->Cond), Body, End);
+        else
+            emitJmp(Body);
+        Cur = Body;
+        lowerStmt(Nd->Then);
+        if(Ext->Inc)
+            lowerExpr(Ext->Inc);
+        if(Nd->Cond)
+            emitBr(lowerExpr(Nd->Cond), Body, End);
+        else
+            emitJmp(Body);
+        Cur = End;
+        return;
+    }
+    case ND_BLOCK:
+        for(NodeId N = Nd->Body; N; N = getNode(N)->Next)
+            lowerStmt(N);
+        return;
+    case ND_RETURN: {
+        // 先求出返回值，再新增返回指令
+        IRValue* Val = lowerExpr(Nd->LHS);
+        emit(IR_RET, 1)->Args[0] = Val;
+        Cur = NULL;
+        return;
+    }
+    case ND_EXPR_STMT:
+        lowerExpr(Nd->LHS);
+        return;
+    default:
+        error("invalid statement");
+    }
+}
+
+//
+// 控制流图的整理
+//
+
+// 深度优先遍历时的一帧
+typedef struct {
+    IRBlock* B;
+    int Next; // 下一个要访问的后继或支配树中的子节点
+    int Mark; // 进入时撤销日志的长度
+} BlockFrame;
+
+// 遍历基本块的显式栈
+static BlockFrame* BlockStack;
+static int BlockTop, BlockCap;
+
+// 将基本块压栈
+static void pushBlock(IRBlock* B, int Mark) {
+    BlockStack = growList(BlockStack, BlockTop, &BlockCap, sizeof(BlockFrame));
+    BlockStack[BlockTop++] = (BlockFrame){B, 0, Mark};
+}
+
+// 从入口块开始深度优先遍历，按逆后序重新排列与编号基本块，
+// 删除不可达的基本块及其在前驱中的记录
+static void computeRPO(void) {
+    static int Visit;
+    Visit++;
+    IRBlock** Post = arenaAlloc(sizeof(IRBlock*) * NumAll);
+    int N = 0;
+
+    AllBlocks[0]->Mark = Visit;
+    pushBlock(AllBlocks[0], 0);
+    while(BlockTop > 0) {
+        BlockFrame* F = &BlockStack[BlockTop - 1];
+        if(F->Next < F->B->NumSuccs) {
+            IRBlock* S = F->B->Succs[F->Next++];
+            if(S->Mark != Visit) {
+                S->Mark = Visit;
+                pushBlock(S, 0);
+            }
+            continue;
+        }
+        Post[N++] = F->B;
+        BlockTop--;
+    }
+
+    Fn->Blocks = arenaAlloc(sizeof(IRBlock*) * N);
+    Fn->NumBlocks = N;
+    for(int I = 0; I < N; I++) {
+        IRBlock* B = Post[N - 1 - I];
+        B->Id = I;
+        Fn->Blocks[I] = B;
+    }
+
+    // 不可达的前驱不再参与之后的分析
+    for(int I = 0; I < N; I++) {
+        IRBlock* B = Fn->Blocks[I];
+        int K = 0;
+        for(int J = 0; J < B->NumPreds; J++)
+            if(B->Preds[J]->Mark == Visit)
+                B->Preds[K++] = B->Preds[J];
+        B->NumPreds = K;
+    }
+
+    // 之后新建的基本块仍记录在AllBlocks中，入口块保持在最前
+    memcpy(AllBlocks, Fn->Blocks, sizeof(IRBlock*) * N);
+    NumAll = N;
+}
+
+// 拆分关键边，即从有多个后继的块到有多个前驱的块的边，
+// 在中间插入只有跳转的块，phi的复制可以放在前驱的末尾
+static void splitCriticalEdges(void) {
+    int N = Fn->NumBlocks;
+    for(int I = 0; I < N; I++) {
+        IRBlock* B = Fn->Blocks[I];
+        if(B->NumSuccs < 2)
+            continue;
+        for(int K = 0; K < B->NumSuccs; K++) {
+            IRBlock* S = B->Succs[K];
+            if(S->NumPreds < 2)
+                continue;
+            IRBlock* Mid = newBlock();
+            insertValue(Mid, newValue(IR_JMP, 0), NULL);
+            Mid->Succs[Mid->NumSuccs++] = S;
+            Mid->Preds = growArena(NULL, 0, &Mid->CapPreds, sizeof(IRBlock*));
+            Mid->Preds[Mid->NumPreds++] = B;
+            // 两个后继相同时，每条边各替换一次
+            for(int J = 0; J < S->NumPreds; J++) {
+                if(S->Preds[J] == B) {
+                    S->Preds[J] = Mid;
+                    break;
+                }
+            }
+            B->Succs[K] = Mid;
+        }
+    }
+}
+
+// 沿直接支配者向上，找到A与B最近的共同支配者
+static IRBlock* intersect(IRBlock* A, IRBlock* B) {
+    while(A != B) {
+        while(A->Id > B->Id)
+            A = A->IDom;
+        while(B->Id > A->Id)
+            B = B->IDom;
+    }
+    return A;
+}
+
+// 计算直接支配者（Cooper、Harvey与Kennedy的迭代算法）与支配边界
+static void computeDominators(void) {
+    IRBlock* Entry = Fn->Blocks[0];
+    for(int I = 0; I < Fn->NumBlocks; I++)
+        Fn->Blocks[I]->IDom = NULL;
+    Entry->IDom = Entry;
+
+    bool Changed = true;
+    while(Changed) {
+        Changed = false;
+        for(int I = 1; I < Fn->NumBlocks; I++) {
+            IRBlock* B = Fn->Blocks[I];
+            IRBlock* New = NULL;
+            for(int J = 0; J < B->NumPreds; J++) {
+                IRBlock* P = B->Preds[J];
+                if(!P->IDom)
+                    continue;
+                New = New ? intersect(P, New) : P;
+            }
+            if(B->IDom != New) {
+                B->IDom = New;
+                Changed = true;
+            }
+        }
+    }
+
+    // 支配边界：从汇合块的每个前驱向上，直到汇合块的直接支配者
+    for(int I = 0; I < Fn->NumBlocks; I++) {
+        IRBlock* B = Fn->Blocks[I];
+        if(B->NumPreds < 2)
+            continue;
+        for(int J = 0; J < B->NumPreds; J++) {
+            for(IRBlock* R = B->Preds[J]; R != B->IDom; R = R->IDom) {
+                // 同一B只在最后加入，检查最后一个即可去重
+                if(R->NumDF && R->DF[R->NumDF - 1] == B)
+                    continue;
+                R->DF = growArena(R->DF, R->NumDF, &R->CapDF, sizeof(IRBlock*));
+                R->DF[R->NumDF++] = B;
+            }
+        }
+    }
+    Entry->IDom = NULL;
+}
+
+//
+// 构造SSA
+//
+
+// 函数中读写的变量，下标为变量的编号
+static Obj** Vars;
+static int NumVars;
+
+// 为函数中读写的变量编号，变量的编号从1开始
+static void numberVars(Function* Prog) {
+    int N = 0;
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next) {
+        Var->Id = 0;
+        N++;
+    }
+    Vars = malloc(sizeof(Obj*) * (N + 1));
+    if(!Vars)
+        error("out of memory");
+    NumVars = 0;
+    for(int I = 0; I < Fn->NumBlocks; I++) {
+        for(IRValue* V = Fn->Blocks[I]->First; V; V = V->Next) {
+            if((V->Op == IR_VAR_GET || V->Op == IR_VAR_SET) && !V->Var->Id) {
+                V->Var->Id = ++NumVars;
+                Vars[NumVars] = V->Var;
+            }
+        }
+    }
+}
+
+// 在变量被赋值的块的迭代支配边界处插入phi
+// 只为在某个块中先读后写的变量插入，仅在块内使用的变量不需要phi
+static void insertPhis(void) {
+    int NB = Fn->NumBlocks;
+    // 各数组中记录的是变量编号或基本块编号加1，0表示未标记
+    int* Killed = calloc(NumVars + 1, sizeof(int));
+    bool* Global = calloc(NumVars + 1, sizeof(bool));
+    int* LastDef = calloc(NumVars + 1, sizeof(int));
+    IRBlock*** Defs = calloc(NumVars + 1, sizeof(IRBlock**));
+    int* NumDefs = calloc(NumVars + 1, sizeof(int));
+    int* CapDefs = calloc(NumVars + 1, sizeof(int));
+    if(!Killed || !Global || !LastDef || !Defs || !NumDefs || !CapDefs)
+        error("out of memory");
+
+    for(int I = 0; I < NB; I++) {
+        IRBlock* B = Fn->Blocks[I];
+        for(IRValue* V = B->First; V; V = V->Next) {
+            if(V->Op == IR_VAR_GET && Killed[V->Var->Id] != I + 1)
+                Global[V->Var->Id] = true;
+            if(V->Op != IR_VAR_SET)
+                continue;
+            int Id = V->Var->Id;
+            Killed[Id] = I + 1;
+            if(LastDef[Id] == I + 1)
+                continue;
+            LastDef[Id] = I + 1;
+            Defs[Id] = growList(Defs[Id], NumDefs[Id], &CapDefs[Id],
+                                sizeof(IRBlock*));
+            Defs[Id][NumDefs[Id]++] = B;
+        }
+    }
+
+    int* HasPhi = calloc(NB, sizeof(int));
+    int* InWork = calloc(NB, sizeof(int));
+    IRBlock** Work = malloc(sizeof(IRBlock*) * (NB + 1));
+    if(!HasPhi || !InWork || !Work)
+        error("out of memory");
+
+    for(int Id = 1; Id <= NumVars; Id++) {
+        if(!Global[Id])
+            continue;
+        int Top = 0;
+        for(int I = 0; I < NumDefs[Id]; I++) {
+            Work[Top++] = Defs[Id][I];
+            InWork[Defs[Id][I]->Id] = Id;
+        }
+        while(Top > 0) {
+            IRBlock* X = Work[--Top];
+            for(int I = 0; I < X->NumDF; I++) {
+                IRBlock* Y = X->DF[I];
+                if(HasPhi[Y->Id] == Id)
+                    continue;
+                HasPhi[Y->Id] = Id;
+                IRValue* Phi = newValue(IR_PHI, Y->NumPreds);
+                Phi->Var = Vars[Id];
+                insertValue(Y, Phi, Y->First);
+                if(InWork[Y->Id] != Id) {
+                    InWork[Y->Id] = Id;
+                    Work[Top++] = Y;
+                }
+            }
+        }
+    }
+
+    for(int Id = 1; Id <= NumVars; Id++)
+        free(Defs[Id]);
+    free(Killed);
+    free(Global);
+    free(LastDef);
+    free(Defs);
+    free(NumDefs);
+    free(CapDefs);
+    free(HasPhi);
+    free(InWork);
+    free(Work);
+}
+
+// 重命名时每个变量当前到达的定义，下标为变量的编号
+static IRValue** CurDefs;
+
+// 重命名时的撤销日志，离开支配树中的子树时恢复变量原来的定义
+typedef struct {
+    int Var;
+    IRValue* Old;
+} UndoEntry;
+static UndoEntry* UndoLog;
+static int UndoLen, UndoCap;
+
+// 读取未赋值的变量时使用的值
+static IRValue* Undef;
+
+// 未定义的值，取为入口块开头的常量0
+static IRValue* undef(void) {
+    if(!Undef) {
+        Undef = newValue(IR_CONST, 0);
+        IRBlock* Entry = Fn->Blocks[0];
+        insertValue(Entry, Undef, Entry->First);
+    }
+    return Undef;
+}
+
+// 变量Id当前到达的定义
+static IRValue* curDef(int Id) {
+    return CurDefs[Id] ? CurDefs[Id] : undef();
+}
+
+// 将变量Id当前的定义设为V
+static void define(int Id, IRValue* V) {
+    UndoLog = growList(UndoLog, UndoLen, &UndoCap, sizeof(UndoEntry));
+    UndoLog[UndoLen++] = (UndoEntry){Id, CurDefs[Id]};
+    CurDefs[Id] = V;
+}
+
+// 参数为变量的读取时，改为读取到的定义
+static IRValue* resolve(IRValue* V) {
+    return V->Op == IR_VAR_GET ? V->Args[0] : V;
+}
+
+// 重命名基本块中的变量，并填写后继中phi的参数
+static void renameBlock(IRBlock* B) {
+    for(IRValue* V = B->First; V; V = V->Next) {
+        switch(V->Op) {
+        case IR_PHI:
+            define(V->Var->Id, V);
+            break;
+        case IR_VAR_GET:
+            V->Args[0] = curDef(V->Var->Id);
+            break;
+        case IR_VAR_SET:
+            define(V->Var->Id, resolve(V->Args[0]));
+            break;
+        default:
+            for(int I = 0; I < V->NumArgs; I++)
+                V->Args[I] = resolve(V->Args[I]);
+            break;
+        }
+    }
+
+    for(int K = 0; K < B->NumSuccs; K++) {
+        IRBlock* S = B->Succs[K];
+        for(int I = 0; I < S->NumPreds; I++) {
+            if(S->Preds[I] != B)
+                continue;
+            for(IRValue* Phi = S->First; Phi && Phi->Op == IR_PHI; Phi = Phi->Next)
+                Phi->Args[I] = curDef(Phi->Var->Id);
+        }
+    }
+}
+
+// 沿支配树前序遍历，重命名变量，同时为支配树编号
+static void renameVars(void) {
+    int NB = Fn->NumBlocks;
+    CurDefs = calloc(NumVars + 1, sizeof(IRValue*));
+    // 支配树中的子节点，Kids[KidStart[I]..KidStart[I+1])为基本块I的子节点
+    int* KidStart = calloc(NB + 1, sizeof(int));
+    IRBlock** Kids = malloc(sizeof(IRBlock*) * (NB + 1));
+    if(!CurDefs || !KidStart || !Kids)
+        error("out of memory");
+
+    for(int I = 1; I < NB; I++)
+        KidStart[Fn->Blocks[I]->IDom->Id + 1]++;
+    for(int I = 0; I < NB; I++)
+        KidStart[I + 1] += KidStart[I];
+    int* Fill = malloc(sizeof(int) * (NB + 1));
+    if(!Fill)
+        error("out of memory");
+    memcpy(Fill, KidStart, sizeof(int) * (NB + 1));
+    for(int I = 1; I < NB; I++) {
+        IRBlock* B = Fn->Blocks[I];
+        Kids[Fill[B->IDom->Id]++] = B;
+    }
+    free(Fill);
+
+    int Order = 0;
+    Fn->Blocks[0]->DomPre = Order++;
+    renameBlock(Fn->Blocks[0]);
+    pushBlock(Fn->Blocks[0], UndoLen);
+    while(BlockTop > 0) {
+        BlockFrame* F = &BlockStack[BlockTop - 1];
+        IRBlock* B = F->B;
+        if(KidStart[B->Id] + F->Next < KidStart[B->Id + 1]) {
+            IRBlock* Kid = Kids[KidStart[B->Id] + F->Next++];
+            int Mark = UndoLen;
+            Kid->DomPre = Order++;
+            renameBlock(Kid);
+            pushBlock(Kid, Mark);
+            continue;
+        }
+
+        // 离开子树，恢复进入前各变量的定义
+        B->DomPost = Order++;
+        while(UndoLen > F->Mark) {
+            UndoLen--;
+            CurDefs[UndoLog[UndoLen].Var] = UndoLog[UndoLen].Old;
+        }
+        BlockTop--;
+    }
+
+    free(CurDefs);
+    free(KidStart);
+    free(Kids);
+    CurDefs = NULL;
+}
+
+// 删除变量的读写，记录每个值的使用者
+static void buildUsers(void) {
+    for(int I = 0; I < Fn->NumBlocks; I++) {
+        for(IRValue* V = Fn->Blocks[I]->First; V;) {
+            IRValue* Next = V->Next;
+            if(V->Op == IR_VAR_GET || V->Op == IR_VAR_SET) {
+                unlinkValue(V);
+                V->Block = NULL;
+            } else {
+                for(int J = 0; J < V->NumArgs; J++)
+                    addUser(V->Args[J], V);
+            }
+            V = Next;
+        }
+    }
+}
+
+// 删除平凡的phi，即除自身外只使用同一个值的phi，它的值就是该值
+// 删除后使用它的phi可能变为平凡的，因此使用工作表反复处理
+static void removeTrivialPhis(void) {
+    IRValue** Work = NULL;
+    int Top = 0, Cap = 0;
+    for(int I = 0; I < Fn->NumBlocks; I++) {
+        for(IRValue* V = Fn->Blocks[I]->First; V && V->Op == IR_PHI; V = V->Next) {
+            Work = growList(Work, Top, &Cap, sizeof(IRValue*));
+            Work[Top++] = V;
+        }
+    }
+
+    while(Top > 0) {
+        IRValue* Phi = Work[--Top];
+        if(!Phi->Block)
+            continue;
+        IRValue* Same = NULL;
+        bool Trivial = true;
+        for(int I = 0; I < Phi->NumArgs; I++) {
+            IRValue* A = Phi->Args[I];
+            if(A == Phi || A == Same)
+                continue;
+            if(Same) {
+                Trivial = false;
+                break;
+            }
+            Same = A;
+        }
+        if(!Trivial)
+            continue;
+        // 只使用自身的phi位于不可达的环中，取未定义的值
+        if(!Same)
+            Same = undef();
+
+        for(int I = 0; I < Phi->NumUsers; I++) {
+            IRValue* User = Phi->Users[I];
+            if(User->Op == IR_PHI && User != Phi) {
+                Work = growList(Work, Top, &Cap, sizeof(IRValue*));
+                Work[Top++] = User;
+            }
+        }
+        irReplaceUses(Phi, Same);
+        irRemove(Phi);
+    }
+    free(Work);
+}
+
+// 按基本块与指令的顺序重新为值编号
+static void numberValues(void) {
+    int N = 0;
+    for(int I = 0; I < Fn->NumBlocks; I++)
+        for(IRValue* V = Fn->Blocks[I]->First; V; V = V->Next)
+            V->Id = N++;
+    Fn->NumValues = N;
+}
+
+IRFunc* irBuild(Function* Prog) {
+    Fn = arenaAlloc(sizeof(IRFunc));
+    NumAll = CapAll = 0;
+    AllBlocks = NULL;
+    Undef = NULL;
+
+    // 入口块最先新建，编号为0
+    Cur = newBlock();
+    lowerStmt(Prog->Body);
+    // 没有return时返回0
+    if(Cur) {
+        IRValue* Zero = emit(IR_CONST, 0);
+        emit(IR_RET, 1)->Args[0] = Zero;
+        Cur = NULL;
+    }
+
+    computeRPO();
+    splitCriticalEdges();
+    computeRPO();
+    computeDominators();
+
+    numberVars(Prog);
+    insertPhis();
+    renameVars();
+    buildUsers();
+    removeTrivialPhis();
+    numberValues();
+
+    free(Vars);
+    free(LowerStack);
+    free(ValStack);
+    free(BlockStack);
+    free(UndoLog);
+    Vars = NULL;
+    LowerStack = NULL;
+    ValStack = NULL;
+    BlockStack = NULL;
+    UndoLog = NULL;
+    LowerCap = ValCap = BlockCap = UndoCap = 0;
+    return Fn;
+}
+
+//
+// 检查与输出
+//
+
+// 报告SSA中的错误
+static void verifyError(IRValue* V, char* Msg) {
+    error("ir: %%%d in b%d: %s", V->Id, V->Block ? V->Block->Id : -1, Msg);
+}
+
+// 判断基本块的前驱或后继中是否有B
+static bool hasBlock(IRBlock** Arr, int N, IRBlock* B) {
+    for(int I = 0; I < N; I++)
+        if(Arr[I] == B)
+            return true;
+    return false;
+}
+
+void irVerify(IRFunc* F) {
+    // 每个值在基本块中的位置，检查块内的定义是否在使用之前
+    int* Pos = calloc(F->NumValues, sizeof(int));
+    // 参数中出现的次数，与使用者的数量比较
+    int* Uses = calloc(F->NumValues, sizeof(int));
+    if(!Pos || !Uses)
+        error("out of memory");
+
+    for(int I = 0; I < F->NumBlocks; I++) {
+        IRBlock* B = F->Blocks[I];
+        if(B->Id != I)
+            error("ir: b%d is numbered %d", I, B->Id);
+        if(!B->Last || !isTerminator(B->Last))
+            error("ir: b%d does not end with a terminator", I);
+        if((I == 0) != (B->IDom == NULL))
+            error("ir: b%d has a wrong immediate dominator", I);
+
+        // 前驱与后继互相对应
+        int Want = B->Last->Op == IR_JMP ? 1 : B->Last->Op == IR_BR ? 2 : 0;
+        if(B->NumSuccs != Want)
+            error("ir: b%d has %d successors", I, B->NumSuccs);
+        for(int J = 0; J < B->NumSuccs; J++)
+            if(!hasBlock(B->Succs[J]->Preds, B->Succs[J]->NumPreds, B))
+                error("ir: b%d is missing from predecessors of b%d", I,
+                      B->Succs[J]->Id);
+        for(int J = 0; J < B->NumPreds; J++)
+            if(!hasBlock(B->Preds[J]->Succs, B->Preds[J]->NumSuccs, B))
+                error("ir: b%d is missing from successors of b%d", I,
+                      B->Preds[J]->Id);
+
+        int N = 0;
+        bool PhiEnd = false;
+        for(IRValue* V = B->First; V; V = V->Next) {
+            if(V->Id < 0 || V->Id >= F->NumValues)
+                verifyError(V, "id out of range");
+            Pos[V->Id] = ++N;
+            if(V->Block != B)
+                verifyError(V, "wrong block");
+            if(V->Op == IR_VAR_GET || V->Op == IR_VAR_SET)
+                verifyError(V, "variable access left after SSA construction");
+            if(isTerminator(V) != (V == B->Last))
+                verifyError(V, "terminator not at the end of the block");
+            if(V->Op == IR_PHI) {
+                if(PhiEnd)
+                    verifyError(V, "phi after other values");
+                if(V->NumArgs != B->NumPreds)
+                    verifyError(V, "phi arguments do not match predecessors");
+            } else {
+                PhiEnd = true;
+            }
+        }
+    }
+
+    for(int I = 0; I < F->NumBlocks; I++) {
+        IRBlock* B = F->Blocks[I];
+        for(IRValue* V = B->First; V; V = V->Next) {
+            for(int J = 0; J < V->NumArgs; J++) {
+                IRValue* A = V->Args[J];
+                if(!A || !A->Block)
+                    verifyError(V, "argument is not defined");
+                if(A->Block->Id >= F->NumBlocks ||
+                   F->Blocks[A->Block->Id] != A->Block)
+                    verifyError(V, "argument is in a removed block");
+                if(isTerminator(A))
+                    verifyError(V, "argument is a terminator");
+                Uses[A->Id]++;
+
+                // 定义必须支配使用，phi的参数在对应前驱的末尾使用
+                if(V->Op == IR_PHI) {
+                    if(!irDominates(A->Block, B->Preds[J]))
+                        verifyError(V, "phi argument does not dominate "
+                                       "its predecessor");
+                } else if(A->Block == B) {
+                    if(Pos[A->Id] >= Pos[V->Id])
+                        verifyError(V, "argument is used before definition");
+                } else if(!irDominates(A->Block, B)) {
+                    verifyError(V, "argument does not dominate its use");
+                }
+            }
+        }
+    }
+
+    // 使用者与参数互相对应
+    for(int I = 0; I < F->NumBlocks; I++) {
+        for(IRValue* V = F->Blocks[I]->First; V; V = V->Next) {
+            if(Uses[V->Id] != V->NumUsers)
+                verifyError(V, "users do not match uses");
+            for(int J = 0; J < V->NumUsers; J++) {
+                IRValue* U = V->Users[J];
+                bool Found = false;
+                for(int K = 0; K < U->NumArgs; K++)
+                    Found |= U->Args[K] == V;
+                if(!Found || !U->Block)
+                    verifyError(V, "user does not use the value");
+            }
+        }
+    }
+
+    free(Pos);
+    free(Uses);
+}
+
+// 值的种类的名称
+static char* OpNames[] = {
+    [IR_CONST] = "const", [IR_ADD] = "add", [IR_SUB] = "sub",
+    [IR_MUL] = "mul",     [IR_DIV] = "div", [IR_NEG] = "neg",
+    [IR_EQ] = "eq",       [IR_NE] = "ne",   [IR_LT] = "lt",
+    [IR_LE] = "le",       [IR_PHI] = "phi", [IR_VAR_GET] = "get",
+    [IR_VAR_SET] = "set", [IR_JMP] = "jmp", [IR_BR] = "br",
+    [IR_RET] = "ret",
+};
+
+void irPrint(IRFunc* F, FILE* Out) {
+    for(int I = 0; I < F->NumBlocks; I++) {
+        IRBlock* B = F->Blocks[I];
+        fprintf(Out, "b%d:", B->Id);
+        if(B->NumPreds) {
+            fprintf(Out, " ; preds");
+            for(int J = 0; J < B->NumPreds; J++)
+                fprintf(Out, " b%d", B->Preds[J]->Id);
+            fprintf(Out, ", idom b%d", B->IDom->Id);
+        }
+        fprintf(Out, "\n");
+
+        for(IRValue* V = B->First; V; V = V->Next) {
+            switch(V->Op) {
+            case IR_CONST:
+                fprintf(Out, "  %%%d = const %ld\n", V->Id, (long)V->Val);
+                continue;
+            case IR_PHI:
+                fprintf(Out, "  %%%d = phi", V->Id);
+                for(int J = 0; J < V->NumArgs; J++)
+                    fprintf(Out, "%s [%%%d, b%d]", J ? "," : "", V->Args[J]->Id,
+                            B->Preds[J]->Id);
+                fprintf(Out, " ; %.*s\n", V->Var->Len, V->Var->Name);
+                continue;
+            case IR_JMP:
+                fprintf(Out, "  jmp b%d\n", B->Succs[0]->Id);
+                continue;
+            case IR_BR:
+                fprintf(Out, "  br %%%d, b%d, b%d\n", V->Args[0]->Id,
+                        B->Succs[0]->Id, B->Succs[1]->Id);
+                continue;
+            case IR_RET:
+                fprintf(Out, "  ret %%%d\n", V->Args[0]->Id);
+                continue;
+            default:
+                fprintf(Out, "  %%%d = %s", V->Id, OpNames[V->Op]);
+                for(int J = 0; J < V->NumArgs; J++)
+                    fprintf(Out, "%s %%%d", J ? "," : "", V->Args[J]->Id);
+                fprintf(Out, "\n");
+                continue;
+            }
+        }
+    }
+}
@@ -0,0 +1,204 @@
+#include "rvcc.h"
+
+// 基本块布局：代码生成按照语句的结构依次输出基本块，块与块之间常有多余的跳转，
+// 如then部分末尾跳到紧随其后的.L.end，return之后跳到紧随其后的.L.return
+//
+// 本遍只改写跳转指令并删除不可达的指令，不移动其余指令。
+// 一处改写可能使另一处成为可改写的，因此反复进行直到不再变化
+
+// 整理的种类
+typedef enum {
+    LO_FALLTHROUGH, // 跳转到紧随其后的标签 => 删除
+    LO_THREAD, // 跳转的目标是另一条无条件跳转 => 直接跳到最终的目标
+    LO_INVERT, // bxx L1; j L2; L1: => 翻转条件bxx' L2; L1:
+    LO_UNREACHABLE, // 无条件跳转或返回之后、下一个被引用的标签之前的指令 => 删除
+    LO_NUM,
+} Layout;
+
+// 整理的名称，用于输出统计
+static char* LayoutNames[LO_NUM] = {
+    [LO_FALLTHROUGH] = "fallthrough",
+    [LO_THREAD] = "thread",
+    [LO_INVERT] = "invert",
+    [LO_UNREACHABLE] = "unreachable",
+};
+
+// 每种整理进行的次数
+static long LayoutCnt[LO_NUM];
+// 进行的遍数
+static int Passes;
+
+// 串联跳转时最多跟随的次数，避免在互相跳转的死循环中无法停止
+#define THREAD_LIMIT 16
+
+// 当前处理的指令
+static Inst* Code;
+static int Len;
+
+// 标签编号对应的指令下标，以及被跳转指令引用的次数
+static int* LabelPos;
+static int64_t LabelCap;
+static int* RefCnt;
+static int64_t RefCap;
+
+// 是否为跳转到标签的指令
+static bool isJump(Inst* I) {
+    return I->Kind == RV_J || isCondBranch(I);
+}
+
+// 记录标签的位置及被引用的次数
+static void countRefs(void) {
+    findLabels(Code, Len, &LabelPos, &LabelCap);
+    if(RefCap < LabelCap) {
+        RefCap = LabelCap;
+        RefCnt = realloc(RefCnt, sizeof(int) * RefCap);
+        if(!RefCnt)
+            error("out of memory");
+    }
+    memset(RefCnt, 0, sizeof(int) * RefCap);
+
+    for(int I = 0; I < Len; I++) {
+        Inst* In = &Code[I];
+        if(isJump(In) || In->Kind == RV_GLOBAL)
+            RefCnt[In->Imm]++;
+    }
+}
+
+// 从I开始跳过伪指令，返回下一条真正的指令的下标
+static int nextReal(int I) {
+    while(I < Len && isPseudo(&Code[I]))
+        I++;
+    return I;
+}
+
+// 从I开始到下一条真正的指令之前，是否有标签Label
+static bool labelFollows(int I, int64_t Label) {
+    for(; I < Len && isPseudo(&Code[I]); I++)
+        if(Code[I].Kind == RV_LABEL && Code[I].Imm == Label)
+            return true;
+    return false;
+}
+
+// 将指令I删除，同时减少其目标标签的引用次数
+static void kill(int I) {
+    if(isJump(&Code[I]))
+        RefCnt[Code[I].Imm]--;
+    killInst(&Code[I]);
+}
+
+// 将跳转指令I的目标改为Label
+static void retarget(int I, int64_t Label) {
+    RefCnt[Code[I].Imm]--;
+    RefCnt[Label]++;
+    Code[I].Imm = Label;
+}
+
+// 跳转到Label之后最终到达的标签，跟随目标处的无条件跳转
+// 超过跟随次数的上限时可能是互相跳转的死循环，返回原标签
+static int64_t finalTarget(int64_t Label) {
+    int64_t Target = Label;
+    for(int N = 0; N < THREAD_LIMIT; N++) {
+        int J = nextReal(LabelPos[Target]);
+        if(J >= Len || Code[J].Kind != RV_J || Code[J].Imm == Target)
+            return Target;
+        Target = Code[J].Imm;
+    }
+    return Label;
+}
+
+// 删除无条件跳转或返回I之后不可达的指令，直到下一个被引用的标签
+static bool removeUnreachable(int I) {
+    bool Changed = false;
+    for(int J = I + 1; J < Len; J++) {
+        Inst* In = &Code[J];
+        if(In->Kind == RV_LABEL && RefCnt[In->Imm] > 0)
+            break;
+        // 保留注释，删除其他指令及不再被引用的标签
+        if(In->Kind == RV_COMMENT || In->Kind == RV_NOP)
+            continue;
+        if(In->Kind != RV_LABEL)
+            LayoutCnt[LO_UNREACHABLE]++;
+        kill(J);
+        Changed = true;
+    }
+    return Changed;
+}
+
+// 整理跳转指令I，返回是否有改写
+static bool layoutJump(int I) {
+    Inst* In = &Code[I];
+
+    // 跳到另一条无条件跳转时，直接跳到最终的目标
+    int64_t Target = finalTarget(In->Imm);
+    if(Target != In->Imm) {
+        retarget(I, Target);
+        LayoutCnt[LO_THREAD]++;
+        return true;
+    }
+
+    // 跳转到紧随其后的标签，跳转与否都执行相同的指令
+    if(labelFollows(I + 1, In->Imm)) {
+        kill(I);
+        LayoutCnt[LO_FALLTHROUGH]++;
+        return true;
+    }
+
+    if(!isCondBranch(In))
+        return false;
+
+    // 条件分支越过紧随其后的无条件跳转，中间不能有标签，否则跳转还有其他来源
+    int J = I + 1;
+    while(J < Len && isPseudo(&Code[J]) && Code[J].Kind != RV_LABEL)
+        J++;
+    if(J >= Len || Code[J].Kind != RV_J || !labelFollows(J + 1, In->Imm))
+        return false;
+    In->Kind = invertBranch(In->Kind);
+    retarget(I, Code[J].Imm);
+    kill(J);
+    LayoutCnt[LO_INVERT]++;
+    return true;
+}
+
+// 进行一遍整理，返回是否有改写
+static bool runPass(void) {
+    countRefs();
+
+    bool Changed = false;
+    for(int I = 0; I < Len; I++) {
+        Inst* In = &Code[I];
+        if(isJump(In) && layoutJump(I))
+            Changed = true;
+        // 改写后可能已被删除，重新判断
+        if((In->Kind == RV_J || In->Kind == RV_RET) && removeUnreachable(I))
+            Changed = true;
+    }
+
+    Len = compactInsts(Code, Len);
+    return Changed;
+}
+
+void layoutBlocks(InstList* L) {
+    Code = L->Data;
+    Len = L->Len;
+
+    do {
+        Passes++;
+    } while(runPass());
+
+    L->Len = Len;
+    free(LabelPos);
+    free(RefCnt);
+    LabelPos = RefCnt = NULL;
+    LabelCap = RefCap = 0;
+}
+
+// 输出每种整理进行的次数
+void layoutReport(FILE* Out) {
+    if(!Passes) {
+        fprintf(Out, "layout: disabled\n");
+        return;
+    }
+    fprintf(Out, "layout: %d passes\n", Passes);
+    for(int I = 0; I < LO_NUM; I++)
+        fprintf(Out, "  %-14s %ld\n", LayoutNames[I], LayoutCnt[I]);
+}
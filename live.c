@@ -0,0 +1,437 @@
+#include "rvcc.h"
+
+// 活跃变量分析：删除无用的赋值，存活范围不相交的变量共用栈槽
+//
+// 在AST上逆序进行数据流分析，每个程序点处活跃的变量以位图表示。
+// 语言中只有if与for两种控制结构，没有break，语句只能通过return离开，
+// 因此只需在for处迭代到不动点：每个循环记录条件之前的活跃集合，
+// 它只会增大，外层循环再次分析内层循环时从记录的集合开始，很快收敛。
+// 所有循环收敛后再遍历一遍，此时的活跃集合是准确的，据此删除赋值并记录冲突。
+//
+// 表达式作为一个整体处理：其中读取的变量在整个表达式中都活跃，
+// 表达式中被读取的变量的赋值不会被删除，不必考虑表达式内部的求值顺序。
+//
+// 变量数与循环数很大时，位图占用的空间按平方增长，超出上限时不进行分析
+
+// 位图占用的位数上限
+#define LIVE_MAX_BITS (1L << 26)
+
+// 参与分析的变量数，变量的Id为1~NumVars，Id为0的变量不参与
+static int NumVars;
+// 位图的字数
+static int Words;
+
+// 是否为最后一遍，只有最后一遍删除赋值并记录冲突
+static bool Apply;
+// 是否删除无用的赋值
+static bool DeleteStores;
+// 冲突矩阵，第I行记录与Id为I的变量冲突的变量，为NULL时不记录
+static uint64_t* Conflict;
+
+// 按编号排序的全部for节点，以及各循环条件之前的活跃集合
+static NodeId* Loops;
+static int NumLoops, LoopCap;
+static uint64_t* LoopLive;
+
+// if的分支各自从同一集合开始分析，每层嵌套使用一个暂存集合
+static uint64_t* Scratch;
+static int MaxDepth;
+static int Depth;
+
+// 统计
+static long Runs, TooLarge, DeadStores, SlotsBefore, SlotsAfter;
+
+// 位图的操作
+static bool hasBit(uint64_t* Set, int I) {
+    return Set[I / 64] >> (I % 64) & 1;
+}
+
+static void setBit(uint64_t* Set, int I) {
+    Set[I / 64] |= 1ULL << (I % 64);
+}
+
+static void clearBit(uint64_t* Set, int I) {
+    Set[I / 64] &= ~(1ULL << (I % 64));
+}
+
+// 遍历表达式时使用的显式栈，以及读取的变量与赋值节点
+static WorkStack Work;
+static int* Reads;
+static int NumReads, ReadCap;
+static NodeId* Assigns;
+static int NumAssigns, AssignCap;
+// 变量在当前表达式中被读取时，等于当前表达式的编号
+static int* ReadMark;
+static int ExprGen;
+
+// 记录X与Live中的变量及表达式中读取的变量冲突
+static void addConflicts(int X, uint64_t* Live) {
+    uint64_t* Row = &Conflict[(size_t)X * Words];
+    for(int W = 0; W < Words; W++) {
+        uint64_t Bits = Live[W] & ~Row[W];
+        Row[W] |= Live[W];
+        // 冲突是对称的，新增的冲突同时记入对方的行
+        while(Bits) {
+            int Y = W * 64 + __builtin_ctzll(Bits);
+            Bits &= Bits - 1;
+            setBit(&Conflict[(size_t)Y * Words], X);
+        }
+    }
+    for(int I = 0; I < NumReads; I++) {
+        setBit(Row, Reads[I]);
+        setBit(&Conflict[(size_t)Reads[I] * Words], X);
+    }
+    clearBit(Row, X);
+}
+
+// 赋值的值之后是否不会被读取
+static bool isDeadStore(NodeId Id, uint64_t* Live) {
+    int V = getNode(getNode(Id)->LHS)->Var->Id;
+    return DeleteStores && !hasBit(Live, V) && ReadMark[V] != ExprGen;
+}
+
+// 分析表达式，Live由表达式之后的活跃集合变为之前的活跃集合
+// Discard为真时表达式的值不被使用，其中的赋值都无用时整个表达式可以删除，
+// 此时返回true，其中读取的变量也不因此活跃，赋值链可以在一遍中全部删除
+static bool liveExpr(NodeId Root, uint64_t* Live, bool Discard) {
+    ExprGen++;
+    NumReads = NumAssigns = 0;
+    Work.Top = 0;
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        NodeId Id = popNode(&Work);
+        Node* Nd = getNode(Id);
+        switch(Nd->Kind) {
+        case ND_NUM:
+            break;
+        case ND_VAR: {
+            int V = Nd->Var->Id;
+            if(V && ReadMark[V] != ExprGen) {
+                ReadMark[V] = ExprGen;
+                Reads = growList(Reads, NumReads, &ReadCap, sizeof(int));
+                Reads[NumReads++] = V;
+            }
+            break;
+        }
+        case ND_ASSIGN:
+            if(getNode(Nd->LHS)->Var->Id) {
+                Assigns = growList(Assigns, NumAssigns, &AssignCap, sizeof(NodeId));
+                Assigns[NumAssigns++] = Id;
+            } else {
+                // 不参与分析的变量的赋值不能删除
+                Discard = false;
+            }
+            pushNode(&Work, Nd->RHS);
+            break;
+        default:
+            pushNode(&Work, Nd->LHS);
+            pushNode(&Work, Nd->RHS);
+            break;
+        }
+    }
+
+    if(Discard && DeleteStores) {
+        bool AllDead = true;
+        for(int I = 0; I < NumAssigns && AllDead; I++)
+            AllDead = isDeadStore(Assigns[I], Live);
+        if(AllDead) {
+            if(Apply)
+                DeadStores += NumAssigns;
+            return true;
+        }
+    }
+
+    // 最后一遍中删除无用的赋值，记录冲突
+    // 先处理内层的赋值，外层的赋值被删除时会复制内层的节点
+    for(int I = NumAssigns - 1; I >= 0 && Apply; I--) {
+        Node* Nd = getNode(Assigns[I]);
+        if(isDeadStore(Assigns[I], Live)) {
+            // 只保留右部
+            NodeId Next = Nd->Next;
+            *Nd = *getNode(Nd->RHS);
+            Nd->Next = Next;
+            DeadStores++;
+            continue;
+        }
+        if(Conflict)
+            addConflicts(getNode(Nd->LHS)->Var->Id, Live);
+    }
+
+    for(int I = 0; I < NumAssigns; I++) {
+        Node* Nd = getNode(Assigns[I]);
+        if(Nd->Kind == ND_ASSIGN)
+            clearBit(Live, getNode(Nd->LHS)->Var->Id);
+    }
+    for(int I = 0; I < NumReads; I++)
+        setBit(Live, Reads[I]);
+    return false;
+}
+
+// 循环条件之前的活跃集合
+static uint64_t* loopLive(NodeId Id) {
+    int Lo = 0, Hi = NumLoops - 1;
+    while(Lo < Hi) {
+        int Mid = (Lo + Hi) / 2;
+        if(Loops[Mid] < Id)
+            Lo = Mid + 1;
+        else
+            Hi = Mid;
+    }
+    return &LoopLive[(size_t)Lo * Words];
+}
+
+// 分析语句，Live由语句之后的活跃集合变为之前的活跃集合
+static void liveStmt(NodeId Id, uint64_t* Live) {
+    Node* Nd = getNode(Id);
+    switch(Nd->Kind) {
+    case ND_IF: {
+        uint64_t* Then = &Scratch[(size_t)Depth * Words];
+        memcpy(Then, Live, Words * sizeof(uint64_t));
+        Depth++;
+        liveStmt(Nd->Then, Then);
+        if(getExt(Nd)->Els)
+            liveStmt(getExt(Nd)->Els, Live);
+        Depth--;
+        for(int W = 0; W < Words; W++)
+            Live[W] |= Then[W];
+        liveExpr(Nd->Cond, Live, false);
+        return;
+    }
+    case ND_FOR: {
+        NodeExt* Ext = getExt(Nd);
+        uint64_t* Head = loopLive(Id);
+        uint64_t* Exit = &Scratch[(size_t)Depth * Words];
+        memcpy(Exit, Live, Words * sizeof(uint64_t));
+        Depth++;
+        // 从记录的集合开始迭代，直到条件之前的活跃集合不再变化
+        while(true) {
+            memcpy(Live, Head, Words * sizeof(uint64_t));
+            // 无用的自增表达式在最后一遍中删除
+            if(Ext->Inc && liveExpr(Ext->Inc, Live, true) && Apply)
+                Ext->Inc = 0;
+            liveStmt(Nd->Then, Live);
+            if(Nd->Cond) {
+                for(int W = 0; W < Words; W++)
+                    Live[W] |= Exit[W];
+                liveExpr(Nd->Cond, Live, false);
+            }
+            bool Changed = false;
+            for(int W = 0; W < Words; W++) {
+                Changed |= (Live[W] | Head[W]) != Head[W];
+                Head[W] |= Live[W];
+            }
+            // 最后一遍中记录的集合已经准确，只需遍历一次
+            if(!Changed || Apply)
+                break;
+        }
+        Depth--;
+        memcpy(Live, Head, Words * sizeof(uint64_t));
+        if(Ext->Init)
+            liveStmt(Ext->Init, Live);
+        return;
+    }
+    case ND_BLOCK: {
+        // 单向链表，先收集全部语句再逆序分析
+        int N = 0;
+        for(NodeId S = Nd->Body; S; S = getNode(S)->Next)
+            N++;
+        NodeId* Stmts = malloc(sizeof(NodeId) * (N + 1));
+        if(!Stmts)
+            error("out of memory");
+        N = 0;
+        for(NodeId S = Nd->Body; S; S = getNode(S)->Next)
+            Stmts[N++] = S;
+        for(int I = N - 1; I >= 0; I--)
+            liveStmt(Stmts[I], Live);
+        free(Stmts);
+        return;
+    }
+    case ND_RETURN:
+        memset(Live, 0, Words * sizeof(uint64_t));
+        liveExpr(Nd->LHS, Live, false);
+        return;
+    case ND_EXPR_STMT:
+        // 只有无用赋值的语句改为空的代码块
+        if(liveExpr(Nd->LHS, Live, true) && Apply) {
+            Nd->Kind = ND_BLOCK;
+            Nd->Body = 0;
+            Nd->RHS = 0;
+            Nd->Ext = 0;
+        }
+        return;
+    default:
+        return;
+    }
+}
+
+// 收集全部for节点，并求出if与for嵌套的最大深度
+static void collectLoops(NodeId Id, int D) {
+    if(!Id)
+        return;
+    Node* Nd = getNode(Id);
+    if(D > MaxDepth)
+        MaxDepth = D;
+    switch(Nd->Kind) {
+    case ND_FOR:
+        Loops = growList(Loops, NumLoops, &LoopCap, sizeof(NodeId));
+        Loops[NumLoops++] = Id;
+        collectLoops(getExt(Nd)->Init, D);
+        collectLoops(Nd->Then, D + 1);
+        return;
+    case ND_IF:
+        collectLoops(Nd->Then, D + 1);
+        collectLoops(getExt(Nd)->Els, D + 1);
+        return;
+    case ND_BLOCK:
+        for(NodeId S = Nd->Body; S; S = getNode(S)->Next)
+            collectLoops(S, D);
+        return;
+    default:
+        return;
+    }
+}
+
+// 比较节点编号
+static int cmpNodeId(const void* A, const void* B) {
+    NodeId X = *(NodeId*)A, Y = *(NodeId*)B;
+    return X < Y ? -1 : X > Y;
+}
+
+// 分析函数体，WithConflict为真时记录变量间的冲突
+// 返回函数入口处的活跃集合，变量过多而未分析时返回NULL
+static uint64_t* analyze(Function* Prog, bool WithConflict) {
+    Runs++;
+    NumLoops = LoopCap = MaxDepth = Depth = 0;
+    Loops = NULL;
+    collectLoops(Prog->Body, 0);
+
+    Words = (NumVars + 1 + 63) / 64;
+    long Bits = (long)Words * 64 * (NumLoops + MaxDepth + 2);
+    if(WithConflict)
+        Bits += (long)Words * 64 * (NumVars + 1);
+    if(Bits > LIVE_MAX_BITS) {
+        TooLarge++;
+        free(Loops);
+        Loops = NULL;
+        return NULL;
+    }
+
+    qsort(Loops, NumLoops, sizeof(NodeId), cmpNodeId);
+    LoopLive = calloc((size_t)(NumLoops + 1) * Words, sizeof(uint64_t));
+    Scratch = calloc((size_t)(MaxDepth + 1) * Words, sizeof(uint64_t));
+    ReadMark = calloc(NumVars + 1, sizeof(int));
+    uint64_t* Live = calloc(Words, sizeof(uint64_t));
+    Conflict = WithConflict
+                   ? calloc((size_t)(NumVars + 1) * Words, sizeof(uint64_t))
+                   : NULL;
+    if(!LoopLive || !Scratch || !ReadMark || !Live ||
+       (WithConflict && !Conflict))
+        error("out of memory");
+    ExprGen = 0;
+
+    // 先使各循环的集合收敛，再遍历一遍
+    Apply = false;
+    liveStmt(Prog->Body, Live);
+    memset(Live, 0, Words * sizeof(uint64_t));
+    Apply = true;
+    liveStmt(Prog->Body, Live);
+
+    free(Loops);
+    free(LoopLive);
+    free(Scratch);
+    free(ReadMark);
+    freeWorkStack(&Work);
+    free(Reads);
+    free(Assigns);
+    Loops = NULL;
+    LoopLive = Scratch = NULL;
+    ReadMark = Reads = NULL;
+    Assigns = NULL;
+    ReadCap = AssignCap = 0;
+    return Live;
+}
+
+void eliminateDeadStores(Function* Prog) {
+    NumVars = 0;
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next)
+        Var->Id = ++NumVars;
+
+    DeleteStores = true;
+    free(analyze(Prog, false));
+    DeleteStores = false;
+}
+
+int shareStackSlots(Function* Prog, int Base) {
+    // 只有位于栈中的变量参与分析
+    NumVars = 0;
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next)
+        Var->Id = Var->Reg ? 0 : ++NumVars;
+    if(NumVars == 0)
+        return 0;
+
+    uint64_t* EntryLive = analyze(Prog, true);
+    if(!EntryLive) {
+        free(Conflict);
+        Conflict = NULL;
+        return -1;
+    }
+
+    // Locals为逆序链表，按声明顺序依次分配，
+    // 每个变量使用与之冲突的变量都未使用的编号最小的栈槽
+    Obj** Vars = malloc(sizeof(Obj*) * (NumVars + 1));
+    int* Slot = calloc(NumVars + 1, sizeof(int));
+    int* Taken = calloc(NumVars + 2, sizeof(int));
+    if(!Vars || !Slot || !Taken)
+        error("out of memory");
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next)
+        if(Var->Id)
+            Vars[Var->Id] = Var;
+
+    int NumSlots = 0;
+    for(int V = NumVars; V >= 1; V--) {
+        // 函数入口处活跃的变量在赋值前就被读取，独占一个栈槽
+        if(hasBit(EntryLive, V)) {
+            Slot[V] = ++NumSlots;
+            Taken[NumSlots] = -1;
+            continue;
+        }
+        uint64_t* Row = &Conflict[(size_t)V * Words];
+        for(int W = 0; W < Words; W++) {
+            for(uint64_t Bits = Row[W]; Bits; Bits &= Bits - 1) {
+                int U = W * 64 + __builtin_ctzll(Bits);
+                if(Slot[U])
+                    Taken[Slot[U]] = V;
+            }
+        }
+        int S = 1;
+        while(S <= NumSlots && (Taken[S] == V || Taken[S] == -1))
+            S++;
+        Slot[V] = S;
+        if(S > NumSlots)
+            NumSlots = S;
+    }
+
+    for(int V = 1; V <= NumVars; V++)
+        Vars[V]->Offset = -(Base + Slot[V] * 8);
+    SlotsBefore += NumVars;
+    SlotsAfter += NumSlots;
+
+    free(Vars);
+    free(Slot);
+    free(Taken);
+    free(Conflict);
+    free(EntryLive);
+    Conflict = NULL;
+    return NumSlots * 8;
+}
+
+// 输出删除的赋值数与共用栈槽的效果
+void liveReport(FILE* Out) {
+    if(!Runs) {
+        fprintf(Out, "live: disabled\n");
+        return;
+    }
+    fprintf(Out, "live: %ld -> %ld stack slots\n", SlotsBefore, SlotsAfter);
+    fprintf(Out, "  %-14s %ld\n", "dead-store", DeadStores);
+    fprintf(Out, "  %-14s %ld\n", "too-large", TooLarge);
+}
@@ -0,0 +1,688 @@
+#include "rvcc.h"
+
+// 循环优化：在ND_FOR节点上进行循环不变量外提与归纳变量的强度削弱
+//
+// 语言中只有局部变量，没有取址与函数调用，表达式的副作用只有赋值，
+// 因此循环中没有被赋值的变量在整个循环中保持不变，
+// 只由常量与这些变量组成的表达式即为循环不变量。
+// 表达式的求值不会出错（除以0的结果由RV64定义），可以提前计算。
+//
+// 外提的表达式与归纳变量的初值存入新的临时变量，在循环前的前置块中计算：
+//
+//   for(Init; Cond; Inc) Body
+//   =>
+//   { Init; 临时变量 = 表达式; ...; for(; Cond; Inc) Body }
+//
+// 由内向外处理嵌套的循环，内层循环的前置块属于外层循环的循环体，
+// 其中的表达式还可以继续外提到外层循环之前
+
+// 优化的种类
+typedef enum {
+    LP_HOIST, // 循环不变量 => 前置块中计算的临时变量
+    LP_REDUCE, // i*K => 每次迭代加上Step*K的临时变量
+    LP_ELIMINATE, // 只用于控制循环的归纳变量 => 以临时变量控制循环，删除原变量
+    LP_NUM,
+} LoopOpt;
+
+// 优化的名称，用于输出统计
+static char* LoopOptNames[LP_NUM] = {
+    [LP_HOIST] = "hoist",
+    [LP_REDUCE] = "reduce",
+    [LP_ELIMINATE] = "eliminate",
+};
+
+// 每种优化进行的次数
+static long LoopOptCnt[LP_NUM];
+// 处理的循环数，-1表示未进行循环优化
+static long Loops = -1;
+
+// 每个循环中最多的外提表达式与削弱的乘法，超出的部分不再处理，
+// 避免去重时的比较次数过多
+#define HOIST_LIMIT 64
+#define REDUCE_LIMIT 8
+
+// 当前处理的函数
+static Function* CurFn;
+// 当前循环的编号，变量的Mark等于它时表示在该循环中被赋值
+static uint32_t LoopGen;
+
+// 遍历节点时使用的显式栈
+static WorkStack Work;
+
+// 将节点的全部子节点压栈，语句与表达式都适用
+static void pushKids(Node* Nd) {
+    switch(Nd->Kind) {
+    case ND_NUM:
+    case ND_VAR:
+        return;
+    case ND_IF:
+        pushNode(&Work, Nd->Cond);
+        pushNode(&Work, Nd->Then);
+        pushNode(&Work, getExt(Nd)->Els);
+        return;
+    case ND_FOR:
+        pushNode(&Work, getExt(Nd)->Init);
+        pushNode(&Work, Nd->Cond);
+        pushNode(&Work, Nd->Then);
+        pushNode(&Work, getExt(Nd)->Inc);
+        return;
+    case ND_BLOCK:
+        for(NodeId N = Nd->Body; N; N = getNode(N)->Next)
+            pushNode(&Work, N);
+        return;
+    default:
+        pushNode(&Work, Nd->LHS);
+        pushNode(&Work, Nd->RHS);
+        return;
+    }
+}
+
+// 将Root中每个变量的出现次数加上Delta
+static void addRefs(NodeId Root, int Delta) {
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        Node* Nd = getNode(popNode(&Work));
+        if(Nd->Kind == ND_VAR)
+            Nd->Var->Refs += Delta;
+        pushKids(Nd);
+    }
+}
+
+// 标记Root中被赋值的变量
+static void markAssigns(NodeId Root) {
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        Node* Nd = getNode(popNode(&Work));
+        if(Nd->Kind == ND_ASSIGN)
+            getNode(Nd->LHS)->Var->Mark = LoopGen;
+        pushKids(Nd);
+    }
+}
+
+// 判断Root中是否有对Var的赋值
+static bool assigns(NodeId Root, Obj* Var) {
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        Node* Nd = getNode(popNode(&Work));
+        if(Nd->Kind == ND_ASSIGN && getNode(Nd->LHS)->Var == Var) {
+            Work.Top = 0;
+            return true;
+        }
+        pushKids(Nd);
+    }
+    return false;
+}
+
+// 新建一个临时变量，加入函数的变量链表
+static Obj* newTemp(void) {
+    static int Cnt;
+    Obj* Var = arenaAlloc(sizeof(Obj));
+    // 名称以'.'开头，不会与源代码中的变量重名
+    char Buf[32];
+    Var->Len = snprintf(Buf, sizeof(Buf), ".loop.%d", Cnt++);
+    Var->Name = arenaAlloc(Var->Len + 1);
+    memcpy(Var->Name, Buf, Var->Len);
+    Var->Next = CurFn->Locals;
+    CurFn->Locals = Var;
+    return Var;
+}
+
+// 新建一个变量节点，同时增加变量的出现次数
+static NodeId newVarRef(Obj* Var) {
+    Var->Refs++;
+    return newVarNode(Var);
+}
+
+// 新建语句Var = Expr;
+static NodeId newAssignStmt(Obj* Var, NodeId Expr) {
+    NodeId Assign = newBinary(ND_ASSIGN, newVarRef(Var), Expr);
+    NodeId Stmt = newNode(ND_EXPR_STMT);
+    getNode(Stmt)->LHS = Assign;
+    return Stmt;
+}
+
+// 将表达式节点Id原地改写为读取变量Var，原有的子树不再被引用
+static void toVar(NodeId Id, Obj* Var) {
+    addRefs(Id, -1);
+    Node* Nd = getNode(Id);
+    Nd->Kind = ND_VAR;
+    Nd->Var = Var;
+    Nd->LHS = 0;
+    Nd->RHS = 0;
+    Var->Refs++;
+}
+
+// 判断Id是否为读取变量Var的节点
+static bool isVar(NodeId Id, Obj* Var) {
+    Node* Nd = getNode(Id);
+    return Nd->Kind == ND_VAR && Nd->Var == Var;
+}
+
+// 判断数值是否在32位有符号数的范围内，两个这样的数相乘不会溢出
+static bool isInt32(int64_t Val) {
+    return INT32_MIN <= Val && Val <= INT32_MAX;
+}
+
+// 当前循环中的表达式的根节点、可外提的表达式、前置块中的语句，按压入顺序访问
+static WorkStack Roots, Cands, Pre;
+
+// 收集语句Id中的表达式的根节点，赋值的左部不会被收集
+static void collectRoots(NodeId Id) {
+    Node* Nd = getNode(Id);
+    switch(Nd->Kind) {
+    case ND_IF:
+        pushNode(&Roots, Nd->Cond);
+        collectRoots(Nd->Then);
+        if(getExt(Nd)->Els)
+            collectRoots(getExt(Nd)->Els);
+        return;
+    case ND_FOR:
+        if(getExt(Nd)->Init)
+            collectRoots(getExt(Nd)->Init);
+        if(Nd->Cond)
+            pushNode(&Roots, Nd->Cond);
+        if(getExt(Nd)->Inc)
+            pushNode(&Roots, getExt(Nd)->Inc);
+        collectRoots(Nd->Then);
+        return;
+    case ND_BLOCK:
+        for(NodeId N = Nd->Body; N; N = getNode(N)->Next)
+            collectRoots(N);
+        return;
+    case ND_RETURN:
+    case ND_EXPR_STMT:
+        pushNode(&Roots, Nd->LHS);
+        return;
+    default:
+        return;
+    }
+}
+
+// 查找不变量时待访问的节点
+typedef struct {
+    NodeId Id;
+    bool Visited; // 子节点是否已经压栈
+} InvFrame;
+
+// 查找不变量时的显式栈，以及已访问完的节点是否为不变量
+static InvFrame* InvStack;
+static int InvTop, InvCap;
+static bool* InvVals;
+static int InvValTop, InvValCap;
+
+// 将待访问的节点压栈
+static void pushInv(NodeId Id) {
+    if(InvTop == InvCap) {
+        InvCap = InvCap ? InvCap * 2 : 64;
+        InvStack = realloc(InvStack, sizeof(InvFrame) * InvCap);
+        if(!InvStack)
+            error("out of memory");
+    }
+    InvStack[InvTop++] = (InvFrame){Id, false};
+}
+
+// 记录节点是否为不变量
+static void pushInvVal(bool Val) {
+    if(InvValTop == InvValCap) {
+        InvValCap = InvValCap ? InvValCap * 2 : 64;
+        InvVals = realloc(InvVals, sizeof(bool) * InvValCap);
+        if(!InvVals)
+            error("out of memory");
+    }
+    InvVals[InvValTop++] = Val;
+}
+
+// 不变量Id值得外提时加入候选，单独的常量或变量不需要外提
+static void addCand(NodeId Id) {
+    NodeKind Kind = getNode(Id)->Kind;
+    if(Kind != ND_NUM && Kind != ND_VAR)
+        pushNode(&Cands, Id);
+}
+
+// 收集表达式Root中极大的不变子表达式
+// 使用显式的栈进行后序遍历，节点的子节点都是不变量且自身不是赋值时，
+// 节点为不变量；不变的子节点的父节点不是不变量时，子节点即为极大的
+static void findInvariants(NodeId Root) {
+    pushInv(Root);
+    while(InvTop > 0) {
+        InvFrame* F = &InvStack[InvTop - 1];
+        Node* Nd = getNode(F->Id);
+
+        if(!F->Visited) {
+            F->Visited = true;
+            switch(Nd->Kind) {
+            case ND_NUM:
+            case ND_VAR:
+                break;
+            case ND_NEG:
+                pushInv(Nd->LHS);
+                continue;
+            case ND_ASSIGN:
+                pushInv(Nd->RHS);
+                continue;
+            default:
+                pushInv(Nd->RHS);
+                pushInv(Nd->LHS);
+                continue;
+            }
+        }
+
+        InvTop--;
+        switch(Nd->Kind) {
+        case ND_NUM:
+            pushInvVal(true);
+            break;
+        case ND_VAR:
+            pushInvVal(Nd->Var->Mark != LoopGen);
+            break;
+        // 子节点的结果即为自身的结果
+        case ND_NEG:
+            break;
+        case ND_ASSIGN:
+            if(InvVals[--InvValTop])
+                addCand(Nd->RHS);
+            pushInvVal(false);
+            break;
+        default: {
+            // 左子节点先访问完，结果在下方
+            bool R = InvVals[--InvValTop];
+            bool L = InvVals[--InvValTop];
+            if(L && R) {
+                pushInvVal(true);
+                break;
+            }
+            if(L)
+                addCand(Nd->LHS);
+            if(R)
+                addCand(Nd->RHS);
+            pushInvVal(false);
+            break;
+        }
+        }
+    }
+
+    if(InvVals[--InvValTop])
+        addCand(Root);
+}
+
+// 将循环中的不变量外提到前置块中
+static void hoistInvariants(NodeId Loop) {
+    Node* Nd = getNode(Loop);
+    NodeExt* Ext = getExt(Nd);
+
+    // 标记循环中被赋值的变量，初始化语句只执行一次，不属于循环
+    LoopGen++;
+    if(Nd->Cond)
+        markAssigns(Nd->Cond);
+    markAssigns(Nd->Then);
+    if(Ext->Inc)
+        markAssigns(Ext->Inc);
+
+    Roots.Top = 0;
+    Cands.Top = 0;
+    if(Nd->Cond)
+        pushNode(&Roots, Nd->Cond);
+    if(Ext->Inc)
+        pushNode(&Roots, Ext->Inc);
+    collectRoots(Nd->Then);
+    for(int I = 0; I < Roots.Top; I++)
+        findInvariants(Roots.Data[I]);
+
+    // 已外提的表达式及存放它的临时变量，相同的表达式共用同一变量
+    NodeId Exprs[HOIST_LIMIT];
+    Obj* Temps[HOIST_LIMIT];
+    int N = 0;
+
+    for(int I = 0; I < Cands.Top; I++) {
+        NodeId Id = Cands.Data[I];
+        Obj* Var = NULL;
+        for(int J = 0; J < N; J++) {
+            if(sameExpr(Exprs[J], Id)) {
+                Var = Temps[J];
+                break;
+            }
+        }
+
+        if(!Var) {
+            if(N == HOIST_LIMIT)
+                continue;
+            // 将表达式复制到新节点中，原节点改写为读取临时变量
+            Var = newTemp();
+            NodeId Copy = newNode(ND_NUM);
+            *getNode(Copy) = *getNode(Id);
+            addRefs(Copy, 1);
+            pushNode(&Pre, newAssignStmt(Var, Copy));
+            Exprs[N] = Copy;
+            Temps[N++] = Var;
+        }
+
+        toVar(Id, Var);
+        LoopOptCnt[LP_HOIST]++;
+    }
+}
+
+// 判断Inc是否为i = i + Step或i = i - Step的形式，是则写入i与Step
+static bool matchStep(NodeId Inc, Obj** Var, int64_t* Step) {
+    Node* Nd = getNode(Inc);
+    if(Nd->Kind != ND_ASSIGN)
+        return false;
+    Obj* V = getNode(Nd->LHS)->Var;
+    Node* RHS = getNode(Nd->RHS);
+    if(RHS->Kind != ND_ADD && RHS->Kind != ND_SUB)
+        return false;
+
+    Node* C;
+    if(isVar(RHS->LHS, V))
+        C = getNode(RHS->RHS);
+    else if(RHS->Kind == ND_ADD && isVar(RHS->RHS, V))
+        C = getNode(RHS->LHS);
+    else
+        return false;
+    if(C->Kind != ND_NUM || C->Val == 0)
+        return false;
+
+    *Var = V;
+    *Step = RHS->Kind == ND_ADD ? C->Val : (int64_t)(0 - (uint64_t)C->Val);
+    return true;
+}
+
+// 判断Init是否为i = N;的形式，是则写入N
+static bool matchInit(NodeId Init, Obj* Var, int64_t* Val) {
+    if(!Init)
+        return false;
+    Node* Nd = getNode(Init);
+    if(Nd->Kind != ND_EXPR_STMT)
+        return false;
+    Node* Assign = getNode(Nd->LHS);
+    if(Assign->Kind != ND_ASSIGN || !isVar(Assign->LHS, Var))
+        return false;
+    Node* RHS = getNode(Assign->RHS);
+    if(RHS->Kind != ND_NUM)
+        return false;
+    *Val = RHS->Val;
+    return true;
+}
+
+// 收集Root中i*K与K*i形式的乘法，K为常量
+static void findMuls(NodeId Root, Obj* Var) {
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        NodeId Id = popNode(&Work);
+        Node* Nd = getNode(Id);
+        if(Nd->Kind == ND_MUL &&
+           ((isVar(Nd->LHS, Var) && getNode(Nd->RHS)->Kind == ND_NUM) ||
+            (isVar(Nd->RHS, Var) && getNode(Nd->LHS)->Kind == ND_NUM))) {
+            pushNode(&Cands, Id);
+            continue;
+        }
+        pushKids(Nd);
+    }
+}
+
+// 乘法i*K或K*i中的常量K
+static int64_t mulConst(NodeId Id) {
+    Node* Nd = getNode(Id);
+    Node* L = getNode(Nd->LHS);
+    return L->Kind == ND_NUM ? L->Val : getNode(Nd->RHS)->Val;
+}
+
+// 以Temp控制循环，删除只用于控制循环的归纳变量Var
+// 要求Init为Var = I0，Cond为Var < N、Var <= N或其对称形式，
+// 且Var在函数中没有其他的使用。各数值都在32位的范围内时，
+// Var*K在循环中不会溢出，比较Var与N等价于比较Var*K与N*K
+static void eliminateIV(NodeId Loop, Obj* Var, int64_t Step, Obj* Temp,
+                        int64_t K) {
+    Node* Nd = getNode(Loop);
+    NodeExt* Ext = getExt(Nd);
+    int64_t I0;
+    if(!Nd->Cond || !matchInit(Ext->Init, Var, &I0))
+        return;
+
+    // 初始化、自增与条件中共4次使用
+    if(Var->Refs != 4)
+        return;
+
+    Node* Cond = getNode(Nd->Cond);
+    if(Cond->Kind != ND_LT && Cond->Kind != ND_LE)
+        return;
+    NodeId VarId, NumId;
+    if(isVar(Cond->LHS, Var) && Step > 0) {
+        VarId = Cond->LHS;
+        NumId = Cond->RHS;
+    } else if(isVar(Cond->RHS, Var) && Step < 0) {
+        VarId = Cond->RHS;
+        NumId = Cond->LHS;
+    } else {
+        return;
+    }
+    Node* Num = getNode(NumId);
+    if(Num->Kind != ND_NUM)
+        return;
+
+    // 循环中Var的值在I0与N+Step之间
+    int64_t N = Num->Val;
+    if(!isInt32(I0) || !isInt32(N) || !isInt32(Step) || !isInt32(K) ||
+       !isInt32(N + Step))
+        return;
+
+    toVar(VarId, Temp);
+    Num->Val = N * K;
+    // K为负数时大小关系相反
+    if(K < 0) {
+        NodeId T = Cond->LHS;
+        Cond->LHS = Cond->RHS;
+        Cond->RHS = T;
+    }
+
+    addRefs(Ext->Inc, -1);
+    Ext->Inc = 0;
+    addRefs(Ext->Init, -1);
+    Ext->Init = 0;
+    LoopOptCnt[LP_ELIMINATE]++;
+}
+
+// 归纳变量的强度削弱
+// Inc为i = i + Step且循环体与条件中不对i赋值时，i为基本归纳变量，
+// 条件与循环体中的i*K改写为临时变量t，t在前置块中初始化为i*K，
+// 在循环体末尾加上Step*K，与Inc中的i同步变化
+static void reduceIVs(NodeId Loop) {
+    Node* Nd = getNode(Loop);
+    NodeExt* Ext = getExt(Nd);
+    Obj* Var;
+    int64_t Step;
+    if(!Ext->Inc || !matchStep(Ext->Inc, &Var, &Step))
+        return;
+    if((Nd->Cond && assigns(Nd->Cond, Var)) || assigns(Nd->Then, Var))
+        return;
+
+    Cands.Top = 0;
+    if(Nd->Cond)
+        findMuls(Nd->Cond, Var);
+    findMuls(Nd->Then, Var);
+    if(!Cands.Top)
+        return;
+
+    int64_t I0;
+    bool HasI0 = matchInit(Ext->Init, Var, &I0);
+
+    // 每个不同的K对应一个临时变量
+    int64_t Ks[REDUCE_LIMIT];
+    Obj* Temps[REDUCE_LIMIT];
+    int N = 0;
+    NodeId Updates = 0;
+
+    for(int I = 0; I < Cands.Top; I++) {
+        NodeId Id = Cands.Data[I];
+        int64_t K = mulConst(Id);
+        Obj* Temp = NULL;
+        for(int J = 0; J < N; J++) {
+            if(Ks[J] == K) {
+                Temp = Temps[J];
+                break;
+            }
+        }
+
+        if(!Temp) {
+            if(N == REDUCE_LIMIT)
+                continue;
+            Temp = newTemp();
+            Ks[N] = K;
+            Temps[N++] = Temp;
+
+            // 乘法使用无符号运算，得到与运行时一致的回绕结果
+            NodeId Init = HasI0 ? newNum((int64_t)((uint64_t)I0 * K))
+                                : newBinary(ND_MUL, newVarRef(Var), newNum(K));
+            pushNode(&Pre, newAssignStmt(Temp, Init));
+
+            NodeId Add = newBinary(ND_ADD, newVarRef(Temp),
+                                   newNum((int64_t)((uint64_t)Step * K)));
+            NodeId Update = newAssignStmt(Temp, Add);
+            getNode(Update)->Next = Updates;
+            Updates = Update;
+        }
+
+        toVar(Id, Temp);
+        LoopOptCnt[LP_REDUCE]++;
+    }
+
+    // 更新语句放在循环体末尾，循环体中没有break与continue，
+    // 每次迭代都会执行到这里
+    NodeId Body = newNode(ND_BLOCK);
+    Nd = getNode(Loop);
+    getNode(Nd->Then)->Next = Updates;
+    getNode(Body)->Body = Nd->Then;
+    Nd->Then = Body;
+
+    eliminateIV(Loop, Var, Step, Temps[0], Ks[0]);
+}
+
+// 分支指令的两个操作数都在寄存器中，条件与非0的常量比较时，
+// 每次迭代都要重新加载常量，将其存入临时变量，只在前置块中加载一次
+static void hoistBound(NodeId Loop) {
+    NodeId CondId = getNode(Loop)->Cond;
+    if(!CondId)
+        return;
+    NodeKind Kind = getNode(CondId)->Kind;
+    if(Kind != ND_EQ && Kind != ND_NE && Kind != ND_LT && Kind != ND_LE)
+        return;
+
+    NodeId Sides[] = {getNode(CondId)->LHS, getNode(CondId)->RHS};
+    for(int I = 0; I < 2; I++) {
+        Node* Num = getNode(Sides[I]);
+        if(Num->Kind != ND_NUM || Num->Val == 0)
+            continue;
+        Obj* Var = newTemp();
+        pushNode(&Pre, newAssignStmt(Var, newNum(getNode(Sides[I])->Val)));
+        toVar(Sides[I], Var);
+        LoopOptCnt[LP_HOIST]++;
+    }
+}
+
+// 优化单个循环，返回替换后的语句
+static NodeId optimizeLoop(NodeId Loop) {
+    Loops++;
+    Pre.Top = 0;
+    hoistInvariants(Loop);
+    reduceIVs(Loop);
+    hoistBound(Loop);
+    if(!Pre.Top)
+        return Loop;
+
+    // 前置块：初始化语句、外提的表达式、归纳变量的初值，最后是循环本身
+    NodeExt* Ext = getExt(getNode(Loop));
+    NodeId Head = Ext->Init;
+    NodeId Tail = Head;
+    Ext->Init = 0;
+    for(int I = 0; I < Pre.Top; I++) {
+        if(Tail)
+            getNode(Tail)->Next = Pre.Data[I];
+        else
+            Head = Pre.Data[I];
+        Tail = Pre.Data[I];
+    }
+    getNode(Tail)->Next = Loop;
+    getNode(Loop)->Next = 0;
+
+    NodeId Block = newNode(ND_BLOCK);
+    getNode(Block)->Body = Head;
+    return Block;
+}
+
+// 优化语句中的循环，返回替换后的语句，调用者负责维护Next
+static NodeId optimizeStmt(NodeId Id) {
+    Node* Nd = getNode(Id);
+    switch(Nd->Kind) {
+    case ND_IF: {
+        NodeId Then = optimizeStmt(Nd->Then);
+        getNode(Id)->Then = Then;
+        NodeId Els = getExt(getNode(Id))->Els;
+        if(Els) {
+            Els = optimizeStmt(Els);
+            getExt(getNode(Id))->Els = Els;
+        }
+        return Id;
+    }
+    case ND_FOR: {
+        // 先处理内层的循环
+        NodeId Then = optimizeStmt(Nd->Then);
+        getNode(Id)->Then = Then;
+        return optimizeLoop(Id);
+    }
+    case ND_BLOCK: {
+        // 新建节点会使节点池扩容，因此只持有节点的编号
+        NodeId Head = 0;
+        NodeId Tail = 0;
+        for(NodeId N = Nd->Body; N;) {
+            NodeId Next = getNode(N)->Next;
+            NodeId S = optimizeStmt(N);
+            if(Tail)
+                getNode(Tail)->Next = S;
+            else
+                Head = S;
+            Tail = S;
+            N = Next;
+        }
+        if(Tail)
+            getNode(Tail)->Next = 0;
+        getNode(Id)->Body = Head;
+        return Id;
+    }
+    default:
+        return Id;
+    }
+}
+
+// 循环优化入口函数
+void optimizeLoops(Function* Prog) {
+    CurFn = Prog;
+    if(Loops < 0)
+        Loops = 0;
+
+    // 统计每个变量在函数中的出现次数，用于判断归纳变量能否删除
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next)
+        Var->Refs = 0;
+    addRefs(Prog->Body, 1);
+
+    Prog->Body = optimizeStmt(Prog->Body);
+
+    freeWorkStack(&Work);
+    free(InvStack);
+    free(InvVals);
+    freeWorkStack(&Roots);
+    freeWorkStack(&Cands);
+    freeWorkStack(&Pre);
+    InvStack = NULL;
+    InvVals = NULL;
+    InvCap = InvValCap = 0;
+}
+
+// 输出每种优化进行的次数
+void loopReport(FILE* Out) {
+    if(Loops < 0) {
+        fprintf(Out, "loop: disabled\n");
+        return;
+    }
+    fprintf(Out, "loop: %ld loops\n", Loops);
+    for(int I = 0; I < LP_NUM; I++)
+        fprintf(Out, "  %-14s %ld\n", LoopOptNames[I], LoopOptCnt[I]);
+}
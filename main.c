@@ -1,18 +1,322 @@
+// 使用了mmap的MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
 #include "rvcc.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 输出文件的路径，为NULL或"-"时输出到标准输出
+static char* OptO;
+
+// 是否在内置模拟器中运行编译出的程序
+static bool OptRun;
+
+// 是否输出死代码删除、循环优化、活跃变量分析、基本块布局与窥孔优化的统计
+static bool OptOptReport;
+
+// 是否经由SSA中间表示生成代码
+static bool OptSSA;
+
+// 是否向标准错误输出SSA中间表示
+static bool OptDumpIR;
+
+// 输入文件的路径，为"-"时从标准输入读取
+static char* InputPath;
+
+// 输出程序的使用说明
+static void usage(int Status) {
+    fprintf(stderr, "rvcc [ -o <path> ] [ -O0 | -O1 ] [ -fssa ] [ --dump-ir ] "
+                    "[ --emit=asm|obj|exe ] [ --annotate ] [ --run ] [ --opt-report ] "
+                    "[ --stats[=json] ] <file>\n"
+                    "--run exits with the low 8 bits of main's return value; "
+                    "compile and simulation errors terminate with SIGABRT instead\n");
+    if(Status)
+        die();
+    exit(0);
+}
+
+// 解析传入程序的参数
+static void parseArgs(int Argc, char** Argv) {
+    // --run时参数的错误也不能与程序的返回值混淆，需在解析其他参数前确定
+    for(int I = 1; I < Argc; I++)
+        if(!strcmp(Argv[I], "--run"))
+            AbortOnError = true;
+
+    for(int I = 1; I < Argc; I++) {
+        // 解析-h或--help
+        if(!strcmp(Argv[I], "-h") || !strcmp(Argv[I], "--help"))
+            usage(0);
+
+        // 解析-o XXX
+        if(!strcmp(Argv[I], "-o")) {
+            // 不存在目标文件则报错
+            if(!Argv[++I])
+                usage(1);
+            OptO = Argv[I];
+            continue;
+        }
+
+        // 解析-oXXX
+        if(!strncmp(Argv[I], "-o", 2)) {
+            OptO = Argv[I] + 2;
+            continue;
+        }
+
+        // 解析--annotate，在汇编中输出注释
+        if(!strcmp(Argv[I], "--annotate")) {
+            OptAnnotate = true;
+            continue;
+        }
+
+        // 解析-O0、-O1，-O0时不进行循环优化、基本块布局与窥孔优化
+        if(!strcmp(Argv[I], "-O0") || !strcmp(Argv[I], "-O1")) {
+            OptLevel = Argv[I][2] - '0';
+            continue;
+        }
+
+        // 解析--emit=asm|obj|exe，输出汇编、可重定位目标文件或静态可执行文件
+        if(!strncmp(Argv[I], "--emit=", 7)) {
+            if(!strcmp(Argv[I] + 7, "asm"))
+                OptEmit = EMIT_ASM;
+            else if(!strcmp(Argv[I] + 7, "obj"))
+                OptEmit = EMIT_OBJ;
+            else if(!strcmp(Argv[I] + 7, "exe"))
+                OptEmit = EMIT_EXE;
+            else
+                error("unknown output format: %s", Argv[I] + 7);
+            continue;
+        }
+
+        // 解析-fssa，将函数体转换为SSA形式后再生成代码
+        if(!strcmp(Argv[I], "-fssa")) {
+            OptSSA = true;
+            continue;
+        }
+
+        // 解析--dump-ir，向标准错误输出SSA形式的函数体，隐含-fssa
+        if(!strcmp(Argv[I], "--dump-ir")) {
+            OptSSA = OptDumpIR = true;
+            continue;
+        }
+
+        // 解析--opt-report，向标准错误输出死代码删除、循环优化、活跃变量分析、基本块布局与窥孔优化的统计
+        if(!strcmp(Argv[I], "--opt-report")) {
+            OptOptReport = true;
+            continue;
+        }
+
+        // 解析--stats与--stats=json，向标准错误输出各阶段的用时与各种数量
+        if(!strcmp(Argv[I], "--stats")) {
+            OptStats = STATS_TEXT;
+            continue;
+        }
+        if(!strcmp(Argv[I], "--stats=json")) {
+            OptStats = STATS_JSON;
+            continue;
+        }
+
+        // 解析--run，编译后直接在内置模拟器中运行
+        if(!strcmp(Argv[I], "--run")) {
+            OptRun = true;
+            continue;
+        }
+
+        // 解析为-的参数
+        if(Argv[I][0] == '-' && Argv[I][1] != '\0')
+            error("unknown argument: %s", Argv[I]);
+
+        // 其他情况则匹配为输入的文件
+        if(InputPath)
+            error("%s: invalid number of arguments", Argv[0]);
+        InputPath = Argv[I];
+    }
+
+    // 不存在输入文件时报错
+    if(!InputPath)
+        error("no input files");
+}
+
+// 从文件描述符中流式读取全部内容，存入不断扩大的缓冲区中
+static char* readStream(int Fd, char* Path) {
+    size_t Cap = 1 << 16;
+    size_t Len = 0;
+    char* Buf = malloc(Cap);
+
+    while(true) {
+        if(!Buf)
+            error("out of memory");
+        // 预留结尾'\0'的位置
+        if(Cap - Len < 2) {
+            Cap *= 2;
+            Buf = realloc(Buf, Cap);
+            continue;
+        }
+        ssize_t N = read(Fd, Buf + Len, Cap - Len - 1);
+        if(N == 0)
+            break;
+        if(N < 0) {
+            if(errno == EINTR)
+                continue;
+            error("cannot read %s: %s", Path, strerror(errno));
+        }
+        Len += N;
+    }
+
+    Buf[Len] = '\0';
+    return Buf;
+}
+
+// 将普通文件映射到内存中，映射区在文件内容之后至少有一个'\0'，
+// 使词法分析可以直接以'\0'作为结束标志，无需复制文件内容
+static char* mapFile(int Fd, char* Path, size_t Size) {
+    size_t PageSize = sysconf(_SC_PAGESIZE);
+
+    // 文件大小不是页大小的整数倍时，最后一页超出文件的部分由内核填充为0
+    if(Size % PageSize) {
+        char* P = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+        if(P == MAP_FAILED)
+            error("cannot mmap %s: %s", Path, strerror(errno));
+        return P;
+    }
+
+    // 文件大小恰为页大小的整数倍时，先预留多一页的匿名映射，
+    // 再将文件覆盖映射到前面，多出的一页全为0，作为结尾的'\0'
+    char* P = mmap(NULL, Size + PageSize, PROT_READ,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(P == MAP_FAILED)
+        error("cannot mmap %s: %s", Path, strerror(errno));
+    if(mmap(P, Size, PROT_READ, MAP_PRIVATE | MAP_FIXED, Fd, 0) == MAP_FAILED)
+        error("cannot mmap %s: %s", Path, strerror(errno));
+    return P;
+}
+
+// 读取输入文件，返回以'\0'结尾的内容
+static char* readFile(char* Path) {
+    // 为"-"时从标准输入读取
+    if(strcmp(Path, "-") == 0)
+        return readStream(STDIN_FILENO, "stdin");
+
+    int Fd = open(Path, O_RDONLY);
+    if(Fd < 0)
+        error("cannot open %s: %s", Path, strerror(errno));
+
+    struct stat St;
+    if(fstat(Fd, &St) < 0)
+        error("cannot stat %s: %s", Path, strerror(errno));
+
+    char* Buf;
+    if(!S_ISREG(St.st_mode))
+        // 管道等无法映射的文件，流式读取
+        Buf = readStream(Fd, Path);
+    else if(St.st_size == 0)
+        Buf = "";
+    else
+        Buf = mapFile(Fd, Path, St.st_size);
+
+    // 映射建立后即可关闭文件
+    close(Fd);
+    return Buf;
+}
+
+// 打开输出文件
+static FILE* openFile(char* Path) {
+    if(!Path || strcmp(Path, "-") == 0)
+        return stdout;
+
+    // 可执行文件创建时即带有执行权限
+    int Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC,
+                  OptEmit == EMIT_EXE ? 0777 : 0666);
+    FILE* Out = Fd < 0 ? NULL : fdopen(Fd, "w");
+    if(!Out)
+        error("cannot open output file: %s: %s", Path, strerror(errno));
+    return Out;
+}
+
 // 语义分析与代码生成
 
 int main(int Argc, char** Argv) {
+    parseArgs(Argc, Argv);
+
+    char* Src = readFile(InputPath);
+
+    // 解析时终结符是按需读取的，统计时先单独进行一次词法分析以得到其用时
+    if(OptStats) {
+        statBegin(ST_TOKENIZE);
+        for(Token* Tok = tokenize(Src); Tok->Kind != TK_EOF; Tok = nextToken(Tok))
+            ;
+        statEnd(ST_TOKENIZE);
+    }
+
+    statBegin(ST_PARSE);
+    Function* Prog = parse(tokenize(Src));
+    statEnd(ST_PARSE);
+
+    statBegin(ST_OPTIMIZE);
+    optimize(Prog);
+    statEnd(ST_OPTIMIZE);
 
-    if(Argc != 2) {
-        error("%s: invalid number of arguments %s\n", Argv[0], Argv[1]);
+    // 构造SSA形式，检查其正确性
+    if(OptSSA) {
+        statBegin(ST_SSA);
+        Prog->IR = irBuild(Prog);
+        eliminateDeadValues(Prog->IR);
+        irVerify(Prog->IR);
+        statEnd(ST_SSA);
+        if(OptDumpIR)
+            irPrint(Prog->IR, stderr);
     }
 
-    Token* Tok = tokenize(Argv[1]);
+    // 生成代码并在内置模拟器中运行，以main的返回值的低8位作为退出码，
+    // 编译或运行出错时以SIGABRT终止，见AbortOnError
+    if(OptRun) {
+        char* Buf;
+        size_t BufLen;
+        FILE* Out = open_memstream(&Buf, &BufLen);
+        statBegin(ST_CODEGEN);
+        codegen(Prog, Out);
+        fclose(Out);
+        statEnd(ST_CODEGEN);
+        statReport(Prog, stderr);
+        arenaFree();
+        if(OptOptReport) {
+            dceReport(stderr);
+            loopReport(stderr);
+            liveReport(stderr);
+            layoutReport(stderr);
+            peepholeReport(stderr);
+        }
 
-    Function* Prog = parse(Tok);
+        // 同时输出运行时执行的指令数
+        uint64_t Steps;
+        int64_t Ret = OptEmit == EMIT_ASM ? simRun(Buf, &Steps)
+                                          : simRunElf((uint8_t*)Buf, BufLen, &Steps);
+        free(Buf);
+        if(OptOptReport)
+            fprintf(stderr, "executed: %lu instructions\n", (unsigned long)Steps);
+        return (int)(Ret & 0xff);
+    }
+
+    // 生成代码，写入到输出文件
+    FILE* Out = openFile(OptO);
+    statBegin(ST_CODEGEN);
+    codegen(Prog, Out);
+    if(Out != stdout)
+        fclose(Out);
+    statEnd(ST_CODEGEN);
+    statReport(Prog, stderr);
+    if(OptOptReport) {
+        dceReport(stderr);
+        loopReport(stderr);
+        liveReport(stderr);
+        layoutReport(stderr);
+        peepholeReport(stderr);
+    }
 
-    codegen(Prog);
+    // 释放编译过程中分配的全部对象
+    arenaFree();
 
     return 0;
-}
\ No newline at end of file
+}
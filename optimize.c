@@ -0,0 +1,326 @@
+#include "rvcc.h"
+
+// AST优化：常量折叠与代数化简
+
+// 优化过程中不新建节点，改写都在原节点上进行，
+// 因此可以安全地持有节点池中的指针
+
+// 将节点Id改写为数字节点
+static NodeId toNum(NodeId Id, int64_t Val) {
+    Node* Nd = getNode(Id);
+    Nd->Kind = ND_NUM;
+    Nd->Val = Val;
+    Nd->LHS = 0;
+    Nd->RHS = 0;
+    return Id;
+}
+
+// 判断是否为值为Val的数字节点
+static bool isNum(NodeId Id, int64_t Val) {
+    Node* Nd = getNode(Id);
+    return Nd->Kind == ND_NUM && Nd->Val == Val;
+}
+
+// isPure与sameExpr遍历时使用的显式栈
+static WorkStack Work;
+
+// 将一对对应的节点压栈，只有一方为空时返回false
+static bool pushPair(NodeId X, NodeId Y) {
+    if(!X || !Y)
+        return X == Y;
+    pushNode(&Work, X);
+    pushNode(&Work, Y);
+    return true;
+}
+
+// 判断表达式是否没有副作用，即不包含赋值
+bool isPure(NodeId Root) {
+    Work.Top = 0;
+    pushNode(&Work, Root);
+    while(Work.Top > 0) {
+        Node* Nd = getNode(popNode(&Work));
+        if(Nd->Kind == ND_ASSIGN)
+            return false;
+        if(Nd->Kind == ND_NUM || Nd->Kind == ND_VAR)
+            continue;
+        pushNode(&Work, Nd->LHS);
+        pushNode(&Work, Nd->RHS);
+    }
+    return true;
+}
+
+// 判断两个表达式在结构上是否相同
+bool sameExpr(NodeId XRoot, NodeId YRoot) {
+    // 成对压栈，依次比较对应的节点
+    Work.Top = 0;
+    if(!pushPair(XRoot, YRoot))
+        return false;
+    while(Work.Top > 0) {
+        NodeId YId = popNode(&Work);
+        NodeId XId = popNode(&Work);
+        Node* X = getNode(XId);
+        Node* Y = getNode(YId);
+        if(X->Kind != Y->Kind)
+            return false;
+        if(X->Kind == ND_NUM) {
+            if(X->Val != Y->Val)
+                return false;
+            continue;
+        }
+        if(X->Kind == ND_VAR) {
+            if(X->Var != Y->Var)
+                return false;
+            continue;
+        }
+        if(!pushPair(X->LHS, Y->LHS) || !pushPair(X->RHS, Y->RHS))
+            return false;
+    }
+    return true;
+}
+
+// 对两个常量进行计算，结果与RV64的64位运算一致
+// 返回false表示不能折叠，如除以0
+static bool evalBinary(NodeKind Kind, int64_t L, int64_t R, int64_t* Val) {
+    // 加减乘使用无符号运算，以得到C中正确的回绕结果
+    uint64_t UL = (uint64_t)L;
+    uint64_t UR = (uint64_t)R;
+
+    switch(Kind) {
+    case ND_ADD:
+        *Val = (int64_t)(UL + UR);
+        return true;
+    case ND_SUB:
+        *Val = (int64_t)(UL - UR);
+        return true;
+    case ND_MUL:
+        *Val = (int64_t)(UL * UR);
+        return true;
+    case ND_DIV:
+        // 除以0与溢出的除法在C中未定义，留给运行时处理
+        if(R == 0 || (L == INT64_MIN && R == -1))
+            return false;
+        *Val = L / R;
+        return true;
+    case ND_EQ:
+        *Val = L == R;
+        return true;
+    case ND_NE:
+        *Val = L != R;
+        return true;
+    case ND_LT:
+        *Val = L < R;
+        return true;
+    case ND_LE:
+        *Val = L <= R;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 代数化简，返回化简后的节点
+static NodeId simplify(NodeId Id) {
+    Node* Nd = getNode(Id);
+    NodeId L = Nd->LHS;
+    NodeId R = Nd->RHS;
+
+    switch(Nd->Kind) {
+    case ND_ADD:
+        // x+0 => x, 0+x => x
+        if(isNum(R, 0))
+            return L;
+        if(isNum(L, 0))
+            return R;
+        break;
+    case ND_SUB:
+        // x-0 => x
+        if(isNum(R, 0))
+            return L;
+        // x-x => 0
+        if(sameExpr(L, R) && isPure(L))
+            return toNum(Id, 0);
+        break;
+    case ND_MUL:
+        // x*1 => x, 1*x => x
+        if(isNum(R, 1))
+            return L;
+        if(isNum(L, 1))
+            return R;
+        // x*0 => 0, 0*x => 0
+        if((isNum(R, 0) && isPure(L)) || (isNum(L, 0) && isPure(R)))
+            return toNum(Id, 0);
+        break;
+    case ND_DIV:
+        // x/1 => x
+        if(isNum(R, 1))
+            return L;
+        break;
+    case ND_EQ:
+    case ND_LE:
+        // x==x => 1, x<=x => 1
+        if(sameExpr(L, R) && isPure(L))
+            return toNum(Id, 1);
+        break;
+    case ND_NE:
+    case ND_LT:
+        // x!=x => 0, x<x => 0
+        if(sameExpr(L, R) && isPure(L))
+            return toNum(Id, 0);
+        break;
+    default:
+        break;
+    }
+
+    return Id;
+}
+
+// 子节点都已折叠后，折叠节点Id本身，返回折叠后的节点
+static NodeId foldNode(NodeId Id) {
+    Node* Nd = getNode(Id);
+    switch(Nd->Kind) {
+    case ND_NUM:
+    case ND_VAR:
+    // 左部为左值，不进行折叠
+    case ND_ASSIGN:
+        return Id;
+    case ND_NEG: {
+        Node* L = getNode(Nd->LHS);
+        // -N => 常量
+        if(L->Kind == ND_NUM)
+            return toNum(Id, (int64_t)(0 - (uint64_t)L->Val));
+        // -(-x) => x
+        if(L->Kind == ND_NEG)
+            return L->LHS;
+        return Id;
+    }
+    default:
+        break;
+    }
+
+    // 两侧均为常量时直接计算
+    Node* L = getNode(Nd->LHS);
+    Node* R = getNode(Nd->RHS);
+    int64_t Val;
+    if(L->Kind == ND_NUM && R->Kind == ND_NUM &&
+       evalBinary(Nd->Kind, L->Val, R->Val, &Val))
+        return toNum(Id, Val);
+
+    return simplify(Id);
+}
+
+// 折叠表达式时待访问的节点，折叠结果写回Slot
+typedef struct {
+    NodeId Id;
+    NodeId* Slot; // 父节点中指向该节点的字段
+    bool Visited; // 子节点是否已经压栈
+} FoldFrame;
+
+// 折叠表达式的显式栈
+static FoldFrame* FoldStack;
+static int FoldTop, FoldCap;
+
+// 将待折叠的节点压栈
+static void pushFold(NodeId Id, NodeId* Slot) {
+    if(FoldTop == FoldCap) {
+        FoldCap = FoldCap ? FoldCap * 2 : 64;
+        FoldStack = realloc(FoldStack, sizeof(FoldFrame) * FoldCap);
+        if(!FoldStack)
+            error("out of memory");
+    }
+    FoldStack[FoldTop++] = (FoldFrame){Id, Slot, false};
+}
+
+// 折叠表达式，返回折叠后的节点
+// 使用显式的栈进行后序遍历，任意深度的表达式都不会耗尽C的调用栈
+static NodeId foldExpr(NodeId Root) {
+    NodeId Result = Root;
+    pushFold(Root, &Result);
+
+    while(FoldTop > 0) {
+        FoldFrame* F = &FoldStack[FoldTop - 1];
+        Node* Nd = getNode(F->Id);
+
+        // 首次访问时先压入子节点，子节点折叠完成后再折叠自身
+        if(!F->Visited) {
+            F->Visited = true;
+            switch(Nd->Kind) {
+            case ND_NUM:
+            case ND_VAR:
+                break;
+            case ND_NEG:
+                pushFold(Nd->LHS, &Nd->LHS);
+                continue;
+            case ND_ASSIGN:
+                pushFold(Nd->RHS, &Nd->RHS);
+                continue;
+            default:
+                pushFold(Nd->RHS, &Nd->RHS);
+                pushFold(Nd->LHS, &Nd->LHS);
+                continue;
+            }
+        }
+
+        FoldTop--;
+        *F->Slot = foldNode(F->Id);
+    }
+
+    return Result;
+}
+
+// 折叠语句中的表达式
+// 条件为常量的分支由死代码删除处理
+static void foldStmt(NodeId Id) {
+    Node* Nd = getNode(Id);
+    switch(Nd->Kind) {
+    case ND_IF: {
+        NodeExt* Ext = getExt(Nd);
+        Nd->Cond = foldExpr(Nd->Cond);
+        foldStmt(Nd->Then);
+        if(Ext->Els)
+            foldStmt(Ext->Els);
+        return;
+    }
+    case ND_FOR: {
+        NodeExt* Ext = getExt(Nd);
+        if(Ext->Init)
+            foldStmt(Ext->Init);
+        if(Nd->Cond)
+            Nd->Cond = foldExpr(Nd->Cond);
+        if(Ext->Inc)
+            Ext->Inc = foldExpr(Ext->Inc);
+        foldStmt(Nd->Then);
+        return;
+    }
+    case ND_BLOCK:
+        for(NodeId N = Nd->Body; N; N = getNode(N)->Next)
+            foldStmt(N);
+        return;
+    case ND_RETURN:
+    case ND_EXPR_STMT:
+        Nd->LHS = foldExpr(Nd->LHS);
+        return;
+    default:
+        return;
+    }
+}
+
+// 优化入口函数
+void optimize(Function* Prog) {
+    foldStmt(Prog->Body);
+    // 折叠后条件为常量的分支与没有副作用的语句随之删除
+    eliminateDeadCode(Prog);
+
+    // 循环优化会新建节点，在折叠之后进行
+    if(OptLevel > 0)
+        optimizeLoops(Prog);
+
+    // 循环优化改写了变量的读写，之后再删除无用的赋值
+    if(OptLevel > 0)
+        eliminateDeadStores(Prog);
+
+    // 遍历用的栈仅在优化期间使用
+    freeWorkStack(&Work);
+    free(FoldStack);
+    FoldStack = NULL;
+    FoldCap = 0;
+}
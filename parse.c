@@ -20,24 +20,60 @@ Obj* Locals;
 // mul = unary("*" unary | "/" unary)*
 // unary = ("+" | "-") unary | primary
 // primary = "(" expr ")" | ident | num
-static Node* compoundStmt(Token** Rest, Token* Tok);
-static Node* stmt(Token** Rest, Token* Tok);
-static Node* exprStmt(Token **Rest, Token* Tok);
-static Node* expr(Token **Rest, Token* Tok);
-static Node* assign(Token **Rest, Token* Tok);
-static Node* equality(Token **Rest, Token* Tok);
-static Node* relational(Token **Rest, Token* Tok);
-static Node* add(Token **Rest, Token* Tok);
-static Node* mul(Token **Rest, Token* Tok);
-static Node* unary(Token **Rest, Token* Tok);
-static Node* primary(Token **Rest, Token* Tok);
+//
+// 表达式不使用递归下降，而是由expr通过显式的栈按优先级解析，
+// 因此任意深度的嵌套都不会耗尽C的调用栈
+static NodeId compoundStmt(Token** Rest, Token* Tok);
+static NodeId stmt(Token** Rest, Token* Tok);
+static NodeId exprStmt(Token **Rest, Token* Tok);
+static NodeId expr(Token **Rest, Token* Tok);
+static NodeId primary(Token **Rest, Token* Tok);
+
+// 变量的哈希表，采用开放寻址法，以变量名(Loc, Len)为键
+static Obj** VarTable;
+// 哈希表的容量，为2的幂
+static int VarTableCap;
+// 哈希表中的变量数
+static int VarTableCnt;
+
+// 初始化容量为Cap的哈希表，Cap须为2的幂
+static void initVarTable(int Cap) {
+    VarTable = calloc(Cap, sizeof(Obj*));
+    VarTableCap = Cap;
+    VarTableCnt = 0;
+}
+
+// 将变量插入哈希表，调用者保证表中不存在同名变量
+static void insertVar(Obj* Var) {
+    // 负载超过一半时扩容，保证探测序列足够短
+    if((VarTableCnt + 1) * 2 > VarTableCap) {
+        Obj** Old = VarTable;
+        int OldCap = VarTableCap;
+        initVarTable(OldCap * 2);
+        for(int I = 0; I < OldCap; I++)
+            if(Old[I])
+                insertVar(Old[I]);
+        free(Old);
+    }
+
+    uint32_t Mask = VarTableCap - 1;
+    uint32_t I = hashBytes(Var->Name, Var->Len) & Mask;
+    // 线性探测，直到找到空位
+    while(VarTable[I])
+        I = (I + 1) & Mask;
+    VarTable[I] = Var;
+    VarTableCnt++;
+}
 
 // 通过一个名称，查找本地变量
 static Obj* findVar(Token* Tok) {
-    // 查找Locals中是否存在同名变量
-    for(Obj* Var = Locals; Var; Var = Var->Next) {
-        if((strlen(Var->Name) == Tok->Len) && 
-           !strncmp(Tok->Loc, Var->Name, Tok->Len)) {
+    uint32_t Mask = VarTableCap - 1;
+    uint32_t I = hashBytes(Tok->Loc, Tok->Len) & Mask;
+
+    // 线性探测，遇到空位说明变量不存在
+    for(Obj* Var; (Var = VarTable[I]); I = (I + 1) & Mask) {
+        if((Var->Len == Tok->Len) &&
+           !memcmp(Tok->Loc, Var->Name, Tok->Len)) {
                 return Var;
            }
     }
@@ -45,70 +81,76 @@ static Obj* findVar(Token* Tok) {
     return NULL;
 }
 
-// 新建一个节点
-static Node* newNode(NodeKind Kind) {
-    Node* Nd = calloc(1, sizeof(Node));
-    Nd->Kind = Kind;
-    return Nd;
-}
+// 节点保存在节点池中，新建节点可能使节点池扩容，
+// 因此解析时只保存节点的编号，子节点解析完成后再通过getNode写入字段
 
 // 新建一个单叉树
-static Node* newUnary(NodeKind Kind, Node* Expr) {
-    Node* Nd = newNode(Kind);
+static NodeId newUnary(NodeKind Kind, NodeId Expr) {
+    NodeId Nd = newNode(Kind);
     // 单叉树，直接关联到其左子树上，而不是右子树
-    Nd->LHS = Expr;
+    getNode(Nd)->LHS = Expr;
     return Nd;
 }
 
 // 新建一个二叉树
-static Node* newBinary(NodeKind Kind, Node* LHS, Node* RHS) {
-    Node* Nd = newNode(Kind);
-    Nd->LHS = LHS;
-    Nd->RHS = RHS;
+NodeId newBinary(NodeKind Kind, NodeId LHS, NodeId RHS) {
+    NodeId Nd = newNode(Kind);
+    getNode(Nd)->LHS = LHS;
+    getNode(Nd)->RHS = RHS;
     return Nd;
 }
 
 // 新建一个数字节点
-static Node* newNum(int val) {
-    Node* Nd = newNode(ND_NUM);
-    Nd->Val = val;
+NodeId newNum(int64_t Val) {
+    NodeId Nd = newNode(ND_NUM);
+    getNode(Nd)->Val = Val;
     return Nd;
 }
 
 // 新建一个变量节点
-static Node* newVarNode(Obj* Var) {
-    Node* Nd = newNode(ND_VAR);
-    Nd->Var = Var;
+NodeId newVarNode(Obj* Var) {
+    NodeId Nd = newNode(ND_VAR);
+    getNode(Nd)->Var = Var;
     return Nd;
 }
 
+// 将语句Nd追加到以Head开头的链表末尾，Tail为链表当前的最后一条语句
+static void appendStmt(NodeId* Head, NodeId* Tail, NodeId Nd) {
+    if(*Tail)
+        getNode(*Tail)->Next = Nd;
+    else
+        *Head = Nd;
+    *Tail = Nd;
+}
+
 // 链表中新增一个变量
-static Obj* newLVar(char* Name) {
-    Obj* Var = calloc(1, sizeof(Obj));
+// 变量名直接指向源代码，不进行复制
+static Obj* newLVar(char* Name, int Len) {
+    Obj* Var = arenaAlloc(sizeof(Obj));
     Var->Name = Name;
-    // 将变量插入头部
+    Var->Len = Len;
+    // 将变量插入头部，Locals保持声明的逆序，使栈布局确定
     Var->Next = Locals;
     Locals = Var;
+    // 同时插入哈希表，用于快速查找
+    insertVar(Var);
     return Var;
 }
 
 // 解析复合语句
 // compoundStmt = stmt* "}"
-static Node* compoundStmt(Token** Rest, Token* Tok) {
-    // 这里使用了和词法分析类似的单向链表结构
-    Node Head = {};
-    Node* Cur = &Head;
+static NodeId compoundStmt(Token** Rest, Token* Tok) {
+    // 语句通过Next组成单向链表
+    NodeId Head = 0, Tail = 0;
 
     // stmt* "}"
-    while(!equal(Tok, "}")) {
-        Cur->Next = stmt(&Tok, Tok);
-        Cur = Cur->Next;
-    }
+    while(!isSym(Tok, SYM_RBRACE))
+        appendStmt(&Head, &Tail, stmt(&Tok, Tok));
 
     // Nd的Body存储了{}内解析的语句
-    Node* Nd = newNode(ND_BLOCK);
-    Nd->Body = Head.Next;
-    *Rest = Tok->Next;
+    NodeId Nd = newNode(ND_BLOCK);
+    getNode(Nd)->Body = Head;
+    *Rest = nextToken(Tok);
     return Nd;
 }
 
@@ -119,76 +161,95 @@ static Node* compoundStmt(Token** Rest, Token* Tok) {
 //        | "while" "(" expr ")" stmt
 //        | "{" compoundStmt 
 //        | exprStmt
-static Node* stmt(Token** Rest, Token* Tok) {
+static NodeId stmt(Token** Rest, Token* Tok) {
     //"return" expr ";"
-    if(equal(Tok, "return")) {
-        Node* Nd = newUnary(ND_RETURN, expr(&Tok, Tok->Next));
-        *Rest = skip(Tok, ";");
+    if(isSym(Tok, SYM_RETURN)) {
+        NodeId Nd = newUnary(ND_RETURN, expr(&Tok, nextToken(Tok)));
+        *Rest = skipSym(Tok, SYM_SEMI);
         return Nd;
     }
 
     //"if" "(" exprStmt ")" stmt ("else" stmt)?
-    if(equal(Tok, "if")) {
-        Node* Nd = newNode(ND_IF);
+    if(isSym(Tok, SYM_IF)) {
         //"(" exprStmt ")"
-        Tok = skip(Tok->Next, "(");
-        Nd->Cond = expr(&Tok, Tok);
-        Tok = skip(Tok, ")");
+        Tok = skipSym(nextToken(Tok), SYM_LPAREN);
+        NodeId Cond = expr(&Tok, Tok);
+        Tok = skipSym(Tok, SYM_RPAREN);
         // stmt
-        Nd->Then = stmt(&Tok, Tok);
+        NodeId Then = stmt(&Tok, Tok);
         //("else" stmt)?
-        if(equal(Tok, "else"))
-            Nd->Els = stmt(&Tok, Tok->Next);
+        NodeId Els = 0;
+        if(isSym(Tok, SYM_ELSE))
+            Els = stmt(&Tok, nextToken(Tok));
+
+        NodeId Nd = newNode(ND_IF);
+        getNode(Nd)->Cond = Cond;
+        getNode(Nd)->Then = Then;
+        // 只有存在else时才需要附加字段
+        if(Els)
+            newNodeExt(Nd)->Els = Els;
         *Rest = Tok;
         return Nd;
     }
 
     //"for" "(" exprStmt expr? ";" expr? ")" stmt
-    if(equal(Tok, "for")) {
-        Node* Nd = newNode(ND_FOR);
+    if(isSym(Tok, SYM_FOR)) {
         // "("
-        Tok = skip(Tok->Next, "(");
+        Tok = skipSym(nextToken(Tok), SYM_LPAREN);
 
         // exprStmt
-        Nd->Init = exprStmt(&Tok, Tok);
+        NodeId Init = exprStmt(&Tok, Tok);
 
         // expr?
-        if(!equal(Tok, ";")) {
-            Nd->Cond = expr(&Tok, Tok);
+        NodeId Cond = 0;
+        if(!isSym(Tok, SYM_SEMI)) {
+            Cond = expr(&Tok, Tok);
         }
 
         // ";"
-        Tok = skip(Tok, ";");
+        Tok = skipSym(Tok, SYM_SEMI);
 
         // expr?
-        if(!equal(Tok, ")"))
-            Nd->Inc = expr(&Tok, Tok);
+        NodeId Inc = 0;
+        if(!isSym(Tok, SYM_RPAREN))
+            Inc = expr(&Tok, Tok);
 
         // ")"
-        Tok = skip(Tok, ")");
+        Tok = skipSym(Tok, SYM_RPAREN);
 
         // stmt
-        Nd->Then = stmt(Rest, Tok);
+        NodeId Then = stmt(Rest, Tok);
+
+        NodeId Nd = newNode(ND_FOR);
+        getNode(Nd)->Cond = Cond;
+        getNode(Nd)->Then = Then;
+        NodeExt* Ext = newNodeExt(Nd);
+        Ext->Init = Init;
+        Ext->Inc = Inc;
         return Nd;
     }
 
     //"while" "(" expr ")" stmt
-    if(equal(Tok, "while")) {
-        Node* Nd = newNode(ND_FOR);
+    if(isSym(Tok, SYM_WHILE)) {
         //"("
-        Tok = skip(Tok->Next, "(");
+        Tok = skipSym(nextToken(Tok), SYM_LPAREN);
         //expr
-        Nd->Cond = expr(&Tok, Tok);
+        NodeId Cond = expr(&Tok, Tok);
         //")"
-        Tok = skip(Tok, ")");
+        Tok = skipSym(Tok, SYM_RPAREN);
         //stmt
-        Nd->Then = stmt(Rest, Tok);
+        NodeId Then = stmt(Rest, Tok);
+
+        // 没有初始化与自增语句，不需要附加字段
+        NodeId Nd = newNode(ND_FOR);
+        getNode(Nd)->Cond = Cond;
+        getNode(Nd)->Then = Then;
         return Nd;
     }
 
     //"{" compoundStmt
-    if(equal(Tok, "{")) {
-        return compoundStmt(Rest, Tok->Next);
+    if(isSym(Tok, SYM_LBRACE)) {
+        return compoundStmt(Rest, nextToken(Tok));
     }
 
     //exprStmt
@@ -197,220 +258,231 @@ static Node* stmt(Token** Rest, Token* Tok) {
 
 // 解析表达式语句
 // exprStmt = expr? ";"
-static Node* exprStmt(Token** Rest, Token* Tok) {
+static NodeId exprStmt(Token** Rest, Token* Tok) {
     // ";" 空语句
-    if(equal(Tok, ";")) {
-        *Rest = Tok->Next;
+    if(isSym(Tok, SYM_SEMI)) {
+        *Rest = nextToken(Tok);
         return newNode(ND_BLOCK);
     }
 
     // expr ";"
-    Node* Nd = newUnary(ND_EXPR_STMT, expr(&Tok, Tok));
-    *Rest = skip(Tok, ";");
+    NodeId Nd = newUnary(ND_EXPR_STMT, expr(&Tok, Tok));
+    *Rest = skipSym(Tok, SYM_SEMI);
     return Nd;
 }
 
-// 解析表达式
-// expr = assign
-static Node* expr(Token **Rest, Token* Tok) {
-    return assign(Rest, Tok);
-}
-
-// 解析赋值
-// assign = equality ("=" assign)?
-static Node* assign(Token **Rest, Token* Tok) {
-    Node* Nd = equality(&Tok, Tok);
-
-    // 可能存在递归赋值，如a=b=1
-    // ("=" assign)?
-    if(equal(Tok, "=")) {
-        Nd = newBinary(ND_ASSIGN, Nd, assign(&Tok, Tok->Next));
+// 二元运算符的优先级，数值越大结合越紧密，0表示不是二元运算符
+static int BinPrec[SYM_NUM] = {
+    [SYM_ASSIGN] = 1,
+    [SYM_EQ] = 2, [SYM_NE] = 2,
+    [SYM_LT] = 3, [SYM_LE] = 3, [SYM_GT] = 3, [SYM_GE] = 3,
+    [SYM_ADD] = 4, [SYM_SUB] = 4,
+    [SYM_MUL] = 5, [SYM_DIV] = 5,
+};
+
+// 一元运算符的优先级，高于所有的二元运算符
+#define UNARY_PREC 6
+
+// 二元运算符对应的节点种类
+// X>Y等于Y<X，X>=Y等于Y<=X，归约时交换左右部
+static NodeKind BinKind[SYM_NUM] = {
+    [SYM_ASSIGN] = ND_ASSIGN,
+    [SYM_EQ] = ND_EQ, [SYM_NE] = ND_NE,
+    [SYM_LT] = ND_LT, [SYM_LE] = ND_LE, [SYM_GT] = ND_LT, [SYM_GE] = ND_LE,
+    [SYM_ADD] = ND_ADD, [SYM_SUB] = ND_SUB,
+    [SYM_MUL] = ND_MUL, [SYM_DIV] = ND_DIV,
+};
+
+// 运算符栈中的运算符
+typedef struct {
+    Symbol Sym; // 运算符，SYM_LPAREN表示尚未闭合的左括号
+    bool Unary; // 是否为前缀的负号
+    char* Loc; // 运算符在源码中的位置，用于报错
+} Op;
+
+// 运算符栈与操作数栈，在多次解析间复用
+static Op* Ops;
+static int OpCnt, OpCap;
+static NodeId* Operands;
+static int OperandCnt, OperandCap;
+
+// 运算符入栈
+static void pushOp(Symbol Sym, bool Unary, char* Loc) {
+    if(OpCnt == OpCap) {
+        OpCap = OpCap ? OpCap * 2 : 64;
+        Ops = realloc(Ops, sizeof(Op) * OpCap);
+        if(!Ops)
+            error("out of memory");
     }
-
-    *Rest = Tok;
-    return Nd;
+    Ops[OpCnt++] = (Op){Sym, Unary, Loc};
 }
 
-// 解析相等性
-// equality = relational ("==" relational | "!=" relational)*
-static Node* equality(Token **Rest, Token* Tok) {
-    // relational
-    Node* Nd = relational(&Tok, Tok);
-
-    //("==" relational | "!=" relational)*
-    while(true) {
-        // "=="
-        if(equal(Tok, "==")) {
-            Nd = newBinary(ND_EQ, Nd, relational(&Tok, Tok->Next));
-            continue;
-        }
-
-        // "!="
-        if(equal(Tok, "!=")) {
-            Nd = newBinary(ND_NE, Nd, relational(&Tok, Tok->Next));
-            continue;
-        }
-
-        *Rest = Tok;
-        return Nd;
+// 操作数入栈
+static void pushOperand(NodeId Nd) {
+    if(OperandCnt == OperandCap) {
+        OperandCap = OperandCap ? OperandCap * 2 : 64;
+        Operands = realloc(Operands, sizeof(NodeId) * OperandCap);
+        if(!Operands)
+            error("out of memory");
     }
+    Operands[OperandCnt++] = Nd;
 }
 
-// 解析比较关系
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-static Node* relational(Token** Rest, Token*Tok) {
-    // add
-    Node* Nd = add(&Tok, Tok);
-
-    //("<" add | "<=" add | ">" add | ">=" add)*
-    while(true) {
-        // "<"
-        if(equal(Tok, "<")) {
-            Nd = newBinary(ND_LT, Nd, add(&Tok, Tok->Next));
-            continue;
-        }
-
-        // "<="
-        if(equal(Tok, "<=")) {
-            Nd = newBinary(ND_LE, Nd, add(&Tok, Tok->Next));
-            continue;
-        }
-
-        // ">"
-        // X>Y等于Y<X
-        if(equal(Tok, ">")) {
-            Nd = newBinary(ND_LT, add(&Tok, Tok->Next), Nd);
-            continue;
-        }
+// 运算符栈顶的优先级，左括号为0，阻止越过它归约
+static int topPrec(void) {
+    Op* Top = &Ops[OpCnt - 1];
+    if(Top->Unary)
+        return UNARY_PREC;
+    return BinPrec[Top->Sym];
+}
 
-        // ">="
-        if(equal(Tok, ">=")) {
-            Nd = newBinary(ND_LE, add(&Tok, Tok->Next), Nd);
-            continue;
-        }
+// 归约：弹出栈顶的运算符，与其操作数组成节点后压回操作数栈
+static void reduce(void) {
+    Op O = Ops[--OpCnt];
 
-        *Rest = Tok;
-        return Nd;
+    // 负号
+    if(O.Unary) {
+        Operands[OperandCnt - 1] = newUnary(ND_NEG, Operands[OperandCnt - 1]);
+        return;
     }
+
+    NodeId RHS = Operands[--OperandCnt];
+    NodeId LHS = Operands[OperandCnt - 1];
+    // 只能对变量赋值，之后的各遍都依赖于此
+    if(O.Sym == SYM_ASSIGN && getNode(LHS)->Kind != ND_VAR)
+        errorAt(O.Loc, "not a lvalue");
+    if(O.Sym == SYM_GT || O.Sym == SYM_GE)
+        Operands[OperandCnt - 1] = newBinary(BinKind[O.Sym], RHS, LHS);
+    else
+        Operands[OperandCnt - 1] = newBinary(BinKind[O.Sym], LHS, RHS);
 }
 
-// 解析加减
-// add = mul ("+" mul | "-" mul)*
-static Node* add(Token** Rest, Token* Tok) {
-    // mul
-    Node* Nd = mul(&Tok, Tok);
+// 解析表达式，按优先级爬升，使用显式的栈代替递归
+// expr = assign
+static NodeId expr(Token **Rest, Token* Tok) {
+    // 本次解析使用的栈底，下方的内容不属于本表达式
+    int OpBase = OpCnt;
+    // 尚未闭合的左括号数
+    int Parens = 0;
 
-    //("+" mul | "-" mul)*
     while(true) {
-        // "+" mul
-        if(equal(Tok, "+")) {
-            Nd = newBinary(ND_ADD, Nd, mul(&Tok, Tok->Next));
-            continue;
+        // 操作数之前的前缀运算符和左括号
+        // ("+" | "-" | "(")*
+        while(true) {
+            // "+" unary，不生成节点
+            if(isSym(Tok, SYM_ADD)) {
+                Tok = nextToken(Tok);
+                continue;
+            }
+            // "-" unary
+            if(isSym(Tok, SYM_SUB)) {
+                pushOp(SYM_SUB, true, Tok->Loc);
+                Tok = nextToken(Tok);
+                continue;
+            }
+            // "(" expr ")"
+            if(isSym(Tok, SYM_LPAREN)) {
+                pushOp(SYM_LPAREN, false, Tok->Loc);
+                Parens++;
+                Tok = nextToken(Tok);
+                continue;
+            }
+            break;
         }
 
-        // "-" mul
-        if(equal(Tok, "-")) {
-            Nd = newBinary(ND_SUB, Nd, mul(&Tok, Tok->Next));
-            continue;
-        }
+        // ident | num
+        pushOperand(primary(&Tok, Tok));
 
-        *Rest = Tok;
-        return Nd;
-    }
-}
-
-// 解析乘除
-// mul = unary("*" unary | "/" unary)*
-static Node* mul(Token** Rest, Token* Tok) {
-    // unary 
-    Node* Nd = unary(&Tok, Tok);
-
-    //("*" unary | "/" unary)*
-    while(true) {
-        // "*" unary
-        if(equal(Tok, "*")) {
-            Nd = newBinary(ND_MUL, Nd, unary(&Tok, Tok->Next));
-            continue;
+        // 右括号：归约到对应的左括号为止
+        while(Parens > 0 && isSym(Tok, SYM_RPAREN)) {
+            while(Ops[OpCnt - 1].Sym != SYM_LPAREN)
+                reduce();
+            OpCnt--;
+            Parens--;
+            Tok = nextToken(Tok);
         }
 
-        // "/" unary
-        if(equal(Tok, "/")) {
-            Nd = newBinary(ND_DIV, Nd, unary(&Tok, Tok->Next));
-            continue;
+        // 不是二元运算符，表达式结束
+        int Prec = BinPrec[Tok->Sym];
+        if(!Prec) {
+            if(Parens > 0)
+                errorTok(Tok, "expect ')'");
+            break;
         }
 
-        *Rest = Tok;
-        return Nd;
+        // 归约优先级更高的运算符，同级的左结合运算符也先归约
+        // 赋值为右结合，可能存在递归赋值，如a=b=1
+        while(OpCnt > OpBase) {
+            int Top = topPrec();
+            if(Top < Prec || (Top == Prec && Tok->Sym == SYM_ASSIGN))
+                break;
+            reduce();
+        }
+        pushOp(Tok->Sym, false, Tok->Loc);
+        Tok = nextToken(Tok);
     }
-}
 
-// 解析一元运算
-// unary = ("+" | "-") unary | primary
-static Node* unary(Token** Rest, Token* Tok) {
-    // "+" unary
-    if(equal(Tok, "+"))
-        return unary(Rest, Tok->Next);
+    while(OpCnt > OpBase)
+        reduce();
 
-    // "-" unary
-    if(equal(Tok, "-"))
-        return newUnary(ND_NEG, unary(Rest, Tok->Next));
-
-    // primary
-    return primary(Rest, Tok);
+    *Rest = Tok;
+    return Operands[--OperandCnt];
 }
 
-// 解析括号、数字、标识符
-// primary = "(" expr ")" | ident | num
-static Node* primary(Token** Rest, Token* Tok) {
-    // "(" expr ")"
-    if(equal(Tok, "(")) {
-        Node* Nd = expr(&Tok, Tok->Next);
-        // 这里实际上完成了Tok=Tok->Next->Next->*, 前面进行了多次递归调用，Rest
-        // 的值都没有发生改变在最底层的rule中进行更新
-        *Rest = skip(Tok, ")");
-        return Nd;
-    }
-
+// 解析数字、标识符，括号由expr处理
+// primary = ident | num
+static NodeId primary(Token** Rest, Token* Tok) {
     // ident
     if(Tok->Kind == TK_IDENT) {
         // 查找变量
         Obj* Var = findVar(Tok);
-        // strndup复制N个字符
         if(!Var)
-            Var = newLVar(strndup(Tok->Loc, Tok->Len));
+            Var = newLVar(Tok->Loc, Tok->Len);
 
-        *Rest = Tok->Next;
+        *Rest = nextToken(Tok);
         return newVarNode(Var);
     }
 
     if(Tok->Kind == TK_NUM) {
-        Node* Nd = newNum(Tok->Val);
+        NodeId Nd = newNum(Tok->Val);
         // 这里实际上完成了Tok=Tok->Next->Next->*, 前面进行了多次递归调用，Rest
         // 的值都没有发生改变在最底层的rule中进行更新
-        *Rest = Tok->Next;
+        *Rest = nextToken(Tok);
         return Nd;
     }
 
     errorTok(Tok, "expected an expression");
-    return NULL;
+    return 0;
 }
 
 // 语法解析入口函数
 // program = stmt*
 Function *parse(Token *Tok) {
-    Node Head = {};
-    Node* Cur = &Head;
+    NodeId Head = 0, Tail = 0;
+
+    // 终结符是按需读取的，无法预知变量数，哈希表随变量的增加而扩容
+    initVarTable(64);
+    Locals = NULL;
 
     // stmt*
-    while(Tok->Kind != TK_EOF) {
-        Cur->Next = stmt(&Tok, Tok);
-        Cur = Cur->Next;
-    }
+    while(Tok->Kind != TK_EOF)
+        appendStmt(&Head, &Tail, stmt(&Tok, Tok));
 
     // 函数体存储语句的AST，Locals存储变量
-    Function* Prog = calloc(1, sizeof(Function));
-    Prog->Body = Head.Next;
+    // 将所有语句包装为一个代码块，使codegen能够生成全部语句
+    Function* Prog = arenaAlloc(sizeof(Function));
+    Prog->Body = newNode(ND_BLOCK);
+    getNode(Prog->Body)->Body = Head;
     Prog->Locals = Locals;
 
+    // 哈希表与表达式的栈仅在解析期间使用
+    free(VarTable);
+    VarTable = NULL;
+    free(Ops);
+    free(Operands);
+    Ops = NULL;
+    Operands = NULL;
+    OpCap = OperandCap = 0;
+
     return Prog;
 }
\ No newline at end of file
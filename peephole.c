@@ -0,0 +1,510 @@
+#include "rvcc.h"
+
+// 窥孔优化：在代码生成得到的指令列表上，用一组规则反复改写相邻或相近的指令，
+// 直到没有规则可以生效为止
+//
+// 规则依赖寄存器的活跃信息，判断改写后被删除的值之后是否还会被读取。
+// 活跃信息在每一遍开始前计算，一遍中某条规则生效后，从被改写的最后一条指令之后
+// 继续匹配，使后续规则不会使用被改写区域中过时的活跃信息
+
+// 规则
+typedef enum {
+    PH_SELF_MOVE, // mv x, x => 删除
+    PH_ADDI_ZERO, // addi x, x, 0 => 删除
+    PH_JUMP_NEXT, // 跳转到紧随其后的标签 => 删除
+    PH_DEAD_DEF, // 结果不再被读取的运算 => 删除
+    PH_SPILL_RELOAD, // 压栈后立即弹栈 => mv
+    PH_STORE_LOAD, // 存储后立即从同一地址读取 => mv
+    PH_FOLD_MOVE, // op y, ...; mv x, y => op x, ...
+    PH_IMM_OPERAND, // li x, N; ...; add rd, y, x => addi rd, y, N
+    PH_ADDR_FOLD, // addi x, fp, N; ...; ld rd, 0(x) => ld rd, N(fp)
+    PH_COPY_PROP, // mv x, y; ...; add rd, rd, x => add rd, rd, y
+    PH_NUM,
+} Rule;
+
+// 规则的名称，用于输出统计
+static char* RuleNames[PH_NUM] = {
+    [PH_SELF_MOVE] = "self-move",
+    [PH_ADDI_ZERO] = "addi-zero",
+    [PH_JUMP_NEXT] = "jump-next",
+    [PH_DEAD_DEF] = "dead-def",
+    [PH_SPILL_RELOAD] = "spill-reload",
+    [PH_STORE_LOAD] = "store-load",
+    [PH_FOLD_MOVE] = "fold-move",
+    [PH_IMM_OPERAND] = "imm-operand",
+    [PH_ADDR_FOLD] = "addr-fold",
+    [PH_COPY_PROP] = "copy-prop",
+};
+
+// 每条规则生效的次数
+static long RuleCnt[PH_NUM];
+// 优化前后的指令数，不含标签与注释
+static long InstsBefore, InstsAfter;
+// 进行的遍数
+static int Passes;
+
+// 向前查找使用者时最多检查的指令数，避免在很长的表达式中退化为平方级
+#define SCAN_LIMIT 32
+
+// 规则最多进行的遍数
+#define MAX_PASSES 16
+
+// 寄存器Reg对应的位
+#define BIT(Reg) (1u << (Reg))
+
+// 始终视为活跃的寄存器，对它们的写入不会被删除或改写
+#define ALWAYS_LIVE (BIT(R_ZERO) | BIT(R_RA) | BIT(R_SP) | BIT(R_FP))
+
+// 被调用者保存的寄存器s0~s11
+#define CALLEE_SAVED (BIT(R_FP) | BIT(sReg(1)) | (0x3ffu << sReg(2)))
+
+// 当前处理的指令
+static Inst* Code;
+static int Len;
+
+// 每条指令之后活跃的寄存器集合
+static uint32_t* LiveOut;
+// 每条指令之前活跃的寄存器集合
+static uint32_t* LiveIn;
+// 标签编号对应的指令下标
+static int* LabelPos;
+static int64_t LabelCap;
+
+// 是否为跳转、返回等改变控制流的指令
+static bool isBranch(Inst* I) {
+    return I->Kind == RV_J || I->Kind == RV_RET || isCondBranch(I);
+}
+
+// 指令写入的寄存器，没有写入时返回-1
+static int defReg(Inst* I) {
+    switch(I->Kind) {
+    case RV_ADD: case RV_SUB: case RV_MUL: case RV_DIV: case RV_XOR:
+    case RV_SLT: case RV_ADDI: case RV_XORI: case RV_SLTI: case RV_NEG:
+    case RV_SEQZ: case RV_SNEZ: case RV_MV: case RV_LI: case RV_LUI:
+    case RV_LD:
+        return I->Rd;
+    default:
+        return -1;
+    }
+}
+
+// 指令读取的寄存器集合
+static uint32_t useMask(Inst* I) {
+    switch(I->Kind) {
+    case RV_ADD: case RV_SUB: case RV_MUL: case RV_DIV: case RV_XOR:
+    case RV_SLT: case RV_SD: case RV_BEQ: case RV_BNE: case RV_BLT:
+    case RV_BGE:
+        return BIT(I->Rs1) | BIT(I->Rs2);
+    case RV_ADDI: case RV_XORI: case RV_SLTI: case RV_NEG: case RV_SEQZ:
+    case RV_SNEZ: case RV_MV: case RV_LD: case RV_BEQZ: case RV_BNEZ:
+        return BIT(I->Rs1);
+    case RV_RET:
+        // 返回值存放在a0中，被调用者保存的寄存器在返回后仍被调用者使用
+        return BIT(R_A0) | CALLEE_SAVED;
+    default:
+        return 0;
+    }
+}
+
+// 是否为没有副作用的运算，结果不被读取时可以删除
+static bool isPureDef(Inst* I) {
+    int Rd = defReg(I);
+    return Rd >= 0 && !(BIT(Rd) & ALWAYS_LIVE);
+}
+
+// 从I开始，跳过注释与已删除的指令，返回下一条指令的下标
+static int skipNops(int I) {
+    while(I < Len && (Code[I].Kind == RV_COMMENT || Code[I].Kind == RV_NOP))
+        I++;
+    return I;
+}
+
+// 寄存器Reg在指令K之后是否不再活跃
+// 指令K重新写入Reg时，之后活跃的是新值
+static bool deadAfter(int K, int Reg) {
+    return !(LiveOut[K] & BIT(Reg)) || defReg(&Code[K]) == Reg;
+}
+
+// 记录所有标签所在的位置
+void findLabels(Inst* Code, int Len, int** Pos, int64_t* Cap) {
+    int64_t Max = 0;
+    for(int I = 0; I < Len; I++)
+        if(Code[I].Kind == RV_LABEL && Code[I].Imm > Max)
+            Max = Code[I].Imm;
+
+    if(Max >= *Cap) {
+        *Cap = Max + 1;
+        *Pos = realloc(*Pos, sizeof(int) * *Cap);
+        if(!*Pos)
+            error("out of memory");
+    }
+    for(int I = 0; I < Len; I++)
+        if(Code[I].Kind == RV_LABEL)
+            (*Pos)[Code[I].Imm] = I;
+}
+
+// 反向数据流分析，计算每条指令前后活跃的寄存器
+// 循环使数据流存在回边，因此迭代直到不再变化
+static void computeLiveness(void) {
+    findLabels(Code, Len, &LabelPos, &LabelCap);
+
+    for(int I = 0; I < Len; I++)
+        LiveIn[I] = LiveOut[I] = 0;
+
+    bool Changed = true;
+    while(Changed) {
+        Changed = false;
+        for(int I = Len - 1; I >= 0; I--) {
+            Inst* In = &Code[I];
+            uint32_t Next = I + 1 < Len ? LiveIn[I + 1] : 0;
+            uint32_t Out;
+            if(In->Kind == RV_J)
+                Out = LiveIn[LabelPos[In->Imm]];
+            else if(isCondBranch(In))
+                Out = Next | LiveIn[LabelPos[In->Imm]];
+            else if(In->Kind == RV_RET)
+                Out = 0;
+            else
+                Out = Next;
+            Out |= ALWAYS_LIVE;
+
+            // 指令之前活跃的为读取的寄存器，以及之后活跃且未被写入的寄存器
+            int Rd = defReg(In);
+            uint32_t Live = useMask(In) | (Rd >= 0 ? Out & ~BIT(Rd) : Out);
+
+            if(Out != LiveOut[I] || Live != LiveIn[I]) {
+                LiveOut[I] = Out;
+                LiveIn[I] = Live;
+                Changed = true;
+            }
+        }
+    }
+}
+
+// 从I之后查找第一条读取Reg的指令，返回其下标
+// 途中经过标签或跳转、Reg被改写、或Keep中的寄存器被改写时，返回-1
+static int findUse(int I, int Reg, uint32_t Keep) {
+    int Scanned = 0;
+    for(int J = skipNops(I + 1); J < Len && Scanned < SCAN_LIMIT;
+        J = skipNops(J + 1), Scanned++) {
+        Inst* In = &Code[J];
+        if(useMask(In) & BIT(Reg))
+            return In->Kind == RV_RET ? -1 : J;
+        if(isPseudo(In) || isBranch(In))
+            return -1;
+        int Rd = defReg(In);
+        if(Rd == Reg || (Rd >= 0 && (BIT(Rd) & Keep)))
+            return -1;
+    }
+    return -1;
+}
+
+// 删除结果不被使用的指令
+static int ruleDeadDef(int I) {
+    Inst* A = &Code[I];
+    if(!isPureDef(A) || (LiveOut[I] & BIT(A->Rd)))
+        return -1;
+    killInst(&Code[I]);
+    return I;
+}
+
+// mv x, x => 删除
+static int ruleSelfMove(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_MV || A->Rd != A->Rs1)
+        return -1;
+    killInst(&Code[I]);
+    return I;
+}
+
+// addi x, x, 0 => 删除
+static int ruleAddiZero(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_ADDI || A->Rd != A->Rs1 || A->Imm != 0)
+        return -1;
+    killInst(&Code[I]);
+    return I;
+}
+
+// j L后紧跟着标签L，跳转是多余的
+static int ruleJumpNext(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_J)
+        return -1;
+    for(int J = I + 1; J < Len && isPseudo(&Code[J]); J++) {
+        if(Code[J].Kind == RV_LABEL && Code[J].Imm == A->Imm) {
+            killInst(&Code[I]);
+            return I;
+        }
+    }
+    return -1;
+}
+
+// addi sp, sp, -8; sd r, 0(sp); ld r2, 0(sp); addi sp, sp, 8 => mv r2, r
+static int ruleSpillReload(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_ADDI || A->Rd != R_SP || A->Rs1 != R_SP || A->Imm != -8)
+        return -1;
+
+    int J = skipNops(I + 1);
+    int K = J < Len ? skipNops(J + 1) : Len;
+    int L = K < Len ? skipNops(K + 1) : Len;
+    if(L >= Len)
+        return -1;
+
+    Inst* B = &Code[J];
+    Inst* C = &Code[K];
+    Inst* D = &Code[L];
+    if(B->Kind != RV_SD || B->Rs1 != R_SP || B->Imm != 0 || B->Rs2 == R_SP ||
+       C->Kind != RV_LD || C->Rs1 != R_SP || C->Imm != 0 ||
+       D->Kind != RV_ADDI || D->Rd != R_SP || D->Rs1 != R_SP || D->Imm != 8)
+        return -1;
+
+    int Src = B->Rs2;
+    int Dst = C->Rd;
+    killInst(&Code[J]);
+    killInst(&Code[K]);
+    killInst(&Code[L]);
+    A->Kind = RV_MV;
+    A->Rd = Dst;
+    A->Rs1 = Src;
+    A->Imm = 0;
+    return L;
+}
+
+// sd r, N(b); ld r2, N(b) => sd r, N(b); mv r2, r
+static int ruleStoreLoad(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_SD)
+        return -1;
+    int J = skipNops(I + 1);
+    if(J >= Len)
+        return -1;
+
+    Inst* B = &Code[J];
+    if(B->Kind != RV_LD || B->Rs1 != A->Rs1 || B->Imm != A->Imm)
+        return -1;
+
+    B->Kind = RV_MV;
+    B->Rs1 = A->Rs2;
+    B->Imm = 0;
+    return J;
+}
+
+// op y, ...; mv x, y => op x, ...，y之后不再被读取
+static int ruleFoldMove(int I) {
+    Inst* A = &Code[I];
+    if(!isPureDef(A))
+        return -1;
+    int J = skipNops(I + 1);
+    if(J >= Len)
+        return -1;
+
+    Inst* B = &Code[J];
+    if(B->Kind != RV_MV || B->Rs1 != A->Rd || B->Rd == A->Rd ||
+       !deadAfter(J, A->Rd))
+        return -1;
+
+    A->Rd = B->Rd;
+    killInst(&Code[J]);
+    return J;
+}
+
+// li x, N; ...; op rd, y, x => opi rd, y, N，x之后不再被读取
+static int ruleImmOperand(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_LI || !isPureDef(A))
+        return -1;
+
+    int X = A->Rd;
+    int64_t N = A->Imm;
+    int K = findUse(I, X, 0);
+    if(K < 0 || !deadAfter(K, X))
+        return -1;
+
+    Inst* B = &Code[K];
+    // 另一个操作数
+    int Y = B->Rs1 == X ? B->Rs2 : B->Rs1;
+    switch(B->Kind) {
+    case RV_ADD:
+    case RV_XOR:
+        // 满足交换律，x可以是任一个操作数
+        if(Y == X || !isImm12(N))
+            return -1;
+        B->Kind = B->Kind == RV_ADD ? RV_ADDI : RV_XORI;
+        B->Rs1 = Y;
+        break;
+    case RV_SUB:
+        if(B->Rs2 != X || B->Rs1 == X || !isImm12(-N))
+            return -1;
+        B->Kind = RV_ADDI;
+        N = -N;
+        break;
+    case RV_SLT:
+        if(B->Rs2 != X || B->Rs1 == X || !isImm12(N))
+            return -1;
+        B->Kind = RV_SLTI;
+        break;
+    case RV_MV:
+        B->Kind = RV_LI;
+        break;
+    default:
+        return -1;
+    }
+
+    B->Rs2 = 0;
+    B->Imm = N;
+    killInst(&Code[I]);
+    return K;
+}
+
+// addi x, b, N; ...; ld rd, M(x) => ld rd, N+M(b)，x之后不再被读取
+static int ruleAddrFold(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_ADDI || !isPureDef(A) || A->Rd == A->Rs1)
+        return -1;
+
+    int X = A->Rd;
+    int K = findUse(I, X, BIT(A->Rs1));
+    if(K < 0 || !deadAfter(K, X))
+        return -1;
+
+    Inst* B = &Code[K];
+    if((B->Kind != RV_LD && B->Kind != RV_SD) || B->Rs1 != X ||
+       !isImm12(B->Imm + A->Imm))
+        return -1;
+    // 存储的值本身就是地址时不能折叠
+    if(B->Kind == RV_SD && B->Rs2 == X)
+        return -1;
+
+    B->Rs1 = A->Rs1;
+    B->Imm += A->Imm;
+    killInst(&Code[I]);
+    return K;
+}
+
+// mv x, y; ...; op rd, x, ... => op rd, y, ...，x之后不再被读取
+static int ruleCopyProp(int I) {
+    Inst* A = &Code[I];
+    if(A->Kind != RV_MV || !isPureDef(A) || A->Rd == A->Rs1)
+        return -1;
+
+    int X = A->Rd;
+    int Y = A->Rs1;
+    int K = findUse(I, X, BIT(Y));
+    if(K < 0 || !deadAfter(K, X))
+        return -1;
+
+    Inst* B = &Code[K];
+    uint32_t Use = useMask(B);
+    if(B->Rs1 == X && (Use & BIT(B->Rs1)))
+        B->Rs1 = Y;
+    if(B->Rs2 == X && (Use & BIT(B->Rs2)))
+        B->Rs2 = Y;
+    killInst(&Code[I]);
+    return K;
+}
+
+// 规则的匹配函数，生效时返回被改写的最后一条指令的下标，否则返回-1
+typedef int (*RuleFn)(int I);
+
+// 按顺序尝试的规则
+static struct {
+    Rule Id;
+    RuleFn Fn;
+} Rules[] = {
+    {PH_SELF_MOVE, ruleSelfMove},
+    {PH_ADDI_ZERO, ruleAddiZero},
+    {PH_JUMP_NEXT, ruleJumpNext},
+    {PH_DEAD_DEF, ruleDeadDef},
+    {PH_SPILL_RELOAD, ruleSpillReload},
+    {PH_STORE_LOAD, ruleStoreLoad},
+    {PH_FOLD_MOVE, ruleFoldMove},
+    {PH_IMM_OPERAND, ruleImmOperand},
+    {PH_ADDR_FOLD, ruleAddrFold},
+    {PH_COPY_PROP, ruleCopyProp},
+};
+
+// 统计不含标签与注释的指令数
+static long countInsts(void) {
+    long N = 0;
+    for(int I = 0; I < Len; I++)
+        if(!isPseudo(&Code[I]))
+            N++;
+    return N;
+}
+
+// 移除已删除的指令
+int compactInsts(Inst* Code, int Len) {
+    int N = 0;
+    for(int I = 0; I < Len; I++)
+        if(Code[I].Kind != RV_NOP)
+            Code[N++] = Code[I];
+    return N;
+}
+
+// 进行一遍改写，返回是否有规则生效
+static bool runPass(void) {
+    computeLiveness();
+
+    bool Changed = false;
+    for(int I = 0; I < Len; I++) {
+        if(isPseudo(&Code[I]))
+            continue;
+
+        for(size_t R = 0; R < sizeof(Rules) / sizeof(*Rules); R++) {
+            int Last = Rules[R].Fn(I);
+            if(Last < 0)
+                continue;
+            RuleCnt[Rules[R].Id]++;
+            Changed = true;
+            // 被改写区域的活跃信息已过时，从其后继续
+            I = Last;
+            break;
+        }
+    }
+
+    Len = compactInsts(Code, Len);
+    return Changed;
+}
+
+// 在指令列表上进行窥孔优化
+void peephole(InstList* L) {
+    Code = L->Data;
+    Len = L->Len;
+    LiveOut = calloc(Len, sizeof(uint32_t));
+    LiveIn = calloc(Len, sizeof(uint32_t));
+    if(Len && (!LiveOut || !LiveIn))
+        error("out of memory");
+
+    InstsBefore += countInsts();
+    for(int I = 0; I < MAX_PASSES; I++) {
+        Passes++;
+        if(!runPass())
+            break;
+    }
+    InstsAfter += countInsts();
+
+    L->Len = Len;
+    free(LiveOut);
+    free(LiveIn);
+    free(LabelPos);
+    LiveOut = LiveIn = NULL;
+    LabelPos = NULL;
+    LabelCap = 0;
+}
+
+// 输出每条规则生效的次数
+void peepholeReport(FILE* Out) {
+    if(!Passes) {
+        fprintf(Out, "peephole: disabled\n");
+        return;
+    }
+    fprintf(Out, "peephole: %ld -> %ld instructions", InstsBefore, InstsAfter);
+    if(InstsBefore)
+        fprintf(Out, " (-%.1f%%)",
+                100.0 * (InstsBefore - InstsAfter) / InstsBefore);
+    fprintf(Out, ", %d passes\n", Passes);
+    for(int I = 0; I < PH_NUM; I++)
+        fprintf(Out, "  %-14s %ld\n", RuleNames[I], RuleCnt[I]);
+}
@@ -7,8 +7,23 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <assert.h>
+#include <errno.h>
+
+//
+// 内存池
+//
+
+// 从内存池中分配已清零的内存
+void* arenaAlloc(size_t Size);
+// 一次性释放内存池中的全部对象
+void arenaFree(void);
+// 已从内存池分配的字节数
+size_t arenaBytesUsed(void);
+// 在容量为*Cap的malloc数组中预留第Len个元素的位置，返回扩容后的数组
+void* growList(void* Arr, int Len, int* Cap, size_t Size);
 
 //
 // 终结符分析，词法分析
@@ -23,25 +38,79 @@ typedef enum {
     TK_EOF, //终止符
 } TokenKind;
 
+// 操作符与关键字的编号，词法分析时确定，
+// 解析器通过比较编号来匹配终结符，无需比较字符串
+typedef enum {
+    SYM_NONE, // 不是已知的操作符或关键字
+    SYM_ADD, // +
+    SYM_SUB, // -
+    SYM_MUL, // *
+    SYM_DIV, // /
+    SYM_EQ, // ==
+    SYM_NE, // !=
+    SYM_LT, // <
+    SYM_LE, // <=
+    SYM_GT, // >
+    SYM_GE, // >=
+    SYM_ASSIGN, // =
+    SYM_LPAREN, // (
+    SYM_RPAREN, // )
+    SYM_LBRACE, // {
+    SYM_RBRACE, // }
+    SYM_SEMI, // ;
+    SYM_RETURN, // "return"
+    SYM_IF, // "if"
+    SYM_ELSE, // "else"
+    SYM_FOR, // "for"
+    SYM_WHILE, // "while"
+    SYM_NUM, // 编号的总数
+} Symbol;
+
 typedef struct Token Token;
 struct Token {
     TokenKind Kind; //终结符种类
-    Token* Next; //指向下一终结符
-    int Val; //值
-    char* Loc; //字符串中的位置
+    Symbol Sym; //操作符或关键字的编号
+    int Idx; //在输入中的序号
     int Len; //长度
+    int64_t Val; //值
+    char* Loc; //字符串中的位置
 };
 
 // 去除了static用以在多个文件间访问
-// 报错函数
-void error(char *Fmt, ...);
-void errorAt(char *Loc, char *Fmt, ...);
-void errorTok(Token *Tok, char *Fmt, ...);
-// 判断Token与Str的关系
+// 报错函数，报错后不再返回
+_Noreturn void error(char *Fmt, ...);
+_Noreturn void errorAt(char *Loc, char *Fmt, ...);
+_Noreturn void errorTok(Token *Tok, char *Fmt, ...);
+// 出错后终止程序，AbortOnError为真时以SIGABRT终止，否则以状态1退出
+extern bool AbortOnError;
+_Noreturn void die(void);
+// 计算Loc开始的Len个字节的FNV-1a哈希值，用于变量名与标签名的哈希表
+uint32_t hashBytes(char* Loc, int Len);
+// 判断Token与Str的关系，需比较字符串，解析器应使用isSym与skipSym
 bool equal(Token *Tok, char *Str);
 Token *skip(Token *Tok, char *Str);
-// 词法分析
+// 判断Tok是否为操作符或关键字Sym
+static inline bool isSym(Token *Tok, Symbol Sym) {
+    return Tok->Sym == Sym;
+}
+// 跳过操作符或关键字Sym，不匹配时报错
+Token *skipSym(Token *Tok, Symbol Sym);
+// 词法分析中扫描连续字符的实现
+typedef enum {
+    LEX_AUTO, // 根据CPU自动选择
+    LEX_SCALAR, // 逐字节扫描
+    LEX_SSE2, // 每次扫描16字节
+    LEX_AVX2, // 每次扫描32字节
+} LexImpl;
+
+// 选择扫描的实现，返回实际使用的实现
+LexImpl lexSelectImpl(LexImpl Impl);
+// 词法分析，返回第一个终结符
 Token *tokenize(char *Input);
+// 按需读取下一个终结符
+Token *nextToken(Token *Tok);
+// 本次词法分析已生成的终结符数
+int tokenCount(void);
 
 //
 // 生成AST（抽象语法树），语法解析
@@ -70,47 +139,492 @@ typedef enum {
 
 typedef struct Node Node;
 
+// AST节点的编号，即节点在节点池中的下标，0表示空节点
+typedef uint32_t NodeId;
+
 // 本地变量
 typedef struct Obj Obj;
 struct Obj {
     Obj* Next; // 指向下一对象
-    char* Name; // 变量名
+    char* Name; // 变量名，指向源代码中的位置，不以'\0'结尾
+    int Len; // 变量名的长度
     int Offset; // fp的偏移量
+    int Reg; // 分配到的被调用者保存寄存器s1~s11的编号，0表示存放在栈中
+    int UseCnt; // 按循环嵌套加权的使用次数，用于寄存器分配
+    int Refs; // 在函数中出现的次数，用于循环优化
+    uint32_t Mark; // 等于循环优化中当前循环的编号时，表示在该循环中被赋值
+    int Id; // 变量的编号，构造SSA时使用
 };
 
-// AST中二叉树节点
+// AST中二叉树节点，子节点以编号表示
+// 各种类只使用部分字段，共用同一位置，节点大小为24字节
 struct Node {
     NodeKind Kind; //种类
-    Node* Next; // 下一语句
-
-    Node* LHS; //左部
-    Node* RHS; //右部
+    NodeId Next; // 下一语句
 
-    Node* Cond; //条件内表达式
-    Node* Then; //符合条件后的语句
-    Node* Els; //不符合条件后的语句
-    Node* Init; //for中初始化语句
-    Node* Inc; //for中自增语句
+    union {
+        NodeId LHS; //左部
+        NodeId Cond; //ND_IF、ND_FOR中的条件内表达式
+        NodeId Body; //ND_BLOCK中的第一条语句
+    };
+    union {
+        NodeId RHS; //右部
+        NodeId Then; //ND_IF、ND_FOR中符合条件后的语句
+    };
 
-    Node* Body; //代码块
-    Obj* Var; //存储ND_VAR的种类
-    int Val; //ND_NUM种类的值
+    union {
+        Obj* Var; //存储ND_VAR的种类
+        int64_t Val; //ND_NUM种类的值
+        uint32_t Ext; //ND_IF、ND_FOR在附加表中的下标，0表示没有附加字段
+    };
 };
 
+// 节点中不常用的字段，存放在附加表中
+typedef struct {
+    NodeId Els; //ND_IF中不符合条件后的语句
+    NodeId Init; //ND_FOR中初始化语句
+    NodeId Inc; //ND_FOR中自增语句
+} NodeExt;
+
+// 节点池，所有节点连续存放，下标0为空节点
+extern Node* Nodes;
+// 附加表，下标0为全空的附加字段
+extern NodeExt* NodeExts;
+
+// 新建一个节点，返回其编号
+// 节点池可能因此扩容，之前通过getNode得到的指针随之失效
+NodeId newNode(NodeKind Kind);
+// 为节点分配附加字段，返回附加字段
+NodeExt* newNodeExt(NodeId Id);
+// 释放节点池与附加表
+void nodePoolFree(void);
+// 节点池与附加表占用的字节数
+size_t nodePoolBytes(void);
+// 已分配的节点数，包括下标0的空节点
+uint32_t nodeCount(void);
+
+// 通过编号得到节点
+static inline Node* getNode(NodeId Id) {
+    return &Nodes[Id];
+}
+
+// 得到节点的附加字段，没有附加字段时为全空
+static inline NodeExt* getExt(Node* Nd) {
+    return &NodeExts[Nd->Ext];
+}
+
+// 遍历节点时使用的显式栈，代替递归，由malloc分配
+// 也可以作为按压入顺序存放的节点列表，以Data[0..Top)访问
+typedef struct {
+    NodeId* Data;
+    int Top, Cap;
+} WorkStack;
+
+// 将节点压入遍历栈，空节点不入栈
+void pushNode(WorkStack* S, NodeId Id);
+// 释放遍历栈
+void freeWorkStack(WorkStack* S);
+
+// 弹出遍历栈顶的节点，栈不能为空
+static inline NodeId popNode(WorkStack* S) {
+    return S->Data[--S->Top];
+}
+
+// SSA形式的函数体
+typedef struct IRFunc IRFunc;
+
 //函数
 typedef struct Function Function;
 struct Function {
-    Node* Body; //函数体
+    NodeId Body; //函数体
     Obj* Locals; //本地变量
     int StackSize; //栈大小
+    IRFunc* IR; // SSA形式的函数体，不为NULL时由它生成代码
 };
 
 // 语法解析入口函数
 Function* parse(Token *Tok);
+// 新建节点，优化时改写AST也使用
+NodeId newBinary(NodeKind Kind, NodeId LHS, NodeId RHS);
+NodeId newNum(int64_t Val);
+NodeId newVarNode(Obj* Var);
+
+//
+// AST优化
+//
+
+// 优化入口函数，进行常量折叠、代数化简与死代码删除，
+// 优化级别大于0时再进行循环优化与无用赋值的删除
+void optimize(Function *Prog);
+// 判断两个表达式在结构上是否相同
+bool sameExpr(NodeId X, NodeId Y);
+// 判断表达式是否没有副作用，即不包含赋值
+bool isPure(NodeId Root);
+
+//
+// 死代码删除
+//
+
+// 删除不会执行到的语句、没有副作用的表达式语句与条件为常量的分支
+void eliminateDeadCode(Function* Prog);
+// 删除SSA中没有被使用的值
+void eliminateDeadValues(IRFunc* F);
+// 输出每种删除进行的次数
+void dceReport(FILE* Out);
+
+//
+// 循环优化
+//
+
+// 对函数中的循环进行不变量外提、归纳变量的强度削弱与删除
+void optimizeLoops(Function* Prog);
+// 输出每种优化进行的次数
+void loopReport(FILE* Out);
+
+//
+// 活跃变量分析
+//
+
+// 删除赋值后不会被读取的赋值
+void eliminateDeadStores(Function* Prog);
+// 为位于栈中的变量分配偏移量，存活范围不相交的变量共用栈槽，栈槽位于fp-Base之下
+// 返回栈槽占用的字节数，变量过多而未分析时返回-1
+int shareStackSlots(Function* Prog, int Base);
+// 输出删除的赋值数与共用栈槽的效果
+void liveReport(FILE* Out);
+
+//
+// SSA中间表示
+//
+
+// 函数体降低为由基本块组成的控制流图，每个值只被定义一次，
+// 控制流汇合处以phi合并来自不同前驱的值
+
+// 值的种类
+typedef enum {
+    IR_CONST, // 常量
+    IR_ADD, // +
+    IR_SUB, // -
+    IR_MUL, // *
+    IR_DIV, // /
+    IR_NEG, // 负号
+    IR_EQ, // ==
+    IR_NE, // !=
+    IR_LT, // <
+    IR_LE, // <=
+    IR_PHI, // phi，第I个参数为从第I个前驱进入时的值
+    IR_VAR_GET, // 读取变量，仅在构造SSA期间存在
+    IR_VAR_SET, // 写入变量，仅在构造SSA期间存在
+    IR_JMP, // 跳转到Succs[0]
+    IR_BR, // 参数不为0时跳转到Succs[0]，否则跳转到Succs[1]
+    IR_RET, // 返回参数的值
+} IROp;
+
+typedef struct IRValue IRValue;
+typedef struct IRBlock IRBlock;
+
+// 值，即一条指令的结果
+struct IRValue {
+    IROp Op; // 种类
+    int Id; // 编号，按基本块与指令的顺序排列
+    IRBlock* Block; // 所在的基本块，已删除时为NULL
+    IRValue* Prev; // 基本块中的上一条指令
+    IRValue* Next; // 基本块中的下一条指令
+    IRValue** Args; // 参数，即使用的值
+    int NumArgs; // 参数的数量
+    IRValue** Users; // 使用该值的指令，多次使用时出现多次
+    int NumUsers;
+    int CapUsers;
+    union {
+        int64_t Val; // IR_CONST的值
+        Obj* Var; // IR_PHI、IR_VAR_GET、IR_VAR_SET对应的变量
+    };
+};
+
+// 基本块
+struct IRBlock {
+    int Id; // 编号，即在逆后序中的位置
+    IRValue* First; // 第一条指令，phi都在最前面
+    IRValue* Last; // 最后一条指令，为跳转或返回
+    IRBlock** Preds; // 前驱
+    int NumPreds;
+    int CapPreds;
+    IRBlock* Succs[2]; // 后继
+    int NumSuccs;
+    IRBlock* IDom; // 直接支配者，入口块为NULL
+    IRBlock** DF; // 支配边界
+    int NumDF;
+    int CapDF;
+    int DomPre; // 支配树前序遍历的序号
+    int DomPost; // 支配树后序遍历的序号
+    int Mark; // 遍历时的标记
+};
+
+// SSA形式的函数体
+struct IRFunc {
+    IRBlock** Blocks; // 按逆后序排列的基本块，第一个为入口块
+    int NumBlocks;
+    int NumValues; // 值的编号的上界
+};
+
+// 将函数体降低为SSA形式，得到的控制流图中没有关键边
+IRFunc* irBuild(Function* Prog);
+// 检查SSA形式的正确性，发现错误时报错退出
+void irVerify(IRFunc* F);
+// 以文本形式输出
+void irPrint(IRFunc* F, FILE* Out);
+// 判断基本块A是否支配B
+bool irDominates(IRBlock* A, IRBlock* B);
+// 将对Old的使用全部改为使用New
+void irReplaceUses(IRValue* Old, IRValue* New);
+// 从基本块中删除值，值不能再被使用
+void irRemove(IRValue* V);
+// 将值移动到Pos之前
+void irMoveBefore(IRValue* V, IRValue* Pos);
+
+//
+// 机器指令
+//
+
+// 代码生成先将指令存入指令列表，经过窥孔优化等处理后再输出汇编
+
+// RISC-V的寄存器编号
+#define R_ZERO 0
+#define R_RA 1
+#define R_SP 2
+#define R_T0 5
+#define R_FP 8
+#define R_A0 10
+#define R_A1 11
+// 寄存器的数量
+#define REG_NUM 32
+
+// 判断立即数是否在12位有符号数的范围内
+static inline bool isImm12(int64_t Val) {
+    return -2048 <= Val && Val <= 2047;
+}
+
+// 数字低12位对应的有符号数，即lui或auipc之后addi的立即数
+static inline int64_t lo12(int64_t Val) {
+    return ((Val & 0xfff) ^ 0x800) - 0x800;
+}
+
+// 被调用者保存寄存器sI的编号，1<=I<=11
+static inline int sReg(int I) {
+    return I == 1 ? 9 : I + 16;
+}
+
+// 指令的种类
+typedef enum {
+    RV_ADD, // add rd, rs1, rs2
+    RV_SUB, // sub rd, rs1, rs2
+    RV_MUL, // mul rd, rs1, rs2
+    RV_DIV, // div rd, rs1, rs2
+    RV_XOR, // xor rd, rs1, rs2
+    RV_SLT, // slt rd, rs1, rs2
+    RV_ADDI, // addi rd, rs1, imm
+    RV_XORI, // xori rd, rs1, imm
+    RV_SLTI, // slti rd, rs1, imm
+    RV_NEG, // neg rd, rs1
+    RV_SEQZ, // seqz rd, rs1
+    RV_SNEZ, // snez rd, rs1
+    RV_MV, // mv rd, rs1
+    RV_LI, // li rd, imm
+    RV_LUI, // lui rd, imm，imm为高20位
+    RV_LD, // ld rd, imm(rs1)
+    RV_SD, // sd rs2, imm(rs1)
+    RV_J, // j label
+    RV_BEQZ, // beqz rs1, label
+    RV_BNEZ, // bnez rs1, label
+    RV_BEQ, // beq rs1, rs2, label
+    RV_BNE, // bne rs1, rs2, label
+    RV_BLT, // blt rs1, rs2, label
+    RV_BGE, // bge rs1, rs2, label
+    RV_RET, // ret
+    RV_LABEL, // label:
+    RV_GLOBAL, // .global label
+    RV_COMMENT, // 注释
+    RV_NOP, // 已删除的指令，不输出
+} InstKind;
+
+// 标签的种类
+typedef enum {
+    LB_MAIN, // main
+    LB_RETURN, // .L.return
+    LB_ELSE, // .L.else.N
+    LB_END, // .L.end.N
+    LB_BEGIN, // .L.begin.N
+    LB_BLOCK, // .L.bb.N，SSA中的基本块
+    LB_NUM, // 种类的总数
+} LabelKind;
+
+// 标签的编号，由种类与序号N组成，不同的标签编号不同
+#define LABEL(Kind, N) ((int64_t)(N) * LB_NUM + (Kind))
+
+// 指令
+typedef struct {
+    InstKind Kind; // 种类
+    uint8_t Rd; // 目标寄存器
+    uint8_t Rs1; // 源寄存器1，访存指令的基址寄存器
+    uint8_t Rs2; // 源寄存器2，sd中存储的值
+    union {
+        int64_t Imm; // 立即数、访存的偏移量，或标签的编号
+        char* Text; // RV_COMMENT的注释内容
+    };
+} Inst;
+
+// 指令列表
+typedef struct {
+    Inst* Data;
+    int Len;
+    int Cap;
+} InstList;
+
+// 是否为标签、注释等不生成机器码的伪指令
+static inline bool isPseudo(Inst* I) {
+    return I->Kind == RV_LABEL || I->Kind == RV_GLOBAL ||
+           I->Kind == RV_COMMENT || I->Kind == RV_NOP;
+}
+
+// 是否为条件分支指令
+static inline bool isCondBranch(Inst* I) {
+    return I->Kind == RV_BEQZ || I->Kind == RV_BNEZ || I->Kind == RV_BEQ ||
+           I->Kind == RV_BNE || I->Kind == RV_BLT || I->Kind == RV_BGE;
+}
+
+// 条件相反的分支指令，Kind必须是条件分支
+static inline InstKind invertBranch(InstKind Kind) {
+    switch(Kind) {
+    case RV_BEQZ:
+        return RV_BNEZ;
+    case RV_BNEZ:
+        return RV_BEQZ;
+    case RV_BEQ:
+        return RV_BNE;
+    case RV_BNE:
+        return RV_BEQ;
+    case RV_BLT:
+        return RV_BGE;
+    case RV_BGE:
+        return RV_BLT;
+    default:
+        error("invalid branch");
+    }
+}
+
+// 将指令删除，之后由compactInsts移除
+static inline void killInst(Inst* I) {
+    I->Kind = RV_NOP;
+}
+
+// 寄存器的名称
+char* regName(int Reg);
+
+//
+// 基本块布局
+//
+
+// 整理基本块之间的跳转：删除跳到紧随其后的标签的跳转、串联连续的跳转、
+// 翻转越过无条件跳转的条件分支、删除不可达的指令
+void layoutBlocks(InstList* L);
+// 输出每种整理进行的次数
+void layoutReport(FILE* Out);
+
+//
+// 窥孔优化
+//
+
+// 在指令列表上进行窥孔优化
+void peephole(InstList* L);
+// 记录Code[0..Len)中标签编号对应的指令下标，*Pos按需扩容，*Cap为其容量
+// 基本块布局也使用
+void findLabels(Inst* Code, int Len, int** Pos, int64_t* Cap);
+// 移除Code[0..Len)中已删除的指令，返回剩下的指令数
+int compactInsts(Inst* Code, int Len);
+// 输出每条规则生效的次数
+void peepholeReport(FILE* Out);
+
+//
+// 机器码与ELF输出
+//
+
+// 将指令列表编码为RV64机器码，超出范围的跳转经过分支松弛，写出ELF文件
+// Exe为true时写出静态可执行文件，否则写出可重定位目标文件
+void emitElf(InstList* L, bool Exe, FILE* Out);
 
 //
 // 语义分析与代码生成
 //
 
-// 代码生成入口函数
-void codegen(Function *Prog);
\ No newline at end of file
+// 是否在汇编中输出注释
+extern bool OptAnnotate;
+// 优化级别，0时不进行循环优化、基本块布局与窥孔优化
+extern int OptLevel;
+
+// 输出的格式
+typedef enum {
+    EMIT_ASM, // 汇编文本
+    EMIT_OBJ, // 可重定位目标文件
+    EMIT_EXE, // 静态可执行文件
+} EmitFormat;
+
+// 输出的格式，由--emit指定
+extern EmitFormat OptEmit;
+
+// 代码生成入口函数，汇编或ELF文件输出到Out
+void codegen(Function *Prog, FILE *Out);
+
+// 代码生成的统计，累计所有codegen的调用
+typedef struct {
+    long Insts; // 输出的指令数，不含标签与注释
+    long Labels; // 由count()分配的标号数
+    int MaxDepth; // 表达式计算时压栈的最大深度
+    size_t InstBytes; // 指令列表占用的最大字节数
+} CodegenStats;
+
+extern CodegenStats CgStats;
+
+//
+// 内置的RV64IM模拟器
+//
+
+// 汇编并运行codegen输出的汇编文本，返回main返回时a0的值
+// Steps不为NULL时，写入执行的指令条数
+int64_t simRun(char *Asm, uint64_t *Steps);
+// 解码并运行emitElf输出的ELF文件，可执行文件从入口开始运行，
+// 目标文件从main开始运行，返回退出码或main返回时a0的值
+int64_t simRunElf(uint8_t *Elf, size_t Len, uint64_t *Steps);
+
+//
+// 编译统计
+//
+
+// 统计的输出格式
+typedef enum {
+    STATS_OFF, // 不统计
+    STATS_TEXT, // 文本
+    STATS_JSON, // JSON
+} StatsFormat;
+
+// 编译的阶段
+typedef enum {
+    ST_TOKENIZE, // 词法分析
+    ST_PARSE, // 语法解析，终结符按需读取，因此包含词法分析
+    ST_OPTIMIZE, // AST优化
+    ST_SSA, // 构造SSA形式
+    ST_CODEGEN, // 代码生成
+    ST_NUM,
+} StatPhase;
+
+// 统计的输出格式，由--stats指定
+extern StatsFormat OptStats;
+
+// 开始与结束一个阶段的计时，未开启统计时什么也不做
+void statBegin(StatPhase P);
+void statEnd(StatPhase P);
+// 输出各阶段的用时、分配的字节数与各种数量
+void statReport(Function *Prog, FILE *Out);
+// 阶段的名称，用于输出
+char* statPhaseName(StatPhase P);
+// 单调时钟的当前时间，秒，用于计时
+double nowSec(void);
@@ -0,0 +1,1032 @@
+#include "rvcc.h"
+
+#include <elf.h>
+
+// 内置的RV64IM模拟器
+// 将codegen输出的汇编文本汇编为内部指令表，或将emitElf输出的机器码解码为内部指令表，
+// 然后直接解释执行，
+// 程序返回时a0的值即为退出码，从而无需交叉工具链与qemu。
+
+// 模拟器栈空间大小，栈顶位于SIM_STACK_TOP
+#define SIM_STACK_SIZE (64 << 20)
+#define SIM_STACK_TOP 0x7ff00000ULL
+// 汇编文本与目标文件的代码段起始地址
+#define SIM_CODE_BASE 0x10000ULL
+// 初始ra的值，跳转到此地址即表示main返回
+#define SIM_HALT_ADDR 0x4ULL
+// 被调用者保存的寄存器在进入main时的特征值
+#define SIM_SAVED_MAGIC 0x5a5a5a5a00000000ULL
+
+// 内部操作码
+typedef enum {
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR,
+    OP_AND, OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM,
+    OP_REMU, OP_ADDW, OP_SUBW, OP_SLLW, OP_SRLW, OP_SRAW, OP_MULW, OP_DIVW,
+    OP_DIVUW, OP_REMW, OP_REMUW,
+    OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI,
+    OP_SRAI, OP_ADDIW, OP_SLLIW, OP_SRLIW, OP_SRAIW,
+    OP_LB, OP_LH, OP_LW, OP_LD, OP_LBU, OP_LHU, OP_LWU,
+    OP_SB, OP_SH, OP_SW, OP_SD,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+    OP_JAL, OP_JALR, OP_LUI, OP_AUIPC, OP_ECALL,
+} SimOp;
+
+// 操作数格式
+typedef enum {
+    FMT_R,      // rd, rs1, rs2
+    FMT_I,      // rd, rs1, imm
+    FMT_LOAD,   // rd, imm(rs1)
+    FMT_STORE,  // rs2, imm(rs1)
+    FMT_B,      // rs1, rs2, label
+    FMT_U,      // rd, imm
+    FMT_NONE,   // 无操作数
+    FMT_PSEUDO, // 伪指令，单独处理
+} SimFmt;
+
+typedef struct {
+    char* Name;
+    SimOp Op;
+    SimFmt Fmt;
+} SimDesc;
+
+static SimDesc Descs[] = {
+    {"add", OP_ADD, FMT_R}, {"sub", OP_SUB, FMT_R}, {"sll", OP_SLL, FMT_R},
+    {"slt", OP_SLT, FMT_R}, {"sltu", OP_SLTU, FMT_R}, {"xor", OP_XOR, FMT_R},
+    {"srl", OP_SRL, FMT_R}, {"sra", OP_SRA, FMT_R}, {"or", OP_OR, FMT_R},
+    {"and", OP_AND, FMT_R}, {"mul", OP_MUL, FMT_R}, {"mulh", OP_MULH, FMT_R},
+    {"mulhsu", OP_MULHSU, FMT_R}, {"mulhu", OP_MULHU, FMT_R},
+    {"div", OP_DIV, FMT_R}, {"divu", OP_DIVU, FMT_R}, {"rem", OP_REM, FMT_R},
+    {"remu", OP_REMU, FMT_R}, {"addw", OP_ADDW, FMT_R},
+    {"subw", OP_SUBW, FMT_R}, {"sllw", OP_SLLW, FMT_R},
+    {"srlw", OP_SRLW, FMT_R}, {"sraw", OP_SRAW, FMT_R},
+    {"mulw", OP_MULW, FMT_R}, {"divw", OP_DIVW, FMT_R},
+    {"divuw", OP_DIVUW, FMT_R}, {"remw", OP_REMW, FMT_R},
+    {"remuw", OP_REMUW, FMT_R},
+    {"addi", OP_ADDI, FMT_I}, {"slti", OP_SLTI, FMT_I},
+    {"sltiu", OP_SLTIU, FMT_I}, {"xori", OP_XORI, FMT_I},
+    {"ori", OP_ORI, FMT_I}, {"andi", OP_ANDI, FMT_I},
+    {"slli", OP_SLLI, FMT_I}, {"srli", OP_SRLI, FMT_I},
+    {"srai", OP_SRAI, FMT_I}, {"addiw", OP_ADDIW, FMT_I},
+    {"slliw", OP_SLLIW, FMT_I}, {"srliw", OP_SRLIW, FMT_I},
+    {"sraiw", OP_SRAIW, FMT_I},
+    {"lb", OP_LB, FMT_LOAD}, {"lh", OP_LH, FMT_LOAD}, {"lw", OP_LW, FMT_LOAD},
+    {"ld", OP_LD, FMT_LOAD}, {"lbu", OP_LBU, FMT_LOAD},
+    {"lhu", OP_LHU, FMT_LOAD}, {"lwu", OP_LWU, FMT_LOAD},
+    {"sb", OP_SB, FMT_STORE}, {"sh", OP_SH, FMT_STORE},
+    {"sw", OP_SW, FMT_STORE}, {"sd", OP_SD, FMT_STORE},
+    {"beq", OP_BEQ, FMT_B}, {"bne", OP_BNE, FMT_B}, {"blt", OP_BLT, FMT_B},
+    {"bge", OP_BGE, FMT_B}, {"bltu", OP_BLTU, FMT_B},
+    {"bgeu", OP_BGEU, FMT_B},
+    {"lui", OP_LUI, FMT_U}, {"auipc", OP_AUIPC, FMT_U},
+    {"ecall", OP_ECALL, FMT_NONE},
+    {"jal", OP_JAL, FMT_PSEUDO}, {"jalr", OP_JALR, FMT_PSEUDO},
+};
+
+// 模拟器内部的一条指令
+typedef struct {
+    SimOp Op;
+    int Rd, Rs1, Rs2;
+    int64_t Imm;
+    char* Label; // 跳转目标标签，解析完成后写入Imm
+    int Line;    // 源汇编所在行，用于报错
+} SimInst;
+
+// 标签表
+typedef struct {
+    char* Name;
+    int Idx;
+} SimLabel;
+
+static SimInst* Insts;
+static int InstCnt, InstCap;
+static SimLabel* Labels;
+static int LabelCnt, LabelCap;
+// 标签的哈希表，存放Labels的下标加1，0表示空位，容量为2的幂
+static int* LabelTable;
+static int LabelTableCap;
+static int CurLine;
+// 代码段的起始地址，指令地址 = CodeBase + 4 * 下标
+static uint64_t CodeBase;
+
+// 寄存器的ABI名称，下标即为寄存器编号
+static char* RegNames[] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+static void simError(char* Fmt, char* Arg) {
+    fprintf(stderr, "sim: line %d: ", CurLine);
+    fprintf(stderr, Fmt, Arg);
+    fprintf(stderr, "\n");
+    die();
+}
+
+// 解析寄存器名称
+static int parseReg(char* S) {
+    if(!strcmp(S, "fp"))
+        return 8;
+    for(int I = 0; I < 32; I++)
+        if(!strcmp(S, RegNames[I]))
+            return I;
+    if(S[0] == 'x' && isdigit(S[1])) {
+        int N = atoi(S + 1);
+        if(N >= 0 && N < 32)
+            return N;
+    }
+    simError("invalid register '%s'", S);
+    return 0;
+}
+
+// 解析立即数
+static int64_t parseImm(char* S) {
+    char* End;
+    int64_t V = strtoll(S, &End, 0);
+    if(End == S || *End)
+        simError("invalid immediate '%s'", S);
+    return V;
+}
+
+// 检查I型/S型指令的立即数是否在12位有符号数范围内
+static int64_t checkImm12(int64_t V) {
+    if(V < -2048 || V > 2047) {
+        fprintf(stderr, "sim: line %d: immediate %lld out of range\n", CurLine,
+                (long long)V);
+        die();
+    }
+    return V;
+}
+
+// 解析 imm(reg) 形式的内存操作数
+static void parseMem(char* S, int64_t* Imm, int* Reg) {
+    char* L = strchr(S, '(');
+    char* R = strrchr(S, ')');
+    if(!L || !R || R < L)
+        simError("invalid memory operand '%s'", S);
+    *R = '\0';
+    *L = '\0';
+    *Imm = (L == S) ? 0 : checkImm12(parseImm(S));
+    *Reg = parseReg(L + 1);
+}
+
+static SimInst* newInst(SimOp Op) {
+    if(InstCnt == InstCap) {
+        InstCap = InstCap ? InstCap * 2 : 256;
+        Insts = realloc(Insts, sizeof(SimInst) * InstCap);
+        if(!Insts)
+            error("out of memory");
+    }
+    SimInst* I = &Insts[InstCnt++];
+    memset(I, 0, sizeof(*I));
+    I->Op = Op;
+    I->Line = CurLine;
+    return I;
+}
+
+// 将第Idx个标签插入哈希表
+static void insertLabel(int Idx) {
+    uint32_t Mask = LabelTableCap - 1;
+    uint32_t H = hashBytes(Labels[Idx].Name, strlen(Labels[Idx].Name)) & Mask;
+    while(LabelTable[H])
+        H = (H + 1) & Mask;
+    LabelTable[H] = Idx + 1;
+}
+
+static void addLabel(char* Name) {
+    // 负载超过一半时扩容哈希表
+    if((LabelCnt + 1) * 2 > LabelTableCap) {
+        free(LabelTable);
+        LabelTableCap = LabelTableCap ? LabelTableCap * 2 : 128;
+        LabelTable = calloc(LabelTableCap, sizeof(int));
+        for(int I = 0; I < LabelCnt; I++)
+            insertLabel(I);
+    }
+
+    if(LabelCnt == LabelCap) {
+        LabelCap = LabelCap ? LabelCap * 2 : 64;
+        Labels = realloc(Labels, sizeof(SimLabel) * LabelCap);
+    }
+    Labels[LabelCnt].Name = strdup(Name);
+    Labels[LabelCnt].Idx = InstCnt;
+    insertLabel(LabelCnt);
+    LabelCnt++;
+}
+
+static void expectOps(int N, int Want, char* Mn) {
+    if(N != Want)
+        simError("wrong number of operands for '%s'", Mn);
+}
+
+// 生成条件跳转
+static void emitBranch(SimOp Op, int Rs1, int Rs2, char* Label) {
+    SimInst* I = newInst(Op);
+    I->Rs1 = Rs1;
+    I->Rs2 = Rs2;
+    I->Label = strdup(Label);
+}
+
+// 处理伪指令及jal/jalr，返回是否识别
+static bool asmPseudo(char* Mn, char** Ops, int N) {
+    SimInst* I;
+
+    if(!strcmp(Mn, "nop")) {
+        newInst(OP_ADDI);
+        return true;
+    }
+    if(!strcmp(Mn, "li")) {
+        expectOps(N, 2, Mn);
+        // li可以加载任意64位立即数，这里直接视为一条指令
+        I = newInst(OP_ADDI);
+        I->Rd = parseReg(Ops[0]);
+        I->Imm = parseImm(Ops[1]);
+        return true;
+    }
+    if(!strcmp(Mn, "mv") || !strcmp(Mn, "sext.w") || !strcmp(Mn, "not") ||
+        !strcmp(Mn, "neg") || !strcmp(Mn, "negw") || !strcmp(Mn, "seqz") ||
+        !strcmp(Mn, "snez") || !strcmp(Mn, "sltz") || !strcmp(Mn, "sgtz")) {
+        expectOps(N, 2, Mn);
+        int Rd = parseReg(Ops[0]), Rs = parseReg(Ops[1]);
+        if(!strcmp(Mn, "mv")) {
+            I = newInst(OP_ADDI);
+            I->Rs1 = Rs;
+        } else if(!strcmp(Mn, "sext.w")) {
+            I = newInst(OP_ADDIW);
+            I->Rs1 = Rs;
+        } else if(!strcmp(Mn, "not")) {
+            I = newInst(OP_XORI);
+            I->Rs1 = Rs;
+            I->Imm = -1;
+        } else if(!strcmp(Mn, "neg") || !strcmp(Mn, "negw")) {
+            I = newInst(Mn[3] ? OP_SUBW : OP_SUB);
+            I->Rs2 = Rs;
+        } else if(!strcmp(Mn, "seqz")) {
+            I = newInst(OP_SLTIU);
+            I->Rs1 = Rs;
+            I->Imm = 1;
+        } else if(!strcmp(Mn, "snez")) {
+            I = newInst(OP_SLTU);
+            I->Rs2 = Rs;
+        } else if(!strcmp(Mn, "sltz")) {
+            I = newInst(OP_SLT);
+            I->Rs1 = Rs;
+        } else {
+            I = newInst(OP_SLT);
+            I->Rs2 = Rs;
+        }
+        I->Rd = Rd;
+        return true;
+    }
+
+    // 与零比较的条件跳转
+    static struct {
+        char* Name;
+        SimOp Op;
+        bool Swap;
+    } BrZ[] = {
+        {"beqz", OP_BEQ, false}, {"bnez", OP_BNE, false},
+        {"bltz", OP_BLT, false}, {"bgez", OP_BGE, false},
+        {"blez", OP_BGE, true},  {"bgtz", OP_BLT, true},
+    };
+    for(size_t K = 0; K < sizeof(BrZ) / sizeof(*BrZ); K++) {
+        if(!strcmp(Mn, BrZ[K].Name)) {
+            expectOps(N, 2, Mn);
+            int R = parseReg(Ops[0]);
+            if(BrZ[K].Swap)
+                emitBranch(BrZ[K].Op, 0, R, Ops[1]);
+            else
+                emitBranch(BrZ[K].Op, R, 0, Ops[1]);
+            return true;
+        }
+    }
+
+    // 交换操作数的条件跳转
+    static struct {
+        char* Name;
+        SimOp Op;
+    } BrSwap[] = {
+        {"bgt", OP_BLT}, {"ble", OP_BGE}, {"bgtu", OP_BLTU}, {"bleu", OP_BGEU},
+    };
+    for(size_t K = 0; K < sizeof(BrSwap) / sizeof(*BrSwap); K++) {
+        if(!strcmp(Mn, BrSwap[K].Name)) {
+            expectOps(N, 3, Mn);
+            emitBranch(BrSwap[K].Op, parseReg(Ops[1]), parseReg(Ops[0]), Ops[2]);
+            return true;
+        }
+    }
+
+    if(!strcmp(Mn, "j") || !strcmp(Mn, "jal") || !strcmp(Mn, "call") ||
+        !strcmp(Mn, "tail")) {
+        int Rd = (!strcmp(Mn, "j") || !strcmp(Mn, "tail")) ? 0 : 1;
+        char* Target;
+        if(N == 2 && !strcmp(Mn, "jal")) {
+            Rd = parseReg(Ops[0]);
+            Target = Ops[1];
+        } else {
+            expectOps(N, 1, Mn);
+            Target = Ops[0];
+        }
+        I = newInst(OP_JAL);
+        I->Rd = Rd;
+        I->Label = strdup(Target);
+        return true;
+    }
+
+    if(!strcmp(Mn, "ret") || !strcmp(Mn, "jr") || !strcmp(Mn, "jalr")) {
+        I = newInst(OP_JALR);
+        if(!strcmp(Mn, "ret")) {
+            expectOps(N, 0, Mn);
+            I->Rs1 = 1;
+        } else if(N == 1) {
+            I->Rd = !strcmp(Mn, "jalr") ? 1 : 0;
+            I->Rs1 = parseReg(Ops[0]);
+        } else if(N == 2) {
+            I->Rd = parseReg(Ops[0]);
+            parseMem(Ops[1], &I->Imm, &I->Rs1);
+        } else {
+            expectOps(N, 3, Mn);
+            I->Rd = parseReg(Ops[0]);
+            I->Rs1 = parseReg(Ops[1]);
+            I->Imm = parseImm(Ops[2]);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// 汇编一行
+static void asmLine(char* Line) {
+    // 去掉注释
+    char* Hash = strchr(Line, '#');
+    if(Hash)
+        *Hash = '\0';
+
+    char* P = Line;
+    while(isspace(*P))
+        P++;
+
+    // 标签，可能与指令位于同一行
+    char* Colon = strchr(P, ':');
+    if(Colon) {
+        char* E = Colon;
+        while(E > P && isspace(E[-1]))
+            E--;
+        *E = '\0';
+        addLabel(P);
+        P = Colon + 1;
+        while(isspace(*P))
+            P++;
+    }
+
+    if(!*P || *P == '.')
+        return;
+
+    // 助记符
+    char* Mn = P;
+    while(*P && !isspace(*P))
+        P++;
+    if(*P)
+        *P++ = '\0';
+
+    // 操作数，以逗号分隔
+    char* Ops[4];
+    int N = 0;
+    while(true) {
+        while(isspace(*P))
+            P++;
+        if(!*P)
+            break;
+        if(N == 4)
+            simError("too many operands for '%s'", Mn);
+        Ops[N++] = P;
+        while(*P && *P != ',')
+            P++;
+        char* E = P;
+        while(E > Ops[N - 1] && isspace(E[-1]))
+            E--;
+        bool More = *P == ',';
+        *E = '\0';
+        if(More)
+            P++;
+        else
+            break;
+    }
+
+    if(asmPseudo(Mn, Ops, N))
+        return;
+
+    for(size_t K = 0; K < sizeof(Descs) / sizeof(*Descs); K++) {
+        SimDesc* D = &Descs[K];
+        if(strcmp(Mn, D->Name))
+            continue;
+
+        SimInst* I = newInst(D->Op);
+        switch(D->Fmt) {
+        case FMT_R:
+            expectOps(N, 3, Mn);
+            I->Rd = parseReg(Ops[0]);
+            I->Rs1 = parseReg(Ops[1]);
+            I->Rs2 = parseReg(Ops[2]);
+            return;
+        case FMT_I:
+            expectOps(N, 3, Mn);
+            I->Rd = parseReg(Ops[0]);
+            I->Rs1 = parseReg(Ops[1]);
+            I->Imm = checkImm12(parseImm(Ops[2]));
+            return;
+        case FMT_LOAD:
+            expectOps(N, 2, Mn);
+            I->Rd = parseReg(Ops[0]);
+            parseMem(Ops[1], &I->Imm, &I->Rs1);
+            return;
+        case FMT_STORE:
+            expectOps(N, 2, Mn);
+            I->Rs2 = parseReg(Ops[0]);
+            parseMem(Ops[1], &I->Imm, &I->Rs1);
+            return;
+        case FMT_B:
+            expectOps(N, 3, Mn);
+            I->Rs1 = parseReg(Ops[0]);
+            I->Rs2 = parseReg(Ops[1]);
+            I->Label = strdup(Ops[2]);
+            return;
+        case FMT_U:
+            expectOps(N, 2, Mn);
+            I->Rd = parseReg(Ops[0]);
+            I->Imm = parseImm(Ops[1]);
+            return;
+        case FMT_NONE:
+            expectOps(N, 0, Mn);
+            return;
+        default:
+            break;
+        }
+    }
+
+    simError("unsupported instruction '%s'", Mn);
+}
+
+// 查找标签对应的指令下标
+static int findLabel(char* Name) {
+    if(LabelTableCap) {
+        uint32_t Mask = LabelTableCap - 1;
+        uint32_t H = hashBytes(Name, strlen(Name)) & Mask;
+        for(; LabelTable[H]; H = (H + 1) & Mask)
+            if(!strcmp(Labels[LabelTable[H] - 1].Name, Name))
+                return Labels[LabelTable[H] - 1].Idx;
+    }
+    simError("undefined label '%s'", Name);
+    return 0;
+}
+
+// 将汇编文本转换为指令表
+static void assemble(char* Asm) {
+    InstCnt = 0;
+    LabelCnt = 0;
+    CurLine = 0;
+
+    char* P = Asm;
+    while(*P) {
+        char* E = strchr(P, '\n');
+        size_t Len = E ? (size_t)(E - P) : strlen(P);
+        char* Line = strndup(P, Len);
+        CurLine++;
+        asmLine(Line);
+        free(Line);
+        P += Len;
+        if(*P)
+            P++;
+    }
+
+    // 回填跳转目标
+    for(int I = 0; I < InstCnt; I++) {
+        if(!Insts[I].Label)
+            continue;
+        CurLine = Insts[I].Line;
+        Insts[I].Imm = findLabel(Insts[I].Label);
+        free(Insts[I].Label);
+        Insts[I].Label = NULL;
+    }
+}
+
+// 将Bits位的数V作为有符号数扩展为64位
+static int64_t sext(uint64_t V, int Bits) {
+    return (int64_t)(V << (64 - Bits)) >> (64 - Bits);
+}
+
+// 按funct3排列的操作，-1表示不存在的编码
+static int OpOps[8] = {OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND};
+static int MulOps[8] = {OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU,
+                        OP_DIV, OP_DIVU, OP_REM, OP_REMU};
+static int Op32Ops[8] = {OP_ADDW, OP_SLLW, -1, -1, -1, OP_SRLW, -1, -1};
+static int Mul32Ops[8] = {OP_MULW, -1, -1, -1, OP_DIVW, OP_DIVUW, OP_REMW, OP_REMUW};
+static int ImmOps[8] = {OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU,
+                        OP_XORI, OP_SRLI, OP_ORI, OP_ANDI};
+static int Imm32Ops[8] = {OP_ADDIW, OP_SLLIW, -1, -1, -1, OP_SRLIW, -1, -1};
+static int LoadOps[8] = {OP_LB, OP_LH, OP_LW, OP_LD, OP_LBU, OP_LHU, OP_LWU, -1};
+static int StoreOps[8] = {OP_SB, OP_SH, OP_SW, OP_SD, -1, -1, -1, -1};
+static int BranchOps[8] = {OP_BEQ, OP_BNE, -1, -1, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU};
+
+// 将第Idx条指令的机器码W解码后加入指令表
+static void decode(uint32_t W, int Idx) {
+    int Opc = W & 0x7f;
+    int Rd = W >> 7 & 31, F3 = W >> 12 & 7, Rs1 = W >> 15 & 31, Rs2 = W >> 20 & 31;
+    int F7 = W >> 25;
+    int64_t ImmI = sext(W >> 20, 12);
+    int Op = -1;
+    int64_t Imm = 0;
+
+    switch(Opc) {
+    case 0x33: // OP
+        if(F7 == 0)
+            Op = OpOps[F3];
+        else if(F7 == 1)
+            Op = MulOps[F3];
+        else if(F7 == 0x20 && (F3 == 0 || F3 == 5))
+            Op = F3 ? OP_SRA : OP_SUB;
+        break;
+    case 0x3b: // OP-32
+        if(F7 == 0)
+            Op = Op32Ops[F3];
+        else if(F7 == 1)
+            Op = Mul32Ops[F3];
+        else if(F7 == 0x20 && (F3 == 0 || F3 == 5))
+            Op = F3 ? OP_SRAW : OP_SUBW;
+        break;
+    case 0x13: // OP-IMM，移位的立即数为6位，第30位区分算术与逻辑右移
+        Op = ImmOps[F3];
+        Imm = ImmI;
+        if(F3 == 1 || F3 == 5) {
+            Imm = ImmI & 63;
+            if(F7 >> 1 == 0x10 && F3 == 5)
+                Op = OP_SRAI;
+            else if(F7 >> 1)
+                Op = -1;
+        }
+        break;
+    case 0x1b: // OP-IMM-32
+        Op = Imm32Ops[F3];
+        Imm = ImmI;
+        if(F3 == 1 || F3 == 5) {
+            Imm = ImmI & 31;
+            if(F7 == 0x20 && F3 == 5)
+                Op = OP_SRAIW;
+            else if(F7)
+                Op = -1;
+        }
+        break;
+    case 0x03: // LOAD
+        Op = LoadOps[F3];
+        Imm = ImmI;
+        break;
+    case 0x23: // STORE
+        Op = StoreOps[F3];
+        Imm = sext((W >> 25) << 5 | (W >> 7 & 31), 12);
+        break;
+    case 0x63: // BRANCH，目标转换为指令下标
+        Op = BranchOps[F3];
+        Imm = Idx + sext((W >> 31) << 12 | (W >> 7 & 1) << 11 |
+                         (W >> 25 & 0x3f) << 5 | (W >> 8 & 0xf) << 1, 13) / 4;
+        break;
+    case 0x6f: // JAL
+        Op = OP_JAL;
+        Imm = Idx + sext((W >> 31) << 20 | (W >> 12 & 0xff) << 12 |
+                         (W >> 20 & 1) << 11 | (W >> 21 & 0x3ff) << 1, 21) / 4;
+        break;
+    case 0x67: // JALR
+        if(F3 == 0)
+            Op = OP_JALR;
+        Imm = ImmI;
+        break;
+    case 0x37: // LUI
+    case 0x17: // AUIPC
+        Op = Opc == 0x37 ? OP_LUI : OP_AUIPC;
+        Imm = W >> 12;
+        break;
+    case 0x73: // SYSTEM
+        if(W == 0x73)
+            Op = OP_ECALL;
+        break;
+    }
+
+    if(Op < 0) {
+        fprintf(stderr, "sim: invalid instruction 0x%08x at 0x%llx\n", W,
+                (unsigned long long)(CodeBase + 4 * (uint64_t)Idx));
+        die();
+    }
+
+    SimInst* I = newInst(Op);
+    I->Rd = Rd;
+    I->Rs1 = Rs1;
+    I->Rs2 = Rs2;
+    I->Imm = Imm;
+}
+
+// 检查并返回内存地址对应的宿主指针
+static uint8_t* memAt(uint8_t* Stack, uint64_t Addr, int Size) {
+    uint64_t Lo = SIM_STACK_TOP - SIM_STACK_SIZE;
+    if(Addr < Lo || Addr + Size > SIM_STACK_TOP) {
+        fprintf(stderr, "sim: line %d: invalid memory access at 0x%llx\n",
+                CurLine, (unsigned long long)Addr);
+        die();
+    }
+    return Stack + (Addr - Lo);
+}
+
+static uint64_t mulhu(uint64_t A, uint64_t B) {
+    return (uint64_t)(((unsigned __int128)A * B) >> 64);
+}
+
+static int64_t mulh(int64_t A, int64_t B) {
+    return (int64_t)(((__int128)A * B) >> 64);
+}
+
+static int64_t mulhsu(int64_t A, uint64_t B) {
+    return (int64_t)(((__int128)A * (unsigned __int128)B) >> 64);
+}
+
+// 按RISC-V语义进行有符号除法：除零得-1，溢出得被除数
+static int64_t sdiv(int64_t A, int64_t B) {
+    if(B == 0)
+        return -1;
+    if(A == INT64_MIN && B == -1)
+        return A;
+    return A / B;
+}
+
+static int64_t srem(int64_t A, int64_t B) {
+    if(B == 0)
+        return A;
+    if(A == INT64_MIN && B == -1)
+        return 0;
+    return A % B;
+}
+
+// 是否为被调用者保存的寄存器s0~s11
+static bool isCalleeSaved(int R) {
+    return R == 8 || R == 9 || (18 <= R && R <= 27);
+}
+
+// 检查被调用者保存的寄存器是否已恢复
+static void checkSaved(uint64_t* X) {
+    for(int Reg = 0; Reg < 32; Reg++)
+        if(isCalleeSaved(Reg) && X[Reg] != SIM_SAVED_MAGIC + Reg)
+            error("sim: callee-saved register x%d not restored", Reg);
+}
+
+// 从第Start条指令开始执行指令表，返回a0
+static int64_t execute(int64_t Start, uint64_t* Steps) {
+    uint64_t X[32] = {0};
+    uint8_t* Stack = calloc(1, SIM_STACK_SIZE);
+    if(!Stack)
+        error("sim: out of memory");
+
+    X[1] = SIM_HALT_ADDR;
+    X[2] = SIM_STACK_TOP;
+    // 为被调用者保存的寄存器s0~s11设置特征值，main返回时检查是否被恢复
+    for(int R = 0; R < 32; R++)
+        if(isCalleeSaved(R))
+            X[R] = SIM_SAVED_MAGIC + R;
+
+    uint64_t N = 0;
+    int64_t Pc = Start;
+
+    while(true) {
+        if(Pc < 0 || Pc >= InstCnt)
+            error("sim: pc out of range");
+
+        SimInst* I = &Insts[Pc];
+        CurLine = I->Line;
+        uint64_t A = X[I->Rs1], B = X[I->Rs2];
+        int64_t SA = (int64_t)A, SB = (int64_t)B;
+        uint64_t Imm = (uint64_t)I->Imm;
+        uint64_t R = 0;
+        int64_t Next = Pc + 1;
+        bool WB = true;
+        N++;
+
+        switch(I->Op) {
+        case OP_ADD:
+            R = A + B;
+            break;
+        case OP_SUB:
+            R = A - B;
+            break;
+        case OP_SLL:
+            R = A << (B & 63);
+            break;
+        case OP_SLT:
+            R = SA < SB;
+            break;
+        case OP_SLTU:
+            R = A < B;
+            break;
+        case OP_XOR:
+            R = A ^ B;
+            break;
+        case OP_SRL:
+            R = A >> (B & 63);
+            break;
+        case OP_SRA:
+            R = (uint64_t)(SA >> (B & 63));
+            break;
+        case OP_OR:
+            R = A | B;
+            break;
+        case OP_AND:
+            R = A & B;
+            break;
+        case OP_MUL:
+            R = A * B;
+            break;
+        case OP_MULH:
+            R = (uint64_t)mulh(SA, SB);
+            break;
+        case OP_MULHSU:
+            R = (uint64_t)mulhsu(SA, B);
+            break;
+        case OP_MULHU:
+            R = mulhu(A, B);
+            break;
+        case OP_DIV:
+            R = (uint64_t)sdiv(SA, SB);
+            break;
+        case OP_DIVU:
+            R = B ? A / B : UINT64_MAX;
+            break;
+        case OP_REM:
+            R = (uint64_t)srem(SA, SB);
+            break;
+        case OP_REMU:
+            R = B ? A % B : A;
+            break;
+        case OP_ADDW:
+            R = (uint64_t)(int64_t)(int32_t)(A + B);
+            break;
+        case OP_SUBW:
+            R = (uint64_t)(int64_t)(int32_t)(A - B);
+            break;
+        case OP_SLLW:
+            R = (uint64_t)(int64_t)(int32_t)((uint32_t)A << (B & 31));
+            break;
+        case OP_SRLW:
+            R = (uint64_t)(int64_t)(int32_t)((uint32_t)A >> (B & 31));
+            break;
+        case OP_SRAW:
+            R = (uint64_t)(int64_t)((int32_t)A >> (B & 31));
+            break;
+        case OP_MULW:
+            R = (uint64_t)(int64_t)(int32_t)(A * B);
+            break;
+        case OP_DIVW:
+            R = (uint64_t)(int64_t)(int32_t)sdiv((int32_t)A, (int32_t)B);
+            break;
+        case OP_DIVUW:
+            R = (uint64_t)(int64_t)(int32_t)((uint32_t)B ? (uint32_t)A / (uint32_t)B : UINT32_MAX);
+            break;
+        case OP_REMW:
+            R = (uint64_t)(int64_t)(int32_t)srem((int32_t)A, (int32_t)B);
+            break;
+        case OP_REMUW:
+            R = (uint64_t)(int64_t)(int32_t)((uint32_t)B ? (uint32_t)A % (uint32_t)B : (uint32_t)A);
+            break;
+        case OP_ADDI:
+            R = A + Imm;
+            break;
+        case OP_SLTI:
+            R = SA < I->Imm;
+            break;
+        case OP_SLTIU:
+            R = A < Imm;
+            break;
+        case OP_XORI:
+            R = A ^ Imm;
+            break;
+        case OP_ORI:
+            R = A | Imm;
+            break;
+        case OP_ANDI:
+            R = A & Imm;
+            break;
+        case OP_SLLI:
+            R = A << (Imm & 63);
+            break;
+        case OP_SRLI:
+            R = A >> (Imm & 63);
+            break;
+        case OP_SRAI:
+            R = (uint64_t)(SA >> (Imm & 63));
+            break;
+        case OP_ADDIW:
+            R = (uint64_t)(int64_t)(int32_t)(A + Imm);
+            break;
+        case OP_SLLIW:
+            R = (uint64_t)(int64_t)(int32_t)((uint32_t)A << (Imm & 31));
+            break;
+        case OP_SRLIW:
+            R = (uint64_t)(int64_t)(int32_t)((uint32_t)A >> (Imm & 31));
+            break;
+        case OP_SRAIW:
+            R = (uint64_t)(int64_t)((int32_t)A >> (Imm & 31));
+            break;
+        case OP_LB:
+            R = (uint64_t)(int64_t)*(int8_t*)memAt(Stack, A + Imm, 1);
+            break;
+        case OP_LH: {
+            int16_t V;
+            memcpy(&V, memAt(Stack, A + Imm, 2), 2);
+            R = (uint64_t)(int64_t)V;
+            break;
+        }
+        case OP_LW: {
+            int32_t V;
+            memcpy(&V, memAt(Stack, A + Imm, 4), 4);
+            R = (uint64_t)(int64_t)V;
+            break;
+        }
+        case OP_LD:
+            memcpy(&R, memAt(Stack, A + Imm, 8), 8);
+            break;
+        case OP_LBU:
+            R = *memAt(Stack, A + Imm, 1);
+            break;
+        case OP_LHU: {
+            uint16_t V;
+            memcpy(&V, memAt(Stack, A + Imm, 2), 2);
+            R = V;
+            break;
+        }
+        case OP_LWU: {
+            uint32_t V;
+            memcpy(&V, memAt(Stack, A + Imm, 4), 4);
+            R = V;
+            break;
+        }
+        case OP_SB:
+            memcpy(memAt(Stack, A + Imm, 1), &B, 1);
+            WB = false;
+            break;
+        case OP_SH:
+            memcpy(memAt(Stack, A + Imm, 2), &B, 2);
+            WB = false;
+            break;
+        case OP_SW:
+            memcpy(memAt(Stack, A + Imm, 4), &B, 4);
+            WB = false;
+            break;
+        case OP_SD:
+            memcpy(memAt(Stack, A + Imm, 8), &B, 8);
+            WB = false;
+            break;
+        case OP_BEQ:
+            if(A == B)
+                Next = I->Imm;
+            WB = false;
+            break;
+        case OP_BNE:
+            if(A != B)
+                Next = I->Imm;
+            WB = false;
+            break;
+        case OP_BLT:
+            if(SA < SB)
+                Next = I->Imm;
+            WB = false;
+            break;
+        case OP_BGE:
+            if(SA >= SB)
+                Next = I->Imm;
+            WB = false;
+            break;
+        case OP_BLTU:
+            if(A < B)
+                Next = I->Imm;
+            WB = false;
+            break;
+        case OP_BGEU:
+            if(A >= B)
+                Next = I->Imm;
+            WB = false;
+            break;
+        case OP_JAL:
+            R = CodeBase + 4 * (uint64_t)(Pc + 1);
+            Next = I->Imm;
+            break;
+        case OP_JALR: {
+            uint64_t T = (A + Imm) & ~1ULL;
+            R = CodeBase + 4 * (uint64_t)(Pc + 1);
+            if(T == SIM_HALT_ADDR) {
+                // main返回
+                if(I->Rd)
+                    X[I->Rd] = R;
+                checkSaved(X);
+                free(Stack);
+                if(Steps)
+                    *Steps = N;
+                return (int64_t)X[10];
+            }
+            if(T < CodeBase || (T - CodeBase) % 4)
+                error("sim: jump to invalid address 0x%llx", (unsigned long long)T);
+            Next = (int64_t)((T - CodeBase) / 4);
+            break;
+        }
+        case OP_LUI:
+            R = (uint64_t)(int64_t)(int32_t)(uint32_t)(Imm << 12);
+            break;
+        case OP_AUIPC:
+            R = CodeBase + 4 * (uint64_t)Pc +
+                (uint64_t)(int64_t)(int32_t)(uint32_t)(Imm << 12);
+            break;
+        case OP_ECALL:
+            // 仅支持exit系统调用
+            if(X[17] == 93 || X[17] == 94) {
+                checkSaved(X);
+                free(Stack);
+                if(Steps)
+                    *Steps = N;
+                return (int64_t)X[10];
+            }
+            error("sim: unsupported ecall %llu", (unsigned long long)X[17]);
+        }
+
+        if(WB && I->Rd)
+            X[I->Rd] = R;
+        Pc = Next;
+    }
+}
+
+// 汇编并运行程序，返回main的返回值
+int64_t simRun(char* Asm, uint64_t* Steps) {
+    char* Copy = strdup(Asm);
+    CodeBase = SIM_CODE_BASE;
+    assemble(Copy);
+    free(Copy);
+    int64_t Ret = execute(findLabel("main"), Steps);
+
+    for(int I = 0; I < LabelCnt; I++)
+        free(Labels[I].Name);
+    free(Labels);
+    free(LabelTable);
+    free(Insts);
+    Labels = NULL;
+    LabelTable = NULL;
+    Insts = NULL;
+    LabelCap = LabelTableCap = InstCap = 0;
+    return Ret;
+}
+
+// 解码并运行ELF文件中的.text节
+int64_t simRunElf(uint8_t* Elf, size_t Len, uint64_t* Steps) {
+    Elf64_Ehdr* Eh = (Elf64_Ehdr*)Elf;
+    if(Len < sizeof(*Eh) || memcmp(Eh->e_ident, ELFMAG, SELFMAG) ||
+       Eh->e_ident[EI_CLASS] != ELFCLASS64 || Eh->e_machine != EM_RISCV)
+        error("sim: not a RISC-V ELF64 file");
+    if(Eh->e_shoff + Eh->e_shnum * sizeof(Elf64_Shdr) > Len ||
+       Eh->e_shstrndx >= Eh->e_shnum)
+        error("sim: invalid section headers");
+
+    // 查找.text节与符号表
+    Elf64_Shdr* Sh = (Elf64_Shdr*)(Elf + Eh->e_shoff);
+    char* ShStr = (char*)Elf + Sh[Eh->e_shstrndx].sh_offset;
+    Elf64_Shdr* Text = NULL;
+    Elf64_Shdr* SymTab = NULL;
+    for(int I = 0; I < Eh->e_shnum; I++) {
+        if(!strcmp(ShStr + Sh[I].sh_name, ".text"))
+            Text = &Sh[I];
+        if(Sh[I].sh_type == SHT_SYMTAB)
+            SymTab = &Sh[I];
+    }
+    if(!Text || Text->sh_offset + Text->sh_size > Len)
+        error("sim: no .text section");
+
+    // 可执行文件按其加载地址运行，目标文件放在默认的代码段地址
+    CodeBase = Eh->e_type == ET_EXEC ? Text->sh_addr : SIM_CODE_BASE;
+    InstCnt = 0;
+    for(Elf64_Xword I = 0; I < Text->sh_size / 4; I++) {
+        uint32_t W;
+        memcpy(&W, Elf + Text->sh_offset + 4 * I, 4);
+        CurLine = I + 1;
+        decode(W, I);
+    }
+
+    // 可执行文件从入口开始运行，目标文件从main开始运行
+    int64_t Start = -1;
+    if(Eh->e_type == ET_EXEC) {
+        Start = (int64_t)(Eh->e_entry - CodeBase) / 4;
+    } else if(SymTab) {
+        Elf64_Sym* Syms = (Elf64_Sym*)(Elf + SymTab->sh_offset);
+        char* Str = (char*)Elf + Sh[SymTab->sh_link].sh_offset;
+        for(size_t I = 0; I < SymTab->sh_size / sizeof(Elf64_Sym); I++)
+            if(!strcmp(Str + Syms[I].st_name, "main"))
+                Start = Syms[I].st_value / 4;
+    }
+    if(Start < 0)
+        error("sim: no entry point");
+
+    int64_t Ret = execute(Start, Steps);
+    free(Insts);
+    Insts = NULL;
+    InstCap = 0;
+    return Ret;
+}
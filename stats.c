@@ -0,0 +1,165 @@
+#include "rvcc.h"
+
+#include <time.h>
+
+// 编译统计
+//
+// 记录每个阶段的墙上时间、CPU时间与分配的字节数，
+// 以及终结符、各种类的节点、变量、指令与标号的数量。
+// 分配的字节数为内存池与节点池在该阶段的增量，
+// 代码生成阶段另加上指令列表的容量，它由malloc分配，不在内存池中
+
+// 统计的输出格式，由--stats指定
+StatsFormat OptStats;
+
+// 阶段的名称，用于输出
+static char* PhaseNames[ST_NUM] = {
+    [ST_TOKENIZE] = "tokenize",
+    [ST_PARSE] = "parse",
+    [ST_OPTIMIZE] = "optimize",
+    [ST_SSA] = "ssa",
+    [ST_CODEGEN] = "codegen",
+};
+
+// 节点种类的数量
+#define NODE_KIND_NUM (ND_NUM + 1)
+
+// 节点种类的名称，用于输出
+static char* KindNames[NODE_KIND_NUM] = {
+    [ND_ADD] = "add",       [ND_SUB] = "sub",     [ND_MUL] = "mul",
+    [ND_DIV] = "div",       [ND_NEG] = "neg",     [ND_EQ] = "eq",
+    [ND_NE] = "ne",         [ND_LT] = "lt",       [ND_LE] = "le",
+    [ND_ASSIGN] = "assign", [ND_RETURN] = "return", [ND_IF] = "if",
+    [ND_FOR] = "for",       [ND_BLOCK] = "block", [ND_EXPR_STMT] = "expr_stmt",
+    [ND_VAR] = "var",       [ND_NUM] = "num",
+};
+
+// 每个阶段的统计
+typedef struct {
+    bool Done; // 是否已进行
+    double Wall; // 墙上时间，秒
+    double Cpu; // CPU时间，秒
+    size_t Bytes; // 分配的字节数
+    // 阶段开始时的值
+    double WallStart, CpuStart;
+    size_t BytesStart;
+} PhaseStat;
+
+static PhaseStat Phases[ST_NUM];
+
+// 终结符数，解析结束时记录
+static long Tokens;
+// 解析得到的各种类的节点数
+static long Kinds[NODE_KIND_NUM];
+
+static double clockSec(clockid_t Clock) {
+    struct timespec Ts;
+    clock_gettime(Clock, &Ts);
+    return Ts.tv_sec + Ts.tv_nsec / 1e9;
+}
+
+double nowSec(void) {
+    return clockSec(CLOCK_MONOTONIC);
+}
+
+char* statPhaseName(StatPhase P) {
+    return PhaseNames[P];
+}
+
+// 内存池与节点池已分配的字节数
+static size_t allocBytes(void) {
+    return arenaBytesUsed() + nodePoolBytes();
+}
+
+void statBegin(StatPhase P) {
+    if(OptStats == STATS_OFF)
+        return;
+    PhaseStat* S = &Phases[P];
+    S->BytesStart = allocBytes();
+    S->CpuStart = clockSec(CLOCK_PROCESS_CPUTIME_ID);
+    S->WallStart = nowSec();
+}
+
+void statEnd(StatPhase P) {
+    if(OptStats == STATS_OFF)
+        return;
+    PhaseStat* S = &Phases[P];
+    S->Wall += nowSec() - S->WallStart;
+    S->Cpu += clockSec(CLOCK_PROCESS_CPUTIME_ID) - S->CpuStart;
+    // 节点池可能被释放，此时不计入
+    size_t Bytes = allocBytes();
+    if(Bytes > S->BytesStart)
+        S->Bytes += Bytes - S->BytesStart;
+    if(P == ST_CODEGEN)
+        S->Bytes += CgStats.InstBytes;
+    S->Done = true;
+
+    // 解析结束时统计终结符与节点，此时节点尚未被优化改写
+    if(P == ST_PARSE) {
+        Tokens += tokenCount();
+        for(uint32_t I = 1; I < nodeCount(); I++)
+            Kinds[getNode(I)->Kind]++;
+    }
+}
+
+void statReport(Function* Prog, FILE* Out) {
+    if(OptStats == STATS_OFF)
+        return;
+
+    long NumNodes = 0;
+    for(int I = 0; I < NODE_KIND_NUM; I++)
+        NumNodes += Kinds[I];
+    long NumObjs = 0;
+    for(Obj* Var = Prog->Locals; Var; Var = Var->Next)
+        NumObjs++;
+
+    double Wall = 0, Cpu = 0;
+    size_t Bytes = 0;
+    for(int P = 0; P < ST_NUM; P++) {
+        Wall += Phases[P].Wall;
+        Cpu += Phases[P].Cpu;
+        Bytes += Phases[P].Bytes;
+    }
+
+    if(OptStats == STATS_JSON) {
+        fprintf(Out, "{\"phases\":{");
+        bool First = true;
+        for(int P = 0; P < ST_NUM; P++) {
+            PhaseStat* S = &Phases[P];
+            if(!S->Done)
+                continue;
+            fprintf(Out, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"bytes\":%zu}",
+                    First ? "" : ",", PhaseNames[P], S->Wall * 1e3, S->Cpu * 1e3,
+                    S->Bytes);
+            First = false;
+        }
+        fprintf(Out, "},\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"bytes\":%zu}",
+                Wall * 1e3, Cpu * 1e3, Bytes);
+        fprintf(Out, ",\"tokens\":%ld,\"nodes\":{\"total\":%ld", Tokens, NumNodes);
+        for(int I = 0; I < NODE_KIND_NUM; I++)
+            fprintf(Out, ",\"%s\":%ld", KindNames[I], Kinds[I]);
+        fprintf(Out, "},\"objs\":%ld,\"insts\":%ld,\"labels\":%ld,\"max_depth\":%d}\n",
+                NumObjs, CgStats.Insts, CgStats.Labels, CgStats.MaxDepth);
+        return;
+    }
+
+    fprintf(Out, "stats:\n");
+    fprintf(Out, "  %-14s %10s %10s %12s\n", "phase", "wall(ms)", "cpu(ms)", "bytes");
+    for(int P = 0; P < ST_NUM; P++) {
+        PhaseStat* S = &Phases[P];
+        if(S->Done)
+            fprintf(Out, "  %-14s %10.3f %10.3f %12zu\n", PhaseNames[P],
+                    S->Wall * 1e3, S->Cpu * 1e3, S->Bytes);
+    }
+    fprintf(Out, "  %-14s %10.3f %10.3f %12zu\n", "total", Wall * 1e3, Cpu * 1e3,
+            Bytes);
+    fprintf(Out, "  %-14s %ld\n", "tokens", Tokens);
+    fprintf(Out, "  %-14s %ld\n", "nodes", NumNodes);
+    for(int I = 0; I < NODE_KIND_NUM; I++)
+        if(Kinds[I])
+            fprintf(Out, "    %-12s %ld\n", KindNames[I], Kinds[I]);
+    fprintf(Out, "  %-14s %ld\n", "objs", NumObjs);
+    fprintf(Out, "  %-14s %ld\n", "insts", CgStats.Insts);
+    fprintf(Out, "  %-14s %ld\n", "labels", CgStats.Labels);
+    fprintf(Out, "  %-14s %d\n", "max-depth", CgStats.MaxDepth);
+}
@@ -1,5 +1,20 @@
 #!/bin/bash
 
+# 默认使用rvcc --run在内置模拟器中运行测试
+# 设置RVCC_QEMU=1时，改用riscv64交叉工具链与qemu运行
+# 传入--stress时，只运行本脚本中的压力测试，不运行测试用例表
+
+# rvcc与测试驱动的路径
+RVCC=${RVCC:-./build/rvcc}
+RVCC_TEST=${RVCC_TEST:-./build/rvcc_test}
+
+# 临时文件所在的目录
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# 失败的用例数
+failed=0
+
 assert()
 {
     # 预期结果为参数1
@@ -7,103 +22,183 @@ assert()
     # 实际输入值
     input="$2"
 
-    # 成功执行 || 之前的语句时将会短路exit
-    ./build/rvcc "$input" > ./assembly/tmp.s || exit
-    riscv64-unknown-linux-gnu-gcc -static ./assembly/tmp.s -o ./assembly/tmp
-    qemu-riscv64 -L $RISCV/sysroot ./assembly/tmp
-    # spike --isa=rv64gc $RISCV/riscv64-unknown-linux-gnu/bin/pk ./assembly/tmp
+    # 将输入写入文件后编译
+    printf '%s' "$input" > $TMP/tmp.c
+
+    if [ -n "$RVCC_QEMU" ]; then
+        # 使用交叉工具链与qemu运行
+        # 成功执行 || 之前的语句时将会短路exit
+        $RVCC -o $TMP/tmp.s $TMP/tmp.c || exit
+        riscv64-unknown-linux-gnu-gcc -static $TMP/tmp.s -o $TMP/tmp
+        qemu-riscv64 -L $RISCV/sysroot $TMP/tmp
+        # spike --isa=rv64gc $RISCV/riscv64-unknown-linux-gnu/bin/pk $TMP/tmp
+    else
+        # 默认在rvcc内置的模拟器中运行
+        $RVCC --run $TMP/tmp.c
+    fi
 
     # 实际结果
     actual="$?"
 
+    # 输入可能很长，只输出前80个字符
     if [ "$actual" == "$expected" ]; then
-        echo "$input => $actual"
+        echo "${input:0:80} => $actual"
     else
-        echo "$input => $expected expected, but got $actual"
+        echo "${input:0:80} => $expected expected, but got $actual"
+        failed=$((failed + 1))
+    fi
+}
+
+# 测试用例表由rvcc_test并行运行
+if [ "$1" != "--stress" ]; then
+    $RVCC_TEST --rvcc $RVCC ${RVCC_QEMU:+--qemu} ./test/cases.txt
+    failed=$?
+fi
+
+# 编译应当失败，且错误信息中包含参数2，参数1为优化选项
+assertError()
+{
+    printf '%s' "$3" > $TMP/err.c
+    if $RVCC $1 -o /dev/null $TMP/err.c 2> $TMP/err.txt; then
+        echo "$1: ${3:0:80} => error expected, but compiled"
+        failed=$((failed + 1))
+    elif ! grep -qF "$2" $TMP/err.txt; then
+        echo "$1: ${3:0:80} => \"$2\" expected, but got: $(cat $TMP/err.txt)"
+        failed=$((failed + 1))
+    fi
+}
+
+# 赋值的左边不是变量时，各级优化都应报错，而不是在优化中崩溃
+for flag in -O0 -O1 -fssa; do
+    assertError $flag "not a lvalue" "{ a=1; (a+1)=3; return a; }"
+    assertError $flag "not a lvalue" "{ 1=2; return 0; }"
+    # 循环的分析只在-O1下进行
+    assertError $flag "not a lvalue" "{ for(i=0; i<3; i=i+1) (i+1)=2; return 0; }"
+done
+
+# --stats=json输出到标准错误的统计应当是合法的JSON，且包含终结符、节点与各阶段
+printf '%s' '{ a=1; for(i=0; i<3; i=i+1) a=a*2; return a; }' > $TMP/stats.c
+$RVCC --stats=json -o /dev/null $TMP/stats.c 2> $TMP/stats.json || exit
+if command -v python3 > /dev/null && ! python3 - $TMP/stats.json <<'EOF2'
+import json, sys
+S = json.load(open(sys.argv[1]))
+assert S["tokens"] > 0 and S["nodes"]["total"] > 0 and S["nodes"]["for"] == 1
+assert all(P in S["phases"] for P in ("tokenize", "parse", "optimize", "codegen"))
+EOF2
+then
+    echo "--stats=json: invalid output: $(cat $TMP/stats.json)"
+    failed=$((failed + 1))
+fi
+
+# 开启统计时，--run的退出码仍为程序的返回值
+$RVCC --stats --run $TMP/stats.c 2> /dev/null
+actual="$?"
+if [ "$actual" != 8 ]; then
+    echo "--stats --run: 8 expected, but got $actual"
+    failed=$((failed + 1))
+fi
+
+# 从文件读取，文件大小恰为页大小的整数倍
+assert 42 "$(printf '%-4096s' 'return 42;')"
+
+# 生成含有N个不同变量的程序，返回值为42
+genVars()
+{
+    printf '{ '
+    for ((I = 0; I < $1; I++)); do
+        printf 'v%d=%d; ' $I $I
+    done
+    printf 'return v%d-v%d; }' $(($1 - 1)) $(($1 - 43))
+}
+
+# 编译5次所用的纳秒数
+compileTime()
+{
+    start=$(date +%s%N)
+    for ((K = 0; K < 5; K++)); do
+        printf '%s' "$1" | $RVCC -o /dev/null - || exit
+    done
+    echo $(($(date +%s%N) - start))
+}
+
+# 变量查找的压力测试，10000个不同的变量
+assert 42 "$(genVars 10000)"
+
+# 变量数增加4倍时，编译时间应近似线性增长，而不是平方级增长
+small=$(compileTime "$(genVars 2500)")
+large=$(compileTime "$(genVars 10000)")
+if [ $((large / small)) -ge 10 ]; then
+    echo "parsing does not scale linearly: ${small}ns for 2500 vars, ${large}ns for 10000 vars"
+    failed=$((failed + 1))
+fi
+
+# 将字符串$2重复$1次
+repeat()
+{
+    printf '%*s' $1 '' | sed "s/ /$2/g"
+}
+
+# 生成嵌套N层的表达式a+(a+(...a))，返回值为(N+1)&255
+genNested()
+{
+    printf '{ a=1; return %s%s%s; }' "$(repeat $1 'a+(')" a "$(repeat $1 ')')"
+}
+
+# 表达式的解析与遍历不使用递归，嵌套10^6层也不会耗尽调用栈
+assert 1 "{ a=1; return $(repeat 1000000 '(')a$(repeat 1000000 ')'); }"
+assert 1 "{ a=1; return $(repeat 1000000 '-')a; }"
+assert 5 "{ a=1; return $(repeat 1000000 'a=')5; }"
+assert 65 "$(genNested 1000000)"
+
+# 嵌套层数增加4倍时，编译时间应近似线性增长
+small=$(compileTime "$(genNested 250000)")
+large=$(compileTime "$(genNested 1000000)")
+if [ $((large / small)) -ge 10 ]; then
+    echo "nesting does not scale linearly: ${small}ns for 250000 levels, ${large}ns for 1000000 levels"
+    failed=$((failed + 1))
+fi
+
+# 直接输出的可执行文件由模拟器解码运行
+assertExe()
+{
+    printf '%s' "$2" > $TMP/exe.c
+    $RVCC --emit=exe --run $TMP/exe.c
+    actual="$?"
+    if [ "$actual" != "$1" ]; then
+        echo "--emit=exe: ${2:0:80} => $1 expected, but got $actual"
+        failed=$((failed + 1))
+    fi
+}
+
+# 跳转距离超出±4KiB与±1MiB，需要分支松弛，返回值为300000*3&255
+assertExe 160 "{ a=0; for(i=0; i<3; i=i+1) { if(a<100000000) { $(repeat 300000 'a=a+1; ') } } return a; }"
+# 各种位数的立即数
+assertExe 42 "{ a=81985529216486895; b=-2147483648; c=4294967295; return (a-81985529216486895+b+2147483648+c-4294967253); }"
+
+# 与外部汇编器得到的机器码逐条比较，没有llvm-mc与llvm-objdump时跳过
+roundTrip()
+{
+    printf '%s' "$2" > $TMP/rt.c
+    $RVCC $1 -o $TMP/rt.s $TMP/rt.c || exit
+    $RVCC $1 --emit=obj -o $TMP/rt.o $TMP/rt.c || exit
+    llvm-mc -triple=riscv64 -mattr=+m -filetype=obj -o $TMP/ref.o $TMP/rt.s || exit
+    if ! cmp -s <(llvm-objdump -d --mattr=+m $TMP/rt.o | tail -n +4) \
+                <(llvm-objdump -d --mattr=+m $TMP/ref.o | tail -n +4); then
+        echo "--emit=obj $1: machine code differs from llvm-mc: ${2:0:80}"
+        failed=$((failed + 1))
     fi
 }
 
-# assert 期待值 输入值
-# [1] 返回指定数值
-assert 0 'return 0;'
-assert 42 'return 42;'
-
-# [2] 支持+ -运算符
-assert 34 'return 12-34+56;'
-
-# [3] 支持空格
-assert 41 'return  12 + 34 - 5 ;'
-
-# [5] 支持* / ()运算符
-assert 47 'return 5+6*7;'
-assert 15 'return 5*(9-6);'
-assert 17 'return 1-8/(2*2)+3*6;'
-
-# [6] 支持一元运算的+ -
-assert 10 'return -10+20;'
-assert 10 'return - -10;'
-assert 10 'return - - +10;'
-assert 48 'return ------12*+++++----++++++++++4;'
-
-# [7] 支持条件运算符
-assert 0 'return 0==1;'
-assert 1 'return 42==42;'
-assert 1 'return 0!=1;'
-assert 0 'return 42!=42;'
-assert 1 'return 0<1;'
-assert 0 'return 1<1;'
-assert 0 'return 2<1;'
-assert 1 'return 0<=1;'
-assert 1 'return 1<=1;'
-assert 0 'return 2<=1;'
-assert 1 'return 1>0;'
-assert 0 'return 1>1;'
-assert 0 'return 1>2;'
-assert 1 'return 1>=0;'
-assert 1 'return 1>=1;'
-assert 0 'return 1>=2;'
-assert 1 'return 5==2+3;'
-assert 0 'return 6==4+3;'
-assert 1 'return 0*9+5*2==4+4*(6/3)-2;'
-
-# [9] 支持;分割语句
-assert 3 '1; 2;return 3;'
-assert 12 '12+23;12+99/3;return 78-66;'
-
-# [10] 支持单字母变量
-assert 3 'a=3;return a;'
-assert 8 'a=3; z=5;return a+z;'
-assert 6 'a=b=3;return a+b;'
-assert 5 'a=3;b=4;a=1;return a+b;'
-
-# [11] 支持多字母变量
-assert 3 'foo=3;return foo;'
-assert 74 'foo2=70; bar4=4;return foo2+bar4;'
-
-# [12] 支持return
-assert 1 'return 1; 2; 3;'
-assert 2 '1; return 2; 3;'
-assert 3 '1; 2; return 3;'
-
-# [13] 支持{...}
-assert 3 '{ {1; {2;} return 3;} }'
-
-# [14] 支持空语句
-assert 5 '{ ;;; return 5; }'
-
-# [15] 支持if语句
-assert 3 '{ if (0) return 2; return 3; }'
-assert 3 '{ if (1-1) return 2; return 3; }'
-assert 2 '{ if (1) return 2; return 3; }'
-assert 2 '{ if (2-1) return 2; return 3; }'
-assert 4 '{ if (0) { 1; 2; return 3; } else { return 4; } }'
-assert 3 '{ if (1) { 1; 2; return 3; } else { return 4; } }'
-
-# [16] 支持for语句
-assert 55 '{ i=0; j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
-assert 3 '{ for (;;) {return 3;} return 5; }'
-
-# [17] 支持while语句
-assert 10 '{ i=0; while(i<10) { i=i+1; } return i; }'
+if command -v llvm-mc > /dev/null && command -v llvm-objdump > /dev/null; then
+    prog="{ a=0; b=5000; for(i=0; i<10; i=i+1) { if(a<i*3) a=a+i; else a=a-1; for(j=0; j<i; j=j+1) a=a*2/3+j-b; if(a==b) return -a; } return a!=b; }"
+    for flag in -O0 -O1 -fssa; do
+        roundTrip $flag "$prog"
+    done
+fi
+
+if [ $failed -ne 0 ]; then
+    echo "$failed test(s) failed"
+    exit 1
+fi
 
 echo "ok"
\ No newline at end of file
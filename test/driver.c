@@ -0,0 +1,341 @@
+// rvcc的并行测试驱动
+// 读取测试用例表，在线程池中并行运行每个用例，每个线程使用独立的临时目录，
+// 最后输出通过与失败的统计及耗时，并以失败的用例数作为退出码
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// 测试用例
+typedef struct {
+    int Line; // 在用例表中的行号
+    int Expected; // 期待的退出码
+    bool ExpectError; // 是否期待编译失败
+    char* Src; // 输入的程序
+    int Actual; // 实际的退出码，编译失败时为-1
+    bool Passed; // 是否通过
+    double Ms; // 耗时，毫秒
+    char Err[256]; // 失败时的错误输出
+} Case;
+
+static Case* Cases;
+static int CaseCnt;
+
+// 下一个待运行的用例
+static int NextCase;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 命令行选项
+static char* OptRvcc = "./build/rvcc";
+static bool OptQemu;
+static bool OptVerbose;
+static int OptJobs;
+// 额外传给rvcc的参数
+static char* OptFlags[8];
+static int FlagCnt;
+
+static void usage(int Status) {
+    fprintf(stderr, "rvcc_test [ -j <jobs> ] [ --rvcc <path> ] [ --flag <arg> ]... "
+                    "[ --qemu ] [ -v ] <cases>...\n");
+    exit(Status);
+}
+
+static void fatal(char* Fmt, char* Arg) {
+    fprintf(stderr, "rvcc_test: ");
+    fprintf(stderr, Fmt, Arg, strerror(errno));
+    fprintf(stderr, "\n");
+    exit(255);
+}
+
+// 当前时间，毫秒
+static double nowMs(void) {
+    struct timespec Ts;
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return Ts.tv_sec * 1e3 + Ts.tv_nsec / 1e6;
+}
+
+// 读取用例表，每行格式为：期待值 输入程序
+// 期待值为!时，输入程序应当编译失败
+static void readCases(char* Path) {
+    FILE* In = fopen(Path, "r");
+    if(!In)
+        fatal("cannot open %s: %s", Path);
+
+    char* Buf = NULL;
+    size_t Cap = 0;
+    ssize_t Len;
+    int Line = 0;
+    static int CaseCap;
+
+    while((Len = getline(&Buf, &Cap, In)) >= 0) {
+        Line++;
+        // 去掉行尾的换行
+        while(Len > 0 && (Buf[Len - 1] == '\n' || Buf[Len - 1] == '\r'))
+            Buf[--Len] = '\0';
+        // 跳过空行和注释
+        if(Len == 0 || Buf[0] == '#')
+            continue;
+
+        char* P;
+        long Expected = strtol(Buf, &P, 10);
+        bool ExpectError = Buf[0] == '!';
+        if(ExpectError)
+            P = Buf + 1;
+        if((P == Buf && !ExpectError) || *P != ' ') {
+            fprintf(stderr, "%s:%d: invalid test case\n", Path, Line);
+            exit(255);
+        }
+
+        if(CaseCnt == CaseCap) {
+            CaseCap = CaseCap ? CaseCap * 2 : 128;
+            Cases = realloc(Cases, sizeof(Case) * CaseCap);
+        }
+        Case* C = &Cases[CaseCnt++];
+        memset(C, 0, sizeof(*C));
+        C->Line = Line;
+        C->Expected = (int)Expected;
+        C->ExpectError = ExpectError;
+        C->Src = strdup(P + 1);
+    }
+
+    free(Buf);
+    fclose(In);
+}
+
+// 运行一个命令，标准输出和标准错误写入ErrPath，返回退出码，异常退出时返回-1
+static int run(char** Argv, char* ErrPath) {
+    posix_spawn_file_actions_t Acts;
+    posix_spawn_file_actions_init(&Acts);
+    posix_spawn_file_actions_addopen(&Acts, STDOUT_FILENO, ErrPath,
+                                     O_WRONLY | O_CREAT | O_APPEND, 0644);
+    posix_spawn_file_actions_adddup2(&Acts, STDOUT_FILENO, STDERR_FILENO);
+
+    pid_t Pid;
+    int Ret = posix_spawnp(&Pid, Argv[0], &Acts, NULL, Argv, environ);
+    posix_spawn_file_actions_destroy(&Acts);
+    if(Ret != 0)
+        return -1;
+
+    int Status;
+    while(waitpid(Pid, &Status, 0) < 0)
+        if(errno != EINTR)
+            return -1;
+    return WIFEXITED(Status) ? WEXITSTATUS(Status) : -1;
+}
+
+// 读取文件开头的内容，用于报告错误
+static void readErr(char* Path, char* Buf, size_t Size) {
+    Buf[0] = '\0';
+    FILE* In = fopen(Path, "r");
+    if(!In)
+        return;
+    size_t N = fread(Buf, 1, Size - 1, In);
+    Buf[N] = '\0';
+    fclose(In);
+}
+
+// 在临时目录Dir中运行一个用例
+static void runCase(Case* C, char* Dir) {
+    char Src[4096], Asm[4096], Exe[4096], Err[4096];
+    snprintf(Src, sizeof(Src), "%s/tmp.c", Dir);
+    snprintf(Asm, sizeof(Asm), "%s/tmp.s", Dir);
+    snprintf(Exe, sizeof(Exe), "%s/tmp", Dir);
+    snprintf(Err, sizeof(Err), "%s/err.txt", Dir);
+
+    double Start = nowMs();
+
+    FILE* Out = fopen(Src, "w");
+    if(!Out)
+        fatal("cannot write %s: %s", Src);
+    fputs(C->Src, Out);
+    fclose(Out);
+    unlink(Err);
+
+    if(C->ExpectError) {
+        // 只编译，rvcc报错时以1退出，崩溃等异常退出不算作编译失败
+        char* Compile[16] = {OptRvcc, "-o", "/dev/null"};
+        int N = 3;
+        for(int I = 0; I < FlagCnt; I++)
+            Compile[N++] = OptFlags[I];
+        Compile[N++] = Src;
+        C->Actual = run(Compile, Err);
+        C->Passed = C->Actual == 1;
+    } else if(OptQemu) {
+        // 使用交叉工具链与qemu运行
+        char* Compile[16] = {OptRvcc, "-o", Asm};
+        int N = 3;
+        for(int I = 0; I < FlagCnt; I++)
+            Compile[N++] = OptFlags[I];
+        Compile[N++] = Src;
+        char* Link[] = {"riscv64-unknown-linux-gnu-gcc", "-static", Asm, "-o",
+                        Exe, NULL};
+        char Sysroot[4096];
+        snprintf(Sysroot, sizeof(Sysroot), "%s/sysroot",
+                 getenv("RISCV") ? getenv("RISCV") : "");
+        char* Qemu[] = {"qemu-riscv64", "-L", Sysroot, Exe, NULL};
+
+        if(run(Compile, Err) != 0 || run(Link, Err) != 0)
+            C->Actual = -1;
+        else
+            C->Actual = run(Qemu, Err);
+        C->Passed = C->Actual == C->Expected;
+    } else {
+        // 在rvcc内置的模拟器中运行，退出码为程序的返回值，
+        // 编译或运行出错时rvcc被SIGABRT终止，run返回-1，不会与返回值混淆
+        char* Run[16] = {OptRvcc, "--run"};
+        int N = 2;
+        for(int I = 0; I < FlagCnt; I++)
+            Run[N++] = OptFlags[I];
+        Run[N++] = Src;
+        C->Actual = run(Run, Err);
+        C->Passed = C->Actual == C->Expected;
+    }
+
+    C->Ms = nowMs() - Start;
+    if(!C->Passed)
+        readErr(Err, C->Err, sizeof(C->Err));
+}
+
+// 工作线程，不断取出下一个用例运行
+static void* worker(void* Arg) {
+    (void)Arg;
+    char Dir[] = "/tmp/rvcc_test.XXXXXX";
+    if(!mkdtemp(Dir))
+        fatal("cannot create temporary directory %s: %s", Dir);
+
+    while(true) {
+        pthread_mutex_lock(&Lock);
+        int I = NextCase++;
+        pthread_mutex_unlock(&Lock);
+        if(I >= CaseCnt)
+            break;
+        runCase(&Cases[I], Dir);
+    }
+
+    // 清理临时目录
+    char* Files[] = {"tmp.c", "tmp.s", "tmp", "err.txt"};
+    for(size_t I = 0; I < sizeof(Files) / sizeof(*Files); I++) {
+        char Path[4096];
+        snprintf(Path, sizeof(Path), "%s/%s", Dir, Files[I]);
+        unlink(Path);
+    }
+    rmdir(Dir);
+    return NULL;
+}
+
+int main(int Argc, char** Argv) {
+    char** Paths = calloc(Argc, sizeof(char*));
+    int PathCnt = 0;
+
+    for(int I = 1; I < Argc; I++) {
+        if(!strcmp(Argv[I], "-h") || !strcmp(Argv[I], "--help"))
+            usage(0);
+        if(!strcmp(Argv[I], "-j")) {
+            if(!Argv[++I])
+                usage(255);
+            OptJobs = atoi(Argv[I]);
+            continue;
+        }
+        if(!strcmp(Argv[I], "--rvcc")) {
+            if(!Argv[++I])
+                usage(255);
+            OptRvcc = Argv[I];
+            continue;
+        }
+        if(!strcmp(Argv[I], "--flag")) {
+            if(!Argv[++I] || FlagCnt == sizeof(OptFlags) / sizeof(*OptFlags))
+                usage(255);
+            OptFlags[FlagCnt++] = Argv[I];
+            continue;
+        }
+        if(!strcmp(Argv[I], "--qemu")) {
+            OptQemu = true;
+            continue;
+        }
+        if(!strcmp(Argv[I], "-v")) {
+            OptVerbose = true;
+            continue;
+        }
+        if(Argv[I][0] == '-')
+            usage(255);
+        Paths[PathCnt++] = Argv[I];
+    }
+    if(PathCnt == 0)
+        usage(255);
+
+    for(int I = 0; I < PathCnt; I++)
+        readCases(Paths[I]);
+
+    // 默认每个CPU核心一个工作线程
+    if(OptJobs <= 0)
+        OptJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(OptJobs <= 0)
+        OptJobs = 1;
+    if(OptJobs > CaseCnt)
+        OptJobs = CaseCnt ? CaseCnt : 1;
+
+    double Start = nowMs();
+    pthread_t* Threads = calloc(OptJobs, sizeof(pthread_t));
+    for(int I = 0; I < OptJobs; I++)
+        pthread_create(&Threads[I], NULL, worker, NULL);
+    for(int I = 0; I < OptJobs; I++)
+        pthread_join(Threads[I], NULL);
+    double Wall = nowMs() - Start;
+
+    // 按用例表的顺序输出结果
+    int Failed = 0;
+    double Total = 0;
+    Case* Slowest = NULL;
+    for(int I = 0; I < CaseCnt; I++) {
+        Case* C = &Cases[I];
+        Total += C->Ms;
+        if(!Slowest || C->Ms > Slowest->Ms)
+            Slowest = C;
+
+        if(C->Passed) {
+            if(OptVerbose && C->ExpectError)
+                printf("PASS %8.2fms  %s => error\n", C->Ms, C->Src);
+            else if(OptVerbose)
+                printf("PASS %8.2fms  %s => %d\n", C->Ms, C->Src, C->Actual);
+            continue;
+        }
+
+        Failed++;
+        if(C->ExpectError && C->Actual == 0)
+            printf("FAIL %8.2fms  line %d: %s => error expected, but compiled\n",
+                   C->Ms, C->Line, C->Src);
+        else if(C->ExpectError)
+            printf("FAIL %8.2fms  line %d: %s => error expected, but crashed\n",
+                   C->Ms, C->Line, C->Src);
+        else if(C->Actual < 0)
+            printf("FAIL %8.2fms  line %d: %s => %d expected, but failed\n",
+                   C->Ms, C->Line, C->Src, C->Expected);
+        else
+            printf("FAIL %8.2fms  line %d: %s => %d expected, but got %d\n",
+                   C->Ms, C->Line, C->Src, C->Expected, C->Actual);
+        if(C->Err[0])
+            printf("%s", C->Err);
+    }
+
+    printf("%d passed, %d failed, %d total; %.1fms wall, %.1fms in cases, "
+           "%d jobs\n",
+           CaseCnt - Failed, Failed, CaseCnt, Wall, Total, OptJobs);
+    if(Slowest)
+        printf("slowest: %.2fms line %d\n", Slowest->Ms, Slowest->Line);
+
+    // 退出码为失败的用例数，超过255时截断为255
+    return Failed > 255 ? 255 : Failed;
+}
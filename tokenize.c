@@ -1,9 +1,38 @@
 #include "rvcc.h"
 
+#include <signal.h>
+#include <sys/resource.h>
+
 static char* CurrentInput;
 
+// 为真时出错以SIGABRT终止，而不是以状态1退出。
+// --run以程序的返回值作为退出码，0到255都可能是程序的结果，
+// 只有被信号终止才能与之区分
+bool AbortOnError;
+
+// 出错后终止程序
+_Noreturn void die(void) {
+    if(AbortOnError) {
+        // 不生成core文件
+        setrlimit(RLIMIT_CORE, &(struct rlimit){0, 0});
+        signal(SIGABRT, SIG_DFL);
+        abort();
+    }
+    exit(1);
+}
+
+// 计算FNV-1a哈希值
+uint32_t hashBytes(char* Loc, int Len) {
+    uint32_t Hash = 2166136261u;
+    for(int I = 0; I < Len; I++) {
+        Hash ^= (unsigned char)Loc[I];
+        Hash *= 16777619u;
+    }
+    return Hash;
+}
+
 // 错误处理函数
-void error(char* Fmt, ...)
+_Noreturn void error(char* Fmt, ...)
 {
     va_list VA;
 
@@ -17,16 +46,24 @@ void error(char* Fmt, ...)
     //清除VA
     va_end(VA);
 
-    exit(1);
+    die();
 }
 
 // 错误出现的位置
 void verrorAt(char* Loc, char* Fmt, va_list VA) {
-    // 先输出源字符串
-    fprintf(stderr, "%s\n", CurrentInput);
-
-    // 计算出错位置, Loc是出错位置的指针，CurrentInput是当前输入的首地址
-    int Pos = Loc - CurrentInput;
+    // 找到出错位置所在行的行首和行尾
+    char* Line = Loc;
+    while(CurrentInput < Line && Line[-1] != '\n')
+        Line--;
+    char* End = Loc;
+    while(*End && *End != '\n')
+        End++;
+
+    // 先输出出错的那一行源代码，输入可能很大，不输出整个输入
+    fprintf(stderr, "%.*s\n", (int)(End - Line), Line);
+
+    // 计算出错位置, Loc是出错位置的指针，Line是所在行的首地址
+    int Pos = Loc - Line;
     // 将字符串补齐Pos位，补齐字符为空格
     fprintf(stderr, "%*s", Pos, "");
     fprintf(stderr, "^ ");
@@ -36,19 +73,19 @@ void verrorAt(char* Loc, char* Fmt, va_list VA) {
 }
 
 // 字符解析出错，退出程序
-void errorAt(char* Loc, char* Fmt, ...) {
+_Noreturn void errorAt(char* Loc, char* Fmt, ...) {
     va_list VA;
     va_start(VA, Fmt);
     verrorAt(Loc, Fmt, VA);
-    exit(1);
+    die();
 }
 
 // Tok解析出错，并退出程序
-void errorTok(Token* Tok, char* Fmt, ...) {
+_Noreturn void errorTok(Token* Tok, char* Fmt, ...) {
     va_list VA;
     va_start(VA, Fmt);
     verrorAt(Tok->Loc, Fmt, VA);
-    exit(1);
+    die();
 }
 
 // 判断Tok是否等于指定值
@@ -70,140 +107,372 @@ bool equal(Token* Tok, char* Str) {
 Token* skip(Token* Tok, char* Str) {
     if(!equal(Tok, Str))
         errorTok(Tok, "expect '%s'", Str);
-    return Tok->Next;
+    return nextToken(Tok);
+}
+
+// 操作符与关键字的拼写
+static char* SymName[SYM_NUM] = {
+    [SYM_ADD] = "+",      [SYM_SUB] = "-",      [SYM_MUL] = "*",
+    [SYM_DIV] = "/",      [SYM_EQ] = "==",      [SYM_NE] = "!=",
+    [SYM_LT] = "<",       [SYM_LE] = "<=",      [SYM_GT] = ">",
+    [SYM_GE] = ">=",      [SYM_ASSIGN] = "=",   [SYM_LPAREN] = "(",
+    [SYM_RPAREN] = ")",   [SYM_LBRACE] = "{",   [SYM_RBRACE] = "}",
+    [SYM_SEMI] = ";",     [SYM_RETURN] = "return", [SYM_IF] = "if",
+    [SYM_ELSE] = "else",  [SYM_FOR] = "for",    [SYM_WHILE] = "while",
+};
+
+// 跳过操作符或关键字Sym，不匹配时报错
+Token* skipSym(Token* Tok, Symbol Sym) {
+    if(!isSym(Tok, Sym))
+        errorTok(Tok, "expect '%s'", SymName[Sym]);
+    return nextToken(Tok);
 }
 
 // 返回TK_NUM的值
-static int getNumber(Token* Tok)
+static int64_t getNumber(Token* Tok)
 {
     if(Tok->Kind != TK_NUM)
         errorTok(Tok, "expect a number");
     return Tok->Val;
 }
 
-// 生成新的Token
-static Token* newToken(TokenKind Kind, char* Start, char* End) {
-    // 分配一个Token的内存空间
-    Token* Tok = calloc(1, sizeof(Token));
+// 设置Token的种类与位置
+static void setToken(Token* Tok, TokenKind Kind, char* Start, char* End) {
     Tok->Kind = Kind;
     Tok->Loc = Start;
     Tok->Len = End - Start;
-    return Tok;
+    Tok->Sym = SYM_NONE;
+    Tok->Val = 0;
 }
 
-// 判断Str是否以SubStr开头
-bool startWith(char* Str, char* SubStr)
-{
-    // 比较LHS和RHS的N个字符是否相等
-    return strncmp(Str, SubStr, strlen(SubStr)) == 0;
-}
+// 字符类别，由CharClass表给出，替代依赖locale的ctype函数
+#define CC_SPACE 1 // 空白字符 [ \t\n\v\f\r]
+#define CC_DIGIT 2 // 数字 [0-9]
+#define CC_IDENT1 4 // 标记符的首字母 [a-zA-Z_]
+#define CC_IDENT2 8 // 标记符的非首字母 [a-zA-Z0-9_]
+#define CC_PUNCT 16 // 操作符，即除字母、数字、空格外的可打印ASCII字符
+
+// 每个字节对应的字符类别
+static uint8_t CharClass[256];
+// 单字节操作符对应的编号
+static uint8_t PunctSym[256];
+
+// 判断字符C是否属于类别Class
+#define charIs(C, Class) (CharClass[(unsigned char)(C)] & (Class))
+
+// 初始化字符类别表
+static void initCharClass(void) {
+    for(int C = 0; C < 256; C++) {
+        uint8_t Class = 0;
+        if(C == ' ' || ('\t' <= C && C <= '\r'))
+            Class |= CC_SPACE;
+        if('0' <= C && C <= '9')
+            Class |= CC_DIGIT | CC_IDENT2;
+        if(('a' <= C && C <= 'z') || ('A' <= C && C <= 'Z') || C == '_')
+            Class |= CC_IDENT1 | CC_IDENT2;
+        if(33 <= C && C <= 126 && !(Class & CC_IDENT2))
+            Class |= CC_PUNCT;
+        CharClass[C] = Class;
+    }
 
-// 判断标记符的首字母规则
-// [a-zA-Z_]
-static bool isIdent1(char C) {
-    return ('a' <= C && C <= 'z') || ('A' <= C && C <= 'Z') || (C == '_');
+    for(int I = 0; I < SYM_NUM; I++)
+        if(SymName[I] && SymName[I][1] == '\0' && charIs(SymName[I][0], CC_PUNCT))
+            PunctSym[(unsigned char)SymName[I][0]] = I;
 }
 
-// 判断标记符的非首字母规则
-// [a-zA-Z0-9_]
-static bool isIdent2(char C) {
-    return isIdent1(C) || ('0' <= C && C <= '9');
+// 标量实现：返回从P开始第一个不属于类别Class的字符
+static char* scanScalar(char* P, int Class) {
+    while(charIs(*P, Class))
+        P++;
+    return P;
 }
 
-// 读取操作符
-static int readPunct(char* Ptr)
-{
-    // 判断2字节操作符
-    if(startWith(Ptr, "==") || startWith(Ptr, "!=") || 
-       startWith(Ptr, "<=") || startWith(Ptr, ">="))
-       return 2;
+#ifdef __x86_64__
+#include <immintrin.h>
 
-    // 判断1字节操作符
-    return ispunct(*Ptr) ? 1 : 0;
+// 从P读取N个字节不会跨越页边界，此时即使越过结尾的'\0'读取也是安全的
+static bool loadIsSafe(char* P, size_t N) {
+    return ((uintptr_t)P & 4095) <= 4096 - N;
 }
 
-// 判断是否为关键字
-static bool isKeyword(Token* Tok) {
-    //关键字列表
-    static char* Kw[] = {"return", "if", "else", "for", "while"};
-
-    //遍历关键字列表进行匹配
-    //每个数组的元素是一样的，所以先算出总的长素，然后处以单独元素的长度
-    for(int I = 0; I < sizeof(Kw) / sizeof(*Kw); I++) {
-        if(equal(Tok, Kw[I]))
-            return true;
+// SSE2实现：每次检查16个字节，返回属于Class的字节的位掩码
+static unsigned classMask16(__m128i C, int Class) {
+    // 字节在[Lo, Hi]之间，有符号比较，非ASCII字节为负数，不在任何区间中
+#define IN_RANGE16(X, Lo, Hi)                                                 \
+    _mm_and_si128(_mm_cmpgt_epi8(X, _mm_set1_epi8((Lo) - 1)),                \
+                  _mm_cmplt_epi8(X, _mm_set1_epi8((Hi) + 1)))
+
+    if(Class == CC_SPACE)
+        return _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(C, _mm_set1_epi8(' ')), IN_RANGE16(C, '\t', '\r')));
+
+    __m128i M = IN_RANGE16(C, '0', '9');
+    if(Class == CC_IDENT2) {
+        // 将大写字母转为小写后判断
+        __m128i Lower = _mm_or_si128(C, _mm_set1_epi8(0x20));
+        M = _mm_or_si128(M, IN_RANGE16(Lower, 'a', 'z'));
+        M = _mm_or_si128(M, _mm_cmpeq_epi8(C, _mm_set1_epi8('_')));
     }
-
-    return false;
+    return _mm_movemask_epi8(M);
+#undef IN_RANGE16
 }
 
-// 遍历标识符链表，将所有关键字进行标识
-static void convertKeywords(Token* Tok) {
-    for(Token* T = Tok; T->Kind != TK_EOF; T = T->Next) {
-        if(isKeyword(T)) {
-            T->Kind = TK_KEYWORD;
+static char* scanSSE2(char* P, int Class) {
+    while(true) {
+        // 临近页边界时逐字节检查
+        if(!loadIsSafe(P, 16)) {
+            if(!charIs(*P, Class))
+                return P;
+            P++;
+            continue;
         }
+
+        unsigned Mask = classMask16(_mm_loadu_si128((__m128i*)P), Class);
+        // 找到第一个不属于Class的字节
+        if(Mask != 0xFFFF)
+            return P + __builtin_ctz(~Mask);
+        P += 16;
     }
 }
 
-// 终结符解析
-Token* tokenize(char* P) {
-    CurrentInput = P;
-    Token Head = {};
-    Token* Cur = &Head;
+// AVX2实现：每次检查32个字节
+__attribute__((target("avx2")))
+static unsigned classMask32(__m256i C, int Class) {
+#define IN_RANGE32(X, Lo, Hi)                                                 \
+    _mm256_and_si256(_mm256_cmpgt_epi8(X, _mm256_set1_epi8((Lo) - 1)),       \
+                     _mm256_cmpgt_epi8(_mm256_set1_epi8((Hi) + 1), X))
+
+    if(Class == CC_SPACE)
+        return _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(C, _mm256_set1_epi8(' ')),
+                            IN_RANGE32(C, '\t', '\r')));
+
+    __m256i M = IN_RANGE32(C, '0', '9');
+    if(Class == CC_IDENT2) {
+        __m256i Lower = _mm256_or_si256(C, _mm256_set1_epi8(0x20));
+        M = _mm256_or_si256(M, IN_RANGE32(Lower, 'a', 'z'));
+        M = _mm256_or_si256(M, _mm256_cmpeq_epi8(C, _mm256_set1_epi8('_')));
+    }
+    return _mm256_movemask_epi8(M);
+#undef IN_RANGE32
+}
 
-    while(*P) {
-        //跳过所有空白、回车、\tab
-        if(isspace(*P)) {
-            ++P;
+__attribute__((target("avx2")))
+static char* scanAVX2(char* P, int Class) {
+    while(true) {
+        if(!loadIsSafe(P, 32)) {
+            if(!charIs(*P, Class))
+                return P;
+            P++;
             continue;
         }
 
-        //数字
-        if(isdigit(*P)) {
-            // Head仅作为头指针，用来表示链表入口，不存储信息
-            Cur->Next = newToken(TK_NUM, P, P);
-            
-            Cur = Cur->Next;
-            const char* OldPtr = P;
-            // strtoul第二个参数会被设置为numerical value的下一个character(相当于P++)
-            Cur->Val = strtoul(P, &P, 10);
-            Cur->Len = P - OldPtr;
-            continue;
-        }
+        unsigned Mask = classMask32(_mm256_loadu_si256((__m256i*)P), Class);
+        if(Mask != 0xFFFFFFFFu)
+            return P + __builtin_ctz(~Mask);
+        P += 32;
+    }
+}
+#endif
+
+// 当前扫描实现的种类
+static LexImpl CurImpl = LEX_AUTO;
+
+// 向量化扫描前先逐字节检查的字节数
+// 大多数空白和标识符都很短，短的连续字符直接逐字节处理更快
+#define SCAN_PREFIX 8
+
+// 跳过从P开始属于类别Class的连续字符，返回第一个不属于Class的字符
+static inline char* scanRun(char* P, int Class) {
+    if(CurImpl != LEX_SCALAR) {
+        for(int I = 0; I < SCAN_PREFIX; I++, P++)
+            if(!charIs(*P, Class))
+                return P;
+#ifdef __x86_64__
+        if(CurImpl == LEX_AVX2)
+            return scanAVX2(P, Class);
+        return scanSSE2(P, Class);
+#endif
+    }
+    return scanScalar(P, Class);
+}
 
-        //解析标识符或关键字
-        //[a-zA-Z_][a-zA-Z0-9_]*
-        if(isIdent1(*P)) {
-            char* Start = P;
-            do {
-                ++P;
-            } while(isIdent2(*P));
+// 选择扫描的实现，不支持时回退到较低的实现，返回实际使用的实现
+LexImpl lexSelectImpl(LexImpl Impl) {
+    initCharClass();
+
+#ifdef __x86_64__
+    // 运行时检测CPU是否支持AVX2，SSE2是x86-64的基本指令集
+    if(Impl == LEX_AUTO)
+        Impl = LEX_AVX2;
+    if(Impl == LEX_AVX2 && !__builtin_cpu_supports("avx2"))
+        Impl = LEX_SSE2;
+#else
+    Impl = LEX_SCALAR;
+#endif
+
+    if(Impl != LEX_AVX2 && Impl != LEX_SSE2)
+        Impl = LEX_SCALAR;
+
+    CurImpl = Impl;
+    return Impl;
+}
 
-            // do-while循环里面P多加了一次
-            Cur->Next = newToken(TK_IDENT, Start, P);
-            Cur = Cur->Next;
+// 读取十进制数字，溢出时与strtoul一样饱和为最大值
+static uint64_t readNumber(char* Start, char* End) {
+    uint64_t Val = 0;
+    for(char* P = Start; P < End; P++) {
+        uint64_t D = *P - '0';
+        if(Val > (UINT64_MAX - D) / 10)
+            return UINT64_MAX;
+        Val = Val * 10 + D;
+    }
+    return Val;
+}
 
-            continue;
+// 读取操作符
+static int readPunct(char* Ptr, Symbol* Sym)
+{
+    // 判断2字节操作符：==、!=、<=、>=
+    if(Ptr[1] == '=') {
+        switch(Ptr[0]) {
+        case '=':
+            *Sym = SYM_EQ;
+            return 2;
+        case '!':
+            *Sym = SYM_NE;
+            return 2;
+        case '<':
+            *Sym = SYM_LE;
+            return 2;
+        case '>':
+            *Sym = SYM_GE;
+            return 2;
         }
+    }
 
-        //解析操作符
-        int PunctLen = readPunct(P);
-        if(PunctLen) {
-            Cur->Next = newToken(TK_PUNCT, P, P + PunctLen);
-            Cur = Cur->Next;
-            //指针前进PunctLen的长度位
-            P = P + PunctLen;
-            continue;
+    // 判断1字节操作符，未知的操作符编号为SYM_NONE
+    *Sym = PunctSym[(unsigned char)*Ptr];
+    return charIs(*Ptr, CC_PUNCT) ? 1 : 0;
+}
+
+// 返回关键字的编号，不是关键字时返回SYM_NONE
+static Symbol keywordSym(Token* Tok) {
+    //遍历关键字列表进行匹配
+    for(int I = SYM_RETURN; I <= SYM_WHILE; I++) {
+        if(SymName[I][0] == Tok->Loc[0] && equal(Tok, SymName[I]))
+            return I;
+    }
+
+    return SYM_NONE;
+}
+
+// 预读窗口的大小，须为2的幂
+// 解析器最多向前查看一个终结符，且不会再访问已经越过的终结符，
+// 因此只需保留最近的少量终结符
+#define TOKEN_WINDOW 16
+
+// 终结符的环形预读窗口，第I个终结符存放在Window[I % TOKEN_WINDOW]中
+static Token Window[TOKEN_WINDOW];
+// 已经生成的终结符数量
+static int Produced;
+// 词法分析的当前位置
+static char* Cursor;
+
+// 从Cursor处读取一个终结符，存入Tok
+static void readToken(Token* Tok) {
+    char* P = Cursor;
+
+    //跳过所有空白、回车、\tab
+    //大多数空白只有一个字符，连续的空白才使用向量化的扫描
+    if(charIs(*P, CC_SPACE))
+        P = scanRun(P + 1, CC_SPACE);
+
+    // 输入结束
+    if(!*P) {
+        setToken(Tok, TK_EOF, P, P);
+        Cursor = P;
+        return;
+    }
+
+    //数字
+    if(charIs(*P, CC_DIGIT)) {
+        char* Start = P;
+        // 先找到数字的结尾，再计算数值
+        P = scanRun(P + 1, CC_DIGIT);
+        int64_t Val = readNumber(Start, P);
+        setToken(Tok, TK_NUM, Start, P);
+        Tok->Val = Val;
+        Cursor = P;
+        return;
+    }
+
+    //解析标识符或关键字
+    //[a-zA-Z_][a-zA-Z0-9_]*
+    if(charIs(*P, CC_IDENT1)) {
+        char* Start = P;
+        P = scanRun(P + 1, CC_IDENT2);
+
+        // 生成标识符时即判断是否为关键字，关键字的长度都在2~6之间
+        setToken(Tok, TK_IDENT, Start, P);
+        if(Tok->Len >= 2 && Tok->Len <= 6) {
+            Tok->Sym = keywordSym(Tok);
+            if(Tok->Sym != SYM_NONE)
+                Tok->Kind = TK_KEYWORD;
         }
+        Cursor = P;
+        return;
+    }
 
-        errorAt(P, "invalid token");
+    //解析操作符
+    Symbol Sym;
+    int PunctLen = readPunct(P, &Sym);
+    if(PunctLen) {
+        //指针前进PunctLen的长度位
+        setToken(Tok, TK_PUNCT, P, P + PunctLen);
+        Tok->Sym = Sym;
+        Cursor = P + PunctLen;
+        return;
     }
 
-    Cur->Next = newToken(TK_EOF, P, P);
+    errorAt(P, "invalid token");
+}
+
+// 返回Tok的下一个终结符，需要时才进行词法分析
+Token* nextToken(Token* Tok) {
+    // 终止符之后不再有终结符
+    if(Tok->Kind == TK_EOF)
+        return Tok;
 
-    // 将所有关键字的终结符都标识为KEYWORD
-    convertKeywords(Head.Next);
+    int Idx = Tok->Idx + 1;
+    Token* Next = &Window[Idx % TOKEN_WINDOW];
+
+    // 下一个终结符尚未生成，读取它，覆盖窗口中最旧的终结符
+    if(Idx == Produced) {
+        readToken(Next);
+        Next->Idx = Produced++;
+    }
+
+    return Next;
+}
 
-    return Head.Next;
-}
\ No newline at end of file
+// 本次词法分析已生成的终结符数
+int tokenCount(void) {
+    return Produced;
+}
+
+// 终结符解析，返回第一个终结符，后续终结符通过nextToken按需读取
+Token* tokenize(char* P) {
+    // 首次使用时，根据CPU选择扫描的实现
+    if(CurImpl == LEX_AUTO)
+        lexSelectImpl(LEX_AUTO);
+
+    CurrentInput = P;
+    Cursor = P;
+    Produced = 0;
+
+    Token* Tok = &Window[0];
+    readToken(Tok);
+    Tok->Idx = Produced++;
+    return Tok;
+}